@@ -0,0 +1,120 @@
+/*************************************************************************
+Public Education Forum Moderation Firehose Client
+Copyright (c) Steve Townsend 2025
+
+>>> SOURCE LICENSE >>>
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation (www.fsf.org); either version 3 of the
+License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+A copy of the GNU General Public License is available at
+http://www.fsf.org/licensing/licenses
+>>> END OF LICENSE >>>
+*************************************************************************/
+
+// nlohmann DOM parser against the arena DAG-CBOR decoder, on a real commit
+#include "car_index.hpp"
+#include "dag_cbor.hpp"
+#include "parser.hpp"
+#include <benchmark/benchmark.h>
+#include <array>
+#include <fstream>
+#include <memory_resource>
+
+namespace {
+// test data is JSON with {"bytes": [...], "subtype": n} for binary values
+nlohmann::json restore_binary(nlohmann::json item) {
+  if (item.is_object() && item.contains("bytes") && item["bytes"].is_array()) {
+    auto content(item["bytes"].template get<std::vector<uint8_t>>());
+    if (item.contains("subtype") && item["subtype"].is_number()) {
+      return nlohmann::json::binary(
+          content, item["subtype"].template get<std::uint64_t>());
+    }
+    return nlohmann::json::binary(content);
+  }
+  if (item.is_structured()) {
+    for (auto &next : item) {
+      next = restore_binary(next);
+    }
+  }
+  return item;
+}
+
+// firehose frame as received: header then message
+struct commit_frame {
+  commit_frame() {
+    std::ifstream input(std::string(BENCHMARK_DATA_PATH) +
+                        "raw_firehose_commit.json");
+    auto message(restore_binary(nlohmann::json::parse(input)));
+    auto header_cbor(nlohmann::json::to_cbor({{"op", 1}, {"t", "#commit"}}));
+    auto message_cbor(nlohmann::json::to_cbor(message));
+    _frame.assign(header_cbor.cbegin(), header_cbor.cend());
+    _frame.append(message_cbor.cbegin(), message_cbor.cend());
+    auto const &blocks(message["blocks"].get_binary());
+    _blocks.assign(blocks.cbegin(), blocks.cend());
+  }
+  std::string _frame;
+  std::vector<uint8_t> _blocks;
+};
+
+commit_frame const &commit() {
+  static commit_frame frame;
+  return frame;
+}
+} // namespace
+
+static void BM_NlohmannFrame(benchmark::State &state) {
+  auto const &frame(commit()._frame);
+  for (auto _ : state) {
+    parser frame_parser;
+    benchmark::DoNotOptimize(
+        frame_parser.json_from_cbor(frame.cbegin(), frame.cend()));
+  }
+  state.SetBytesProcessed(state.iterations() * frame.size());
+}
+BENCHMARK(BM_NlohmannFrame);
+
+static void BM_DagCborFrame(benchmark::State &state) {
+  auto const &frame(commit()._frame);
+  for (auto _ : state) {
+    dag_cbor::document document(frame);
+    benchmark::DoNotOptimize(document.items().data());
+  }
+  state.SetBytesProcessed(state.iterations() * frame.size());
+}
+BENCHMARK(BM_DagCborFrame);
+
+static void BM_NlohmannCar(benchmark::State &state) {
+  auto const &blocks(commit()._blocks);
+  for (auto _ : state) {
+    parser block_parser;
+    benchmark::DoNotOptimize(
+        block_parser.json_from_car(blocks.cbegin(), blocks.cend()));
+  }
+  state.SetBytesProcessed(state.iterations() * blocks.size());
+}
+BENCHMARK(BM_NlohmannCar);
+
+static void BM_DagCborCar(benchmark::State &state) {
+  auto const &blocks(commit()._blocks);
+  std::array<std::byte, 16384> initial;
+  for (auto _ : state) {
+    std::pmr::monotonic_buffer_resource arena(initial.data(), initial.size());
+    car_index index(blocks);
+    for (auto const &block : index.blocks()) {
+      std::string_view content(
+          reinterpret_cast<const char *>(block.second.data()),
+          block.second.size());
+      size_t offset(0);
+      benchmark::DoNotOptimize(dag_cbor::decode(content, offset, arena));
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * blocks.size());
+}
+BENCHMARK(BM_DagCborCar);
@@ -0,0 +1,168 @@
+/*************************************************************************
+Public Education Forum Moderation Firehose Client
+Copyright (c) Steve Townsend 2025
+
+>>> SOURCE LICENSE >>>
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation (www.fsf.org); either version 3 of the
+License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+A copy of the GNU General Public License is available at
+http://www.fsf.org/licensing/licenses
+>>> END OF LICENSE >>>
+*************************************************************************/
+
+// matcher throughput on the live filters, by rule count, text length and
+// thread count. Candidate texts come from the test posts and profiles, or
+// from MATCHER_BENCHMARK_CORPUS if set: a file of Jetstream messages, one
+// per line, such as a capture of the live feed.
+#include "common/bluesky/platform.hpp"
+#include "common/log_wrapper.hpp"
+#include "matcher.hpp"
+#include "parser.hpp"
+#include <algorithm>
+#include <benchmark/benchmark.h>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <spdlog/sinks/null_sink.h>
+#include <stdexcept>
+
+namespace {
+constexpr const char *Messages[] = {"post.json", "profile.json",
+                                    "abusive_profile.json"};
+// 0 is every rule in the filter file
+constexpr int64_t RuleCounts[] = {16, 64, 0};
+constexpr int64_t TextLengths[] = {64, 512, 4096};
+// candidates scanned per iteration
+constexpr size_t BatchSize = 64;
+
+std::string read_file(std::string const &filename) {
+  std::ifstream input(filename);
+  return std::string(std::istreambuf_iterator<char>(input),
+                     std::istreambuf_iterator<char>());
+}
+
+std::vector<std::string> corpus_texts() {
+  std::vector<std::string> messages;
+  if (char const *corpus = std::getenv("MATCHER_BENCHMARK_CORPUS")) {
+    std::ifstream input(corpus);
+    std::string line;
+    while (std::getline(input, line)) {
+      if (!line.empty())
+        messages.push_back(std::move(line));
+    }
+  } else {
+    for (auto const name : Messages) {
+      messages.push_back(read_file(std::string(BENCHMARK_DATA_PATH) + name));
+    }
+  }
+  std::vector<std::string> texts;
+  for (auto const &message : messages) {
+    try {
+      for (auto &next : parser().get_candidates_from_string(message)) {
+        if (!next._value.empty())
+          texts.push_back(std::move(next._value));
+      }
+    } catch (std::exception const &) {
+      // not JSON
+    }
+  }
+  return texts;
+}
+
+// Benchmark state shared by every case and thread, built once
+struct fixture {
+  fixture() {
+    logger = spdlog::null_logger_mt("matcher_benchmark");
+    logger->set_level(spdlog::level::off);
+
+    std::vector<std::string> rules;
+    std::ifstream input(std::string(BENCHMARK_CONFIG_PATH) + "live_filters");
+    std::string line;
+    while (std::getline(input, line)) {
+      if (line.length() < 2 || (line[0] == '#' && line[1] == '#'))
+        continue;
+      rules.push_back(line);
+    }
+    for (auto const count : RuleCounts) {
+      std::vector<matcher::rule> replacement;
+      for (auto const &rule : rules) {
+        if (count > 0 && replacement.size() == static_cast<size_t>(count))
+          break;
+        try {
+          matcher::rule parsed(rule);
+          if (parsed._track)
+            replacement.push_back(std::move(parsed));
+        } catch (std::exception const &) {
+          // malformed, as when loading the file
+        }
+      }
+      auto &target(_matchers[count]);
+      target = std::make_unique<matcher>();
+      target->refresh_rules(std::move(replacement));
+    }
+
+    // candidates of each length, cut from the corpus laid end to end
+    const std::vector<std::string> texts(corpus_texts());
+    std::string all_text;
+    for (auto const &text : texts) {
+      all_text.append(text).push_back(' ');
+    }
+    if (all_text.empty())
+      throw std::runtime_error("matcher benchmark corpus has no candidates");
+    for (auto const length : TextLengths) {
+      auto &batch(_candidates[length]);
+      size_t offset(0);
+      for (size_t next = 0; next < BatchSize; ++next) {
+        std::string value;
+        while (value.length() < static_cast<size_t>(length)) {
+          const size_t wanted(std::min(static_cast<size_t>(length) -
+                                           value.length(),
+                                       all_text.length() - offset));
+          value.append(all_text, offset, wanted);
+          offset = (offset + wanted) % all_text.length();
+        }
+        batch.push_back({std::string(bsky::AppBskyFeedPost), "text",
+                         std::move(value)});
+      }
+    }
+  }
+
+  std::map<int64_t, std::unique_ptr<matcher>> _matchers;
+  std::map<int64_t, candidate_list> _candidates;
+};
+
+fixture const &shared_fixture() {
+  static fixture instance;
+  return instance;
+}
+} // namespace
+
+static void BM_AllMatchesForCandidates(benchmark::State &state) {
+  auto const &setup(shared_fixture());
+  matcher const &rules(*setup._matchers.at(state.range(0)));
+  candidate_list const &candidates(setup._candidates.at(state.range(1)));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(rules.all_matches_for_candidates(candidates));
+  }
+  state.SetBytesProcessed(state.iterations() * candidates.size() *
+                          state.range(1));
+  state.counters["candidates"] = benchmark::Counter(
+      static_cast<double>(state.iterations() * candidates.size()),
+      benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_AllMatchesForCandidates)
+    ->ArgNames({"rules", "length"})
+    ->ArgsProduct({{std::begin(RuleCounts), std::end(RuleCounts)},
+                   {std::begin(TextLengths), std::end(TextLengths)}})
+    ->ThreadRange(1, 8)
+    ->UseRealTime();
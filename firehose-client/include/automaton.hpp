@@ -0,0 +1,388 @@
+#ifndef __automaton_hpp__
+#define __automaton_hpp__
+/*************************************************************************
+Public Education Forum Moderation Firehose Client
+Copyright (c) Steve Townsend 2025
+
+>>> SOURCE LICENSE >>>
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation (www.fsf.org); either version 3 of the
+License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+A copy of the GNU General Public License is available at
+http://www.fsf.org/licensing/licenses
+>>> END OF LICENSE >>>
+*************************************************************************/
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <limits>
+#include <map>
+#include <ostream>
+#include <span>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+// Aho-Corasick automaton over a fixed set of patterns, reporting pattern IDs.
+// Patterns are added, then compile() flattens the trie into arrays: per-state
+// sorted edge ranges, failure links and output lists that already include
+// every pattern reachable by following failure links. After compile() the
+// automaton is read-only, so any number of threads can scan concurrently,
+// and a scan never allocates.
+//
+// The compiled arrays can be written out as one image and later viewed in
+// place, e.g. from a memory-mapped file, instead of being rebuilt.
+template <typename CharT> class basic_automaton {
+public:
+  typedef uint32_t pattern_id;
+  typedef std::basic_string_view<CharT> view_type;
+  static constexpr pattern_id NoPattern =
+      std::numeric_limits<pattern_id>::max();
+
+  basic_automaton() {
+    _build.emplace_back();
+    _root_table = _root_next;
+  }
+  ~basic_automaton() = default;
+  // the tables may view the automaton's own storage
+  basic_automaton(basic_automaton const &) = delete;
+  basic_automaton &operator=(basic_automaton const &) = delete;
+
+  // Returns the pattern's ID, the existing one if it was added before.
+  // Empty patterns are not allowed and return NoPattern.
+  pattern_id add(view_type pattern) {
+    if (pattern.empty())
+      return NoPattern;
+    uint32_t current(Root);
+    for (CharT const next : pattern) {
+      auto found(_build[current]._edges.find(next));
+      if (found != _build[current]._edges.end()) {
+        current = found->second;
+        continue;
+      }
+      const uint32_t added(static_cast<uint32_t>(_build.size()));
+      _build[current]._edges.insert({next, added});
+      _build.emplace_back();
+      current = added;
+    }
+    if (_build[current]._terminal == NoPattern) {
+      _build[current]._terminal = static_cast<pattern_id>(_lengths.size());
+      _lengths.push_back(static_cast<uint32_t>(pattern.length()));
+      _length_table = _lengths;
+    }
+    return _build[current]._terminal;
+  }
+
+  void compile() {
+    const size_t count(_build.size());
+    std::vector<uint32_t> fail(count, Root);
+    std::vector<std::vector<pattern_id>> outputs(count);
+    // breadth-first, so the failure state is always complete before use
+    std::deque<uint32_t> pending;
+    for (auto const &edge : _build[Root]._edges) {
+      pending.push_back(edge.second);
+    }
+    if (_build[Root]._terminal != NoPattern)
+      outputs[Root].push_back(_build[Root]._terminal);
+    while (!pending.empty()) {
+      const uint32_t current(pending.front());
+      pending.pop_front();
+      if (_build[current]._terminal != NoPattern)
+        outputs[current].push_back(_build[current]._terminal);
+      auto const &inherited(outputs[fail[current]]);
+      outputs[current].insert(outputs[current].end(), inherited.cbegin(),
+                              inherited.cend());
+      for (auto const &edge : _build[current]._edges) {
+        uint32_t fallback(fail[current]);
+        while (true) {
+          auto found(_build[fallback]._edges.find(edge.first));
+          if (found != _build[fallback]._edges.end()) {
+            fail[edge.second] = found->second;
+            break;
+          }
+          if (fallback == Root)
+            break;
+          fallback = fail[fallback];
+        }
+        pending.push_back(edge.second);
+      }
+    }
+
+    _states.clear();
+    _edges.clear();
+    _outputs.clear();
+    _states.reserve(count);
+    for (uint32_t index = 0; index < count; ++index) {
+      state next;
+      next._first_edge = static_cast<uint32_t>(_edges.size());
+      // std::map iterates in key order, keeping each edge range sorted
+      for (auto const &edge : _build[index]._edges) {
+        _edges.push_back({edge.first, edge.second});
+      }
+      next._edge_count =
+          static_cast<uint32_t>(_edges.size()) - next._first_edge;
+      next._fail = fail[index];
+      next._first_output = static_cast<uint32_t>(_outputs.size());
+      _outputs.insert(_outputs.end(), outputs[index].cbegin(),
+                      outputs[index].cend());
+      next._output_count =
+          static_cast<uint32_t>(_outputs.size()) - next._first_output;
+      _states.push_back(next);
+    }
+    // the root is left on every mismatch, so resolve it directly
+    std::fill(std::begin(_root_next), std::end(_root_next), Root);
+    for (auto const &edge : _build[Root]._edges) {
+      if (as_unsigned(edge.first) < RootTableSize)
+        _root_next[as_unsigned(edge.first)] = edge.second;
+    }
+    _build.clear();
+    _build.shrink_to_fit();
+    _state_table = _states;
+    _edge_table = _edges;
+    _output_table = _outputs;
+  }
+
+  inline size_t pattern_count() const { return _length_table.size(); }
+  inline size_t pattern_length(const pattern_id id) const {
+    return _length_table[id];
+  }
+  inline size_t state_count() const { return _state_table.size(); }
+
+  // Image of the compiled automaton: image_header, root table, states,
+  // edges, outputs and pattern lengths, each padded to 8 bytes
+  size_t image_size() const {
+    return sizeof(image_header) + padded(sizeof(_root_next)) +
+           padded(_state_table.size_bytes()) +
+           padded(_edge_table.size_bytes()) +
+           padded(_output_table.size_bytes()) +
+           padded(_length_table.size_bytes());
+  }
+  void write_image(std::ostream &out) const {
+    image_header header{sizeof(CharT),
+                        sizeof(state),
+                        sizeof(edge),
+                        static_cast<uint32_t>(_state_table.size()),
+                        static_cast<uint32_t>(_edge_table.size()),
+                        static_cast<uint32_t>(_output_table.size()),
+                        static_cast<uint32_t>(_length_table.size()),
+                        0};
+    write_padded(out, &header, sizeof(header));
+    write_padded(out, _root_table, sizeof(_root_next));
+    write_padded(out, _state_table.data(), _state_table.size_bytes());
+    write_padded(out, _edge_table.data(), _edge_table.size_bytes());
+    write_padded(out, _output_table.data(), _output_table.size_bytes());
+    write_padded(out, _length_table.data(), _length_table.size_bytes());
+  }
+  // Views an image from write_image, 8-byte aligned, that must outlive the
+  // automaton. Returns false if it is malformed, inconsistent or from another
+  // build.
+  bool load_image(std::string_view image) {
+    image_header header;
+    if (image.length() < sizeof(header))
+      return false;
+    std::memcpy(&header, image.data(), sizeof(header));
+    if (header._char_size != sizeof(CharT) ||
+        header._state_size != sizeof(state) ||
+        header._edge_size != sizeof(edge) || header._state_count == 0)
+      return false;
+    size_t offset(sizeof(header));
+    auto next_section([&](const size_t bytes) -> char const * {
+      if (offset + padded(bytes) > image.length())
+        return nullptr;
+      char const *section(image.data() + offset);
+      offset += padded(bytes);
+      return section;
+    });
+    auto root(next_section(sizeof(_root_next)));
+    auto states(next_section(header._state_count * sizeof(state)));
+    auto edges(next_section(header._edge_count * sizeof(edge)));
+    auto outputs(next_section(header._output_count * sizeof(pattern_id)));
+    auto lengths(next_section(header._pattern_count * sizeof(uint32_t)));
+    if (!root || !states || !edges || !outputs || !lengths)
+      return false;
+    std::span<const state> state_table(reinterpret_cast<state const *>(states),
+                                       header._state_count);
+    std::span<const edge> edge_table(reinterpret_cast<edge const *>(edges),
+                                     header._edge_count);
+    std::span<const pattern_id> output_table(
+        reinterpret_cast<pattern_id const *>(outputs), header._output_count);
+    std::span<const uint32_t> length_table(
+        reinterpret_cast<uint32_t const *>(lengths), header._pattern_count);
+    if (!is_consistent(reinterpret_cast<uint32_t const *>(root), state_table,
+                       edge_table, output_table, length_table))
+      return false;
+    _build.clear();
+    _build.shrink_to_fit();
+    _root_table = reinterpret_cast<uint32_t const *>(root);
+    _state_table = state_table;
+    _edge_table = edge_table;
+    _output_table = output_table;
+    _length_table = length_table;
+    return true;
+  }
+
+  // Calls visit(pattern_id, end) for every occurrence of every pattern, with
+  // end one past the last matched character, in order of end position.
+  // visit returns false to stop the scan early.
+  template <typename Visitor> void scan(view_type text, Visitor &&visit) const {
+    if (_state_table.empty())
+      return;
+    uint32_t current(Root);
+    for (size_t offset = 0; offset < text.length(); ++offset) {
+      current = next_state(current, text[offset]);
+      state const &reached(_state_table[current]);
+      for (uint32_t output = 0; output < reached._output_count; ++output) {
+        if (!visit(_output_table[reached._first_output + output], offset + 1))
+          return;
+      }
+    }
+  }
+
+private:
+  static constexpr uint32_t Root = 0;
+  // every byte, or the ASCII range of wider characters
+  static constexpr size_t RootTableSize = sizeof(CharT) == 1 ? 256 : 128;
+
+  struct build_state {
+    std::map<CharT, uint32_t> _edges;
+    pattern_id _terminal = NoPattern;
+  };
+  struct state {
+    uint32_t _first_edge;
+    uint32_t _edge_count;
+    uint32_t _fail;
+    uint32_t _first_output;
+    uint32_t _output_count;
+  };
+  struct edge {
+    CharT _label;
+    uint32_t _target;
+  };
+  struct image_header {
+    uint32_t _char_size;
+    uint32_t _state_size;
+    uint32_t _edge_size;
+    uint32_t _state_count;
+    uint32_t _edge_count;
+    uint32_t _output_count;
+    uint32_t _pattern_count;
+    uint32_t _reserved;
+  };
+
+  static inline size_t padded(const size_t bytes) {
+    return (bytes + 7) & ~size_t(7);
+  }
+  static void write_padded(std::ostream &out, void const *data,
+                           const size_t bytes) {
+    static constexpr char Padding[8] = {};
+    out.write(static_cast<char const *>(data),
+              static_cast<std::streamsize>(bytes));
+    out.write(Padding, static_cast<std::streamsize>(padded(bytes) - bytes));
+  }
+
+  // Every index in the tables is in bounds, the edges form a tree from the
+  // root, failure links lead to shallower states and a state's patterns are
+  // no longer than the text that reaches it. A scan of an image that passes
+  // cannot read outside it, loop, or report a match starting before the
+  // text.
+  static bool is_consistent(uint32_t const *root,
+                            std::span<const state> states,
+                            std::span<const edge> edges,
+                            std::span<const pattern_id> outputs,
+                            std::span<const uint32_t> lengths) {
+    // depth in the trie, set on reaching each state by its only edge
+    std::vector<uint32_t> depth(states.size(), 0);
+    std::vector<bool> reached(states.size(), false);
+    reached[Root] = true;
+    std::deque<uint32_t> pending{Root};
+    while (!pending.empty()) {
+      const uint32_t current(pending.front());
+      pending.pop_front();
+      state const &from(states[current]);
+      if (uint64_t(from._first_edge) + from._edge_count > edges.size())
+        return false;
+      for (auto const &next :
+           edges.subspan(from._first_edge, from._edge_count)) {
+        if (next._target >= states.size() || reached[next._target])
+          return false;
+        reached[next._target] = true;
+        depth[next._target] = depth[current] + 1;
+        pending.push_back(next._target);
+      }
+    }
+    for (uint32_t index = 0; index < states.size(); ++index) {
+      state const &next(states[index]);
+      if (!reached[index] || next._fail >= states.size() ||
+          (index != Root && depth[next._fail] >= depth[index]) ||
+          uint64_t(next._first_output) + next._output_count > outputs.size())
+        return false;
+      for (auto const id :
+           outputs.subspan(next._first_output, next._output_count)) {
+        if (id >= lengths.size() || lengths[id] == 0 ||
+            lengths[id] > depth[index])
+          return false;
+      }
+    }
+    return std::all_of(root, root + RootTableSize, [&](uint32_t const target) {
+      return target == Root || (target < states.size() && depth[target] == 1);
+    });
+  }
+
+  static inline auto as_unsigned(CharT const value) {
+    return static_cast<std::make_unsigned_t<CharT>>(value);
+  }
+
+  inline uint32_t next_state(uint32_t current, CharT const next) const {
+    while (true) {
+      if (current == Root) {
+        return as_unsigned(next) < RootTableSize
+                   ? _root_table[as_unsigned(next)]
+                   : find_edge(_state_table[Root], next, Root);
+      }
+      state const &from(_state_table[current]);
+      const uint32_t target(find_edge(from, next, NoPattern));
+      if (target != NoPattern)
+        return target;
+      current = from._fail;
+    }
+  }
+
+  inline uint32_t find_edge(state const &from, CharT const next,
+                            uint32_t const missing) const {
+    auto first(_edge_table.begin() + from._first_edge);
+    auto last(first + from._edge_count);
+    auto found(std::lower_bound(
+        first, last, next,
+        [](edge const &lhs, CharT const rhs) { return lhs._label < rhs; }));
+    return found != last && found->_label == next ? found->_target : missing;
+  }
+
+  std::vector<build_state> _build;
+  // compiled here, or viewed from an image
+  std::vector<state> _states;
+  std::vector<edge> _edges;
+  std::vector<pattern_id> _outputs;
+  std::vector<uint32_t> _lengths;
+  uint32_t _root_next[RootTableSize];
+  // the tables scanned
+  std::span<const state> _state_table;
+  std::span<const edge> _edge_table;
+  std::span<const pattern_id> _output_table;
+  std::span<const uint32_t> _length_table;
+  uint32_t const *_root_table;
+};
+
+// over UTF-8 bytes, as used by the matcher
+typedef basic_automaton<char> utf8_automaton;
+typedef basic_automaton<wchar_t> wautomaton;
+
+#endif
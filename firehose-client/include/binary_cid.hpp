@@ -0,0 +1,84 @@
+#ifndef __binary_cid_hpp__
+#define __binary_cid_hpp__
+/*************************************************************************
+Public Education Forum Moderation Firehose Client
+Copyright (c) Steve Townsend 2025
+
+>>> SOURCE LICENSE >>>
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation (www.fsf.org); either version 3 of the
+License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+A copy of the GNU General Public License is available at
+http://www.fsf.org/licensing/licenses
+>>> END OF LICENSE >>>
+*************************************************************************/
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <span>
+#include <string>
+
+namespace atproto {
+
+// CID with a 32-byte sha2-256 multihash, held as its 36 raw bytes: version,
+// codec, hash code, digest length, digest. A CIDv0 is the bare multihash,
+// kept after two zero bytes so the digest offset is the same. Used to key
+// in-pipeline lookups without building the base32 form, which is only
+// rendered when the CID is logged or sent to an API.
+class binary_cid {
+public:
+  static constexpr size_t Size = 36;
+  static constexpr size_t DigestOffset = 4;
+  static constexpr size_t V0Offset = 2;
+  typedef std::span<const uint8_t> bytes;
+
+  binary_cid() = default;
+  // raw CID bytes, 36 for CIDv1 or 34 for CIDv0. Throws
+  // std::invalid_argument for other sizes.
+  explicit binary_cid(bytes raw);
+  ~binary_cid() = default;
+
+  // DAG-CBOR link (tag 42) bytes carry a leading multibase zero
+  static binary_cid from_link(bytes link);
+
+  // the digest length is never zero once set
+  inline bool is_valid() const { return _bytes[DigestOffset - 1] != 0; }
+  inline bool is_v0() const { return _bytes[0] == 0; }
+  // the bytes as they were on the wire, 34 for CIDv0
+  inline bytes raw() const {
+    return is_v0() ? bytes(_bytes).subspan(V0Offset) : bytes(_bytes);
+  }
+  // base32 display form, allocates
+  std::string to_string() const;
+
+  bool operator==(binary_cid const &other) const = default;
+
+  // the digest is already uniformly distributed, no need to mix it
+  inline size_t hash() const {
+    size_t result;
+    std::memcpy(&result, _bytes.data() + DigestOffset, sizeof(result));
+    return result;
+  }
+
+private:
+  std::array<uint8_t, Size> _bytes = {};
+};
+
+} // namespace atproto
+
+template <> struct std::hash<atproto::binary_cid> {
+  inline size_t operator()(atproto::binary_cid const &cid) const noexcept {
+    return cid.hash();
+  }
+};
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef __car_index_hpp__
+#define __car_index_hpp__
+/*************************************************************************
+Public Education Forum Moderation Firehose Client
+Copyright (c) Steve Townsend 2025
+
+>>> SOURCE LICENSE >>>
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation (www.fsf.org); either version 3 of the
+License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+A copy of the GNU General Public License is available at
+http://www.fsf.org/licensing/licenses
+>>> END OF LICENSE >>>
+*************************************************************************/
+
+#include <cstdint>
+#include <span>
+#include <string_view>
+#include <unordered_map>
+
+// Index of the blocks in a commit CAR by binary CID, without decoding them.
+// Lets the caller decode only the records that ops refer to and skip MST
+// nodes. Views point into the CAR, which must outlive the index.
+// Layout per https://ipld.io/specs/transport/car/carv1/
+class car_index {
+public:
+  typedef std::span<const uint8_t> bytes;
+
+  car_index() = delete;
+  car_index(bytes car);
+  ~car_index() = default;
+
+  // false if the CAR was truncated or malformed, blocks before the fault are
+  // still indexed
+  inline bool is_valid() const { return _valid; }
+  inline size_t size() const { return _blocks.size(); }
+  // DAG-CBOR content of the block, empty if not present
+  bytes find(bytes cid) const;
+  inline std::unordered_map<std::string_view, bytes> const &blocks() const {
+    return _blocks;
+  }
+
+private:
+  bool read_varint(bytes car, size_t &offset, uint64_t &value) const;
+  bool read_cid(bytes car, size_t &offset) const;
+
+  std::unordered_map<std::string_view, bytes> _blocks;
+  bool _valid = false;
+};
+
+#endif
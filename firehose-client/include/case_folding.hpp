@@ -0,0 +1,43 @@
+#ifndef __case_folding_hpp__
+#define __case_folding_hpp__
+/*************************************************************************
+Public Education Forum Moderation Firehose Client
+Copyright (c) Steve Townsend 2025
+
+>>> SOURCE LICENSE >>>
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation (www.fsf.org); either version 3 of the
+License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+A copy of the GNU General Public License is available at
+http://www.fsf.org/licensing/licenses
+>>> END OF LICENSE >>>
+*************************************************************************/
+
+#include <string>
+#include <string_view>
+
+// Unicode default full case folding applied directly to UTF-8, giving the
+// same result as ICU u_strFoldCase without converting to UTF-16 and back.
+// Runs of ASCII are folded 16 bytes at a time. Other BMP code points use a
+// two-stage table precomputed from ICU at first use. Malformed UTF-8 is
+// replaced by U+FFFD.
+namespace case_folding {
+
+// output is overwritten, reusing its capacity
+void fold(std::string_view input, std::string &output);
+std::string folded(std::string_view input);
+
+// code point starting at offset, or ending just before it
+char32_t code_point_at(std::string_view text, const size_t offset);
+char32_t code_point_before(std::string_view text, const size_t offset);
+
+} // namespace case_folding
+
+#endif
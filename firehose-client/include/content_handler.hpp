@@ -20,38 +20,208 @@ http://www.fsf.org/licensing/licenses
 >>> END OF LICENSE >>>
 *************************************************************************/
 
+#include "blockingconcurrentqueue.h"
+#include "common/controller.hpp"
 #include "common/log_wrapper.hpp"
+#include "common/metrics_factory.hpp"
+#include "frame_pool.hpp"
 #include "matcher.hpp"
 #include "moderation/action_router.hpp"
+#include "moderation/auxiliary_data.hpp"
 #include "moderation/embed_checker.hpp"
+#include "parser.hpp"
 #include "post_processor.hpp"
-#include <boost/beast/core.hpp>
+#include "resequencer.hpp"
+#include "yaml-cpp/yaml.h"
+#include <algorithm>
+#include <chrono>
+#include <optional>
+#include <thread>
+#include <vector>
 
-namespace beast = boost::beast; // from <boost/beast.hpp>
+// Raw websocket frame, tagged with its position on the wire
+struct raw_frame {
+  uint64_t _ordinal = 0;
+  frame_ptr _data;
+};
 
+// Decodes websocket frames into payloads for post-processing. With decode
+// threads configured the reader only queues raw frames, a worker pool decodes
+// them and results are restored to wire order before post-processing. With
+// zero decode threads, frames are decoded inline on the reader thread.
+// At most QueueLimit frames are between the reader and post-processing, so
+// when post-processing stalls the reader waits and the websocket backs up.
+// Each decoder takes whatever burst of frames is queued, up to the batch
+// limit, and matches their candidates in one pass.
 template <typename PAYLOAD> class content_handler {
 public:
-  content_handler() = default;
+  static constexpr size_t QueueLimit = 10000;
+  static constexpr size_t DefaultDecodeThreads = 4;
+  static constexpr size_t DefaultDecodeBatch = 16;
+  // how long an idle decoder, or a reader waiting for admission, waits
+  // before checking for shutdown
+  static constexpr std::chrono::milliseconds DequeueTimeout =
+      std::chrono::milliseconds(100);
+
+  content_handler()
+      : _decode_queue(QueueLimit),
+        _resequencer(
+            [this](decoded &&result) { pass_on(std::move(result)); },
+            QueueLimit) {}
   ~content_handler() = default;
 
-  void handle(beast::flat_buffer const &beast_data) {
-    auto matches(matcher::shared().find_all_matches(beast_data));
+  void set_config(YAML::Node const &settings) {
+    _number_of_threads =
+        settings["decode_threads"].as<size_t>(DefaultDecodeThreads);
+    _batch_limit = std::max(
+        settings["decode_batch"].as<size_t>(DefaultDecodeBatch), size_t(1));
+    if (settings["admission"]) {
+      _post_processor.set_config(settings["admission"]);
+    }
+  }
+
+  void start() {
+    _threads.reserve(_number_of_threads);
+    for (size_t count = 0; count < _number_of_threads; ++count) {
+      _threads.push_back(std::thread([&, this] {
+        try {
+          std::vector<raw_frame> frames(_batch_limit);
+          while (controller::instance().is_active()) {
+            const size_t count(_decode_queue.wait_dequeue_bulk_timed(
+                frames.begin(), _batch_limit, DequeueTimeout));
+            if (count == 0)
+              continue;
+            metrics_factory::instance()
+                .get_gauge("process_operation")
+                .Get({{"decoder", "backlog"}})
+                .Decrement(static_cast<double>(count));
+            decode_batch(frames, count);
+          }
+        } catch (std::exception const &exc) {
+          REL_ERROR("decoder exception {}", exc.what());
+          controller::instance().force_stop();
+        }
+        REL_INFO("decoder stopping");
+      }));
+    }
+  }
+
+  // highest seq post-processed in wire order, 0 if none yet
+  inline int64_t last_processed() const {
+    return _post_processor.last_processed();
+  }
+
+  void handle(frame_ptr &&frame) {
+    if (_threads.empty()) {
+      decoded result;
+      try {
+        result = decode(std::move(frame));
+      } catch (std::exception const &exc) {
+        REL_ERROR("decoder error {} on frame {}", exc.what(), _next_ordinal);
+      }
+      ++_next_ordinal;
+      pass_on(std::move(result));
+      return;
+    }
+    if (!_resequencer.wait_admission(_next_ordinal, std::chrono::seconds(0))) {
+      metrics_factory::instance()
+          .get_counter("post_processor_admission")
+          .Get({{"class", "decoder"}, {"admission", "delayed"}})
+          .Increment();
+      do {
+        if (!controller::instance().is_active())
+          return;
+      } while (!_resequencer.wait_admission(_next_ordinal, DequeueTimeout));
+    }
+    _decode_queue.enqueue(raw_frame{_next_ordinal++, std::move(frame)});
+    metrics_factory::instance()
+        .get_gauge("process_operation")
+        .Get({{"decoder", "backlog"}})
+        .Increment();
+  }
+
+private:
+  // The payload for a frame, or the seq of a frame that needs no
+  // post-processing
+  struct decoded {
+    std::optional<PAYLOAD> _payload;
+    int64_t _seq = 0;
+  };
+
+  decoded decode(frame_ptr &&frame) {
+    auto matches(matcher::shared().find_all_matches(*frame));
+    return matched(std::move(frame), std::move(matches));
+  }
+
+  decoded matched(frame_ptr &&frame, match_results &&matches) {
     // No match, or all eliminated by contingent match processing
     if (matches.empty()) {
-      return;
+      return {{}, PAYLOAD::seq_from_frame(*frame)};
+    }
+    return {PAYLOAD(std::move(frame), std::move(matches))};
+  }
+
+  // In wire order. A frame without a payload counts as processed once the
+  // payloads queued ahead of it are, so a restart never resumes past them.
+  void pass_on(decoded &&result) {
+    if (result._payload.has_value()) {
+      _post_processor.wait_enqueue(std::move(result._payload.value()));
+    } else if (result._seq != 0) {
+      _post_processor.skip(result._seq);
     }
-    std::string json_msg(boost::beast::buffers_to_string(beast_data.data()));
+  }
 
-    _post_processor.wait_enqueue(PAYLOAD(json_msg, matches));
+  // Decodes the first count frames and completes their ordinals. Every
+  // ordinal must complete, or later frames are never released.
+  void decode_batch(std::vector<raw_frame> &frames, const size_t count) {
+    std::vector<candidate_list> candidates(count);
+    std::vector<bool> failed(count, false);
+    parser frame_parser;
+    for (size_t index = 0; index < count; ++index) {
+      try {
+        candidates[index] =
+            frame_parser.get_candidates_from_frame(*frames[index]._data);
+      } catch (std::exception const &exc) {
+        REL_ERROR("decoder error {} on frame {}", exc.what(),
+                  frames[index]._ordinal);
+        failed[index] = true;
+      }
+    }
+    auto matches(matcher::shared().all_matches_for_batch(candidates));
+    for (size_t index = 0; index < count; ++index) {
+      std::optional<decoded> result;
+      if (!failed[index]) {
+        try {
+          result = matched(std::move(frames[index]._data),
+                           std::move(matches[index]));
+        } catch (std::exception const &exc) {
+          REL_ERROR("decoder error {} on frame {}", exc.what(),
+                    frames[index]._ordinal);
+        }
+      }
+      _resequencer.complete(frames[index]._ordinal, std::move(result));
+      frames[index]._data.reset();
+    }
   }
 
-private:
   post_processor<PAYLOAD> _post_processor;
+  // Declare queue between websocket and decoders
+  moodycamel::BlockingConcurrentQueue<raw_frame> _decode_queue;
+  resequencer<decoded> _resequencer;
+  size_t _number_of_threads = DefaultDecodeThreads;
+  // most frames one decoder takes from the queue at once
+  size_t _batch_limit = DefaultDecodeBatch;
+  std::vector<std::thread> _threads;
+  // only the reader thread assigns ordinals
+  uint64_t _next_ordinal = 0;
 };
 
 class firehose_payload;
 template <>
-void content_handler<firehose_payload>::handle(
-    beast::flat_buffer const &beast_data);
+content_handler<firehose_payload>::decoded
+content_handler<firehose_payload>::decode(frame_ptr &&frame);
+template <>
+void content_handler<firehose_payload>::decode_batch(
+    std::vector<raw_frame> &frames, const size_t count);
 
-#endif
\ No newline at end of file
+#endif
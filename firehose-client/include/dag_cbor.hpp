@@ -0,0 +1,179 @@
+#ifndef __dag_cbor_hpp__
+#define __dag_cbor_hpp__
+/*************************************************************************
+Public Education Forum Moderation Firehose Client
+Copyright (c) Steve Townsend 2025
+
+>>> SOURCE LICENSE >>>
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation (www.fsf.org); either version 3 of the
+License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+A copy of the GNU General Public License is available at
+http://www.fsf.org/licensing/licenses
+>>> END OF LICENSE >>>
+*************************************************************************/
+
+#include "nlohmann/json.hpp"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Streaming DAG-CBOR decoder. Strings, byte strings and links are views into
+// the input. Arrays and maps are allocated from a caller-supplied arena, so
+// a decoded message costs a few arena chunks and no per-node heap
+// allocations. Values are trivially destructible and the arena is released
+// in one go. Per https://ipld.io/specs/codecs/dag-cbor/spec/
+namespace dag_cbor {
+
+// bound recursion on hostile input, deeper nesting is a decode_error
+constexpr size_t MaxDepth = 64;
+
+// malformed input
+class decode_error : public std::runtime_error {
+public:
+  using std::runtime_error::runtime_error;
+};
+// value accessed as the wrong type, or missing map key
+class type_error : public std::runtime_error {
+public:
+  using std::runtime_error::runtime_error;
+};
+
+enum class kind : uint8_t {
+  null_,
+  boolean,
+  integer,
+  floating,
+  bytes,
+  text,
+  array,
+  map,
+  // tag 42 CID, bytes include the leading multibase zero
+  link
+};
+
+typedef std::span<const uint8_t> bytes;
+
+struct entry;
+class value {
+public:
+  value() = default;
+
+  inline kind type() const { return _kind; }
+  inline bool is_null() const { return _kind == kind::null_; }
+  inline bool is_text() const { return _kind == kind::text; }
+  inline bool is_array() const { return _kind == kind::array; }
+  inline bool is_map() const { return _kind == kind::map; }
+  inline bool is_link() const { return _kind == kind::link; }
+
+  bool as_bool() const;
+  int64_t as_integer() const;
+  double as_double() const;
+  std::string_view as_text() const;
+  // bytes or link
+  bytes as_bytes() const;
+  std::span<const value> items() const;
+  std::span<const entry> entries() const;
+
+  // map lookup, nullptr if absent
+  value const *find(std::string_view key) const;
+  inline bool contains(std::string_view key) const {
+    return find(key) != nullptr;
+  }
+  // map lookup, throws type_error if absent
+  value const &operator[](std::string_view key) const;
+  // array or map element count, 0 otherwise
+  size_t size() const;
+
+private:
+  friend class reader;
+  kind _kind = kind::null_;
+  bool _boolean = false;
+  int64_t _integer = 0;
+  double _floating = 0.0;
+  const void *_data = nullptr;
+  size_t _size = 0;
+};
+
+struct entry {
+  std::string_view _key;
+  value _value;
+};
+
+// Decodes one item starting at offset, advancing offset past it
+value decode(std::string_view data, size_t &offset,
+             std::pmr::memory_resource &arena);
+
+// For diagnostics and for callers that still need a DOM
+nlohmann::json to_json(value const &item);
+
+// A frame decoded as a sequence of items, e.g. firehose header then message.
+// Owns the arena, views into the frame which must outlive the document.
+class document {
+public:
+  // covers a typical firehose message without going to the heap
+  static constexpr size_t InitialArenaBytes = 2048;
+
+  document() = delete;
+  document(std::string_view frame);
+  ~document() = default;
+  document(document const &) = delete;
+  document &operator=(document const &) = delete;
+
+  // decodes another frame, reusing the arena
+  void assign(std::string_view frame);
+
+  inline std::span<const value> items() const { return _items; }
+
+private:
+  std::array<std::byte, InitialArenaBytes> _initial;
+  std::pmr::monotonic_buffer_resource _arena;
+  std::pmr::vector<value> _items;
+};
+
+// Recycled documents. The arena lives inside the document, which therefore
+// cannot move, and the payload that owns it is moved between threads. A
+// document goes back to the pool, arena intact, when its owner is destroyed.
+class document_pool {
+public:
+  static constexpr size_t MaxPooled = 1024;
+
+  struct releaser {
+    void operator()(document *item) const;
+  };
+  typedef std::unique_ptr<document, releaser> document_ptr;
+
+  static document_pool &instance();
+
+  // decodes the frame into a free document, throws decode_error if malformed
+  document_ptr acquire(std::string_view frame);
+  void release(document *item);
+
+private:
+  document_pool() = default;
+  ~document_pool() = default;
+
+  std::mutex _lock;
+  std::vector<document *> _free;
+};
+
+typedef document_pool::document_ptr document_ptr;
+
+} // namespace dag_cbor
+
+#endif
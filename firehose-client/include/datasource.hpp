@@ -24,17 +24,27 @@ http://www.fsf.org/licensing/licenses
 #include <boost/beast/core.hpp>
 #include <boost/beast/websocket.hpp>
 #include <boost/beast/websocket/ssl.hpp>
+#include <algorithm>
 #include <cstdlib>
+#include <format>
 #include <functional>
 #include <iostream>
+#include <optional>
 #include <prometheus/counter.h>
+#include <prometheus/labels.h>
+#include <random>
 #include <string>
+#include <string_view>
+#include <vector>
 
 #include "common/config.hpp"
 #include "common/controller.hpp"
 #include "common/log_wrapper.hpp"
 #include "common/metrics_factory.hpp"
 #include "content_handler.hpp"
+#include "frame_decompressor.hpp"
+#include "frame_log.hpp"
+#include "frame_pool.hpp"
 #include "matcher.hpp"
 #include "project_defs.hpp"
 
@@ -52,6 +62,26 @@ inline bool is_full(config const &settings) {
               .contains(jetstream);
 }
 
+// Jetstream sends identity and account events on every connection, whatever
+// the collection filter. The top-level kind precedes the event body.
+inline bool is_jetstream_commit(std::string_view frame) {
+  constexpr std::string_view kind = "\"kind\":\"";
+  size_t found(frame.find(kind));
+  return found != std::string_view::npos &&
+         frame.substr(found + kind.size()).starts_with("commit\"");
+}
+
+// content of the first string after member, e.g. "\"did\":\"", empty if
+// there is none. Jetstream DIDs and NSIDs are never escaped.
+inline std::string_view jetstream_string(std::string_view frame,
+                                         std::string_view member) {
+  size_t found(frame.find(member));
+  if (found == std::string_view::npos)
+    return {};
+  found += member.size();
+  return frame.substr(found, frame.find('"', found) - found);
+}
+
 template <typename PAYLOAD> class datasource {
 public:
   static datasource &instance() {
@@ -70,8 +100,63 @@ public:
     _subscription =
         _settings->get_config()[PROJECT_NAME]["datasource"]["subscription"]
             .as<std::string>();
-    if (cursor != 0) {
-      _subscription.append(std::format("?cursor={}", cursor));
+    auto const &datasource_config(
+        _settings->get_config()[PROJECT_NAME]["datasource"]);
+    // Jetstream only, dictionary from
+    // https://github.com/bluesky-social/jetstream/tree/main/pkg/models
+    if (datasource_config["compression"]) {
+      _dictionary = std::make_shared<const zstd_dictionary>(
+          datasource_config["compression"]["dictionary"].as<std::string>());
+      _max_frame_bytes =
+          datasource_config["compression"]["max_frame_kb"].as<size_t>(
+              frame_decompressor::DefaultMaxFrameBytes / 1024) *
+          1024;
+      _subscription.append(std::format(
+          "{}compress=true", _subscription.contains('?') ? '&' : '?'));
+    }
+    _start_cursor = cursor;
+    // Jetstream only, one connection per shard with server-side filters
+    if (datasource_config["shards"]) {
+      if (is_full(*_settings)) {
+        REL_WARNING("datasource shards need Jetstream, ignored");
+      } else {
+        bool first(true);
+        for (auto const &shard_config : datasource_config["shards"]) {
+          add_shard(shard_config, first);
+          first = false;
+        }
+      }
+    }
+    if (_shards.empty()) {
+      add_shard(YAML::Node(), true);
+    }
+    if (datasource_config["reconnect"]) {
+      _initial_backoff = std::chrono::milliseconds(
+          datasource_config["reconnect"]["initial_ms"].as<int64_t>(
+              DefaultInitialBackoff.count()));
+      _max_backoff = std::chrono::milliseconds(
+          datasource_config["reconnect"]["max_ms"].as<int64_t>(
+              DefaultMaxBackoff.count()));
+    }
+    for (auto &this_shard : _shards) {
+      this_shard->_handler.set_config(datasource_config);
+    }
+    // replay from a capture log supersedes the live feed, and is not
+    // captured again
+    if (datasource_config["replay"]) {
+      _replay_directory =
+          datasource_config["replay"]["directory"].as<std::string>();
+      _replay_from_seq =
+          datasource_config["replay"]["from_seq"].as<int64_t>(cursor);
+      _replay_speed = datasource_config["replay"]["speed"].as<double>(0.0);
+    } else if (datasource_config["capture"]) {
+      if (_shards.size() > 1) {
+        // the log is a single seq-ordered stream
+        REL_WARNING("datasource capture is not supported with shards");
+      } else {
+        _capture =
+            std::make_unique<frame_log::writer>(datasource_config["capture"]);
+      }
     }
   }
 
@@ -80,6 +165,20 @@ public:
                                             "Number of inbound messages");
     metrics_factory::instance().add_counter("websocket_inbound_bytes",
                                             "Number of inbound message bytes");
+    metrics_factory::instance().add_counter(
+        "websocket_compression_bytes",
+        "Compressed and uncompressed bytes of inbound messages");
+    metrics_factory::instance().add_counter(
+        "websocket_reconnects", "Reconnects and replayed duplicate messages");
+    metrics_factory::instance().add_histogram(
+        "websocket_downtime", "Seconds from disconnect to first new message");
+    metrics_factory::instance().add_counter(
+        "frame_pool", "Recycling of websocket frame buffers");
+    metrics_factory::instance().add_counter(
+        "post_processor_admission",
+        "Payloads shed or delayed by post-processing admission control");
+    metrics_factory::instance().add_counter(
+        "frame_log", "Frames captured to or replayed from the frame log");
     metrics_factory::instance().add_counter(
         "message_string_matches",
         "Number of matches within each field of message");
@@ -108,60 +207,272 @@ public:
     metrics_factory::instance()
         .get_histogram("firehose_facets")
         .Add({{"facet", "total"}}, boundaries);
-    _thread = std::thread([&, this] {
-      REL_INFO("client startup for {}:{} at {}", _host, _port, _subscription);
-      try {
-        while (controller::instance().is_active()) {
-          // The io_context is required for all I/O
-          net::io_context ioc;
-
-          // The SSL context is required, and holds certificates
-          ssl::context ctx{ssl::context::tlsv12_client};
-
-          // Launch the asynchronous operation
-          boost::asio::spawn(ioc,
-                             std::bind(&datasource::do_work, this,
-                                       std::ref(ioc), std::ref(ctx),
-                                       std::placeholders::_1),
-                             // on completion, spawn will call this function
-                             [](std::exception_ptr ex) {
-                               // if an exception occurred in the coroutine,
-                               // it's something critical, e.g. out of memory
-                               // we capture normal errors in the ec
-                               // so we just rethrow the exception here,
-                               // which will cause `ioc.run()` to throw
-                               if (ex)
-                                 std::rethrow_exception(ex);
-                             });
-
-          // Run the I/O service. The call will return when
-          // the socket is closed.
-          ioc.run();
-
-          // we should run forever unless killed. Try to reconnect in a little
-          // while.
-          std::this_thread::sleep_for(std::chrono::seconds(10));
-        }
-      } catch (std::exception const &exc) {
-        REL_CRITICAL("datasource exception {}", exc.what());
-      }
-      REL_INFO("datasource stopping");
-    });
+    prometheus::Histogram::BucketBoundaries downtime = {
+        0.5, 1.0, 2.0, 5.0, 10.0, 30.0, 60.0, 120.0, 300.0, 600.0};
+    for (auto &this_shard : _shards) {
+      metrics_factory::instance()
+          .get_histogram("websocket_downtime")
+          .Add(this_shard->_labels, downtime);
+      // decoders must be ready before the first read
+      this_shard->_handler.start();
+    }
+    if (!_replay_directory.empty()) {
+      _replay_thread = std::thread([&, this] { replay(); });
+      return;
+    }
+    for (auto &this_shard : _shards) {
+      shard *target(this_shard.get());
+      this_shard->_thread = std::thread([this, target] { run(*target); });
+    }
   }
 
-  void wait_for_end_thread() { _thread.join(); }
+  void wait_for_end_thread() {
+    if (_replay_thread.joinable()) {
+      _replay_thread.join();
+    }
+    for (auto &this_shard : _shards) {
+      if (this_shard->_thread.joinable()) {
+        this_shard->_thread.join();
+      }
+    }
+  }
 
 private:
+  // One websocket connection and the handler it feeds
+  struct shard {
+    std::string _name;
+    std::string _subscription;
+    prometheus::Labels _labels;
+    // identity and account events arrive on every Jetstream connection, only
+    // one shard passes them on
+    bool _accounts = true;
+    // the server-side filters, a collection ending in ".*" is a prefix
+    std::vector<std::string> _collections;
+    std::vector<std::string> _dids;
+    content_handler<PAYLOAD> _handler;
+    std::thread _thread;
+    // highest seq read from the wire, older messages after reconnect are
+    // duplicates of what is already queued
+    int64_t _last_received = 0;
+    bool _received_messages = false;
+    std::optional<std::chrono::steady_clock::time_point> _disconnected_at;
+    // for TLS resumption on reconnect
+    std::unique_ptr<SSL_SESSION, decltype(&SSL_SESSION_free)> _tls_session{
+        nullptr, &SSL_SESSION_free};
+
+    // whether the connection would deliver this frame, to route frames that
+    // did not arrive on it
+    bool accepts(std::string_view frame) const {
+      if (!_dids.empty() &&
+          std::ranges::find(_dids, jetstream_string(frame, "\"did\":\"")) ==
+              _dids.end())
+        return false;
+      if (!is_jetstream_commit(frame))
+        return _accounts;
+      if (_collections.empty())
+        return true;
+      std::string_view collection(
+          jetstream_string(frame, "\"collection\":\""));
+      return std::ranges::any_of(
+          _collections, [collection](std::string_view wanted) {
+            return wanted.ends_with(".*")
+                       ? collection.starts_with(
+                             wanted.substr(0, wanted.size() - 1))
+                       : collection == wanted;
+          });
+    }
+  };
+
+  // A null node is the whole subscription on a single connection
+  void add_shard(YAML::Node const &shard_config, const bool first) {
+    auto this_shard(std::make_unique<shard>());
+    this_shard->_name = "all";
+    this_shard->_subscription = _subscription;
+    this_shard->_labels = {{"host", _host}};
+    if (shard_config.IsMap()) {
+      this_shard->_name = shard_config["name"].as<std::string>(
+          std::to_string(_shards.size()));
+      this_shard->_labels.insert({"shard", this_shard->_name});
+      this_shard->_accounts = shard_config["accounts"].as<bool>(first);
+      auto add_filter = [&](const char *key, std::string_view parameter,
+                            std::vector<std::string> &values) {
+        if (!shard_config[key])
+          return;
+        for (auto const &value : shard_config[key]) {
+          values.push_back(value.as<std::string>());
+          this_shard->_subscription.append(std::format(
+              "{}{}={}", this_shard->_subscription.contains('?') ? '&' : '?',
+              parameter, values.back()));
+        }
+      };
+      add_filter("collections", "wantedCollections",
+                 this_shard->_collections);
+      add_filter("dids", "wantedDids", this_shard->_dids);
+      REL_INFO("datasource shard {} at {}{}", this_shard->_name,
+               this_shard->_subscription,
+               this_shard->_accounts ? ", with accounts" : "");
+    }
+    _shards.push_back(std::move(this_shard));
+  }
+
+  static prometheus::Labels with_label(prometheus::Labels labels,
+                                       std::string const &name,
+                                       std::string const &value) {
+    labels.insert({name, value});
+    return labels;
+  }
+
+  // connect, read until failure, reconnect until stopped
+  void run(shard &this_shard) {
+    REL_INFO("client startup for {}:{} at {}", _host, _port,
+             this_shard._subscription);
+    try {
+      // The io_context is required for all I/O
+      net::io_context ioc;
+
+      // The SSL context is required, and holds certificates. It is kept
+      // across reconnects so the client session cache can resume TLS.
+      ssl::context ctx{ssl::context::tlsv12_client};
+      SSL_CTX_set_session_cache_mode(ctx.native_handle(),
+                                     SSL_SESS_CACHE_CLIENT);
+      std::minstd_rand jitter(std::random_device{}());
+      size_t attempt(0);
+      while (controller::instance().is_active()) {
+        this_shard._received_messages = false;
+        ioc.restart();
+
+        // Launch the asynchronous operation
+        boost::asio::spawn(ioc,
+                           std::bind(&datasource::do_work, this,
+                                     std::ref(this_shard), std::ref(ioc),
+                                     std::ref(ctx), std::placeholders::_1),
+                           // on completion, spawn will call this function
+                           [](std::exception_ptr ex) {
+                             // if an exception occurred in the coroutine,
+                             // it's something critical, e.g. out of memory
+                             // we capture normal errors in the ec
+                             // so we just rethrow the exception here,
+                             // which will cause `ioc.run()` to throw
+                             if (ex)
+                               std::rethrow_exception(ex);
+                           });
+
+        // Run the I/O service. The call will return when
+        // the socket is closed.
+        ioc.run();
+        if (!controller::instance().is_active())
+          break;
+
+        // we should run forever unless killed. Reconnect after full-jitter
+        // exponential backoff, reset once a connection delivers messages.
+        if (this_shard._received_messages) {
+          attempt = 0;
+          this_shard._disconnected_at = std::chrono::steady_clock::now();
+        }
+        auto ceiling(std::min(_max_backoff,
+                              _initial_backoff * (int64_t(1) << attempt)));
+        if (ceiling < _max_backoff && attempt < MaxBackoffDoublings) {
+          ++attempt;
+        }
+        std::chrono::milliseconds backoff(
+            std::uniform_int_distribution<int64_t>(0, ceiling.count())(
+                jitter));
+        REL_WARNING("datasource {} reconnect in {} ms", this_shard._name,
+                    backoff.count());
+        metrics_factory::instance()
+            .get_counter("websocket_reconnects")
+            .Get(with_label(this_shard._labels, "reconnect", "attempt"))
+            .Increment();
+        std::this_thread::sleep_for(backoff);
+      }
+    } catch (std::exception const &exc) {
+      REL_CRITICAL("datasource exception {}", exc.what());
+    }
+    REL_INFO("datasource {} stopping", this_shard._name);
+  }
+
   // TODO support round robin if needed
   std::string _host;
   std::string _port;
   std::string _subscription;
-  content_handler<PAYLOAD> _handler;
+  std::vector<std::unique_ptr<shard>> _shards;
   std::shared_ptr<config> _settings;
-  std::thread _thread;
+  std::thread _replay_thread;
   std::unique_ptr<datasource> _instance;
+  std::shared_ptr<const zstd_dictionary> _dictionary;
+  size_t _max_frame_bytes = frame_decompressor::DefaultMaxFrameBytes;
+
+  static constexpr std::chrono::milliseconds DefaultInitialBackoff =
+      std::chrono::milliseconds(500);
+  static constexpr std::chrono::milliseconds DefaultMaxBackoff =
+      std::chrono::milliseconds(60000);
+  static constexpr size_t MaxBackoffDoublings = 30;
+  std::chrono::milliseconds _initial_backoff = DefaultInitialBackoff;
+  std::chrono::milliseconds _max_backoff = DefaultMaxBackoff;
+  int64_t _start_cursor = 0;
+
+  // Resume after the last message processed by every shard, or the startup
+  // cursor. Shards that have processed nothing yet do not hold the others
+  // back. Messages a shard already received are dropped again on read.
+  std::string subscription(shard const &this_shard) const {
+    int64_t cursor(0);
+    for (auto const &each_shard : _shards) {
+      const int64_t processed(each_shard->_handler.last_processed());
+      if (processed != 0 && (cursor == 0 || processed < cursor)) {
+        cursor = processed;
+      }
+    }
+    if (cursor == 0) {
+      cursor = _start_cursor;
+    }
+    if (cursor == 0)
+      return this_shard._subscription;
+    return std::format("{}{}cursor={}", this_shard._subscription,
+                       this_shard._subscription.contains('?') ? '&' : '?',
+                       cursor);
+  }
+  std::unique_ptr<frame_log::writer> _capture;
+  std::string _replay_directory;
+  int64_t _replay_from_seq = 0;
+  // 0 is as fast as the pipeline accepts, otherwise a multiple of real time
+  double _replay_speed = 0.0;
+
+  void replay() {
+    REL_INFO("replay startup from {} at seq {} speed {}", _replay_directory,
+             _replay_from_seq, _replay_speed);
+    try {
+      frame_log::reader reader(_replay_directory, _replay_from_seq);
+      frame_log::record next_record;
+      int64_t first_captured_us(0);
+      auto started(std::chrono::steady_clock::now());
+      while (controller::instance().is_active() && reader.next(next_record)) {
+        if (_replay_speed > 0.0) {
+          if (first_captured_us == 0) {
+            first_captured_us = next_record._captured_us;
+          }
+          std::this_thread::sleep_until(
+              started + std::chrono::microseconds(static_cast<int64_t>(
+                            static_cast<double>(next_record._captured_us -
+                                                first_captured_us) /
+                            _replay_speed)));
+        }
+        // to every shard the live feed would have delivered it to
+        for (auto &this_shard : _shards) {
+          if (!this_shard->accepts(next_record._frame))
+            continue;
+          frame_ptr frame(
+              frame_pool::instance().acquire(next_record._frame.size()));
+          frame->assign(next_record._frame);
+          this_shard->_handler.handle(std::move(frame));
+        }
+      }
+    } catch (std::exception const &exc) {
+      REL_CRITICAL("replay exception {}", exc.what());
+    }
+    REL_INFO("replay complete");
+  }
 
-  void do_work(net::io_context &ioc, ssl::context &ctx,
+  void do_work(shard &this_shard, net::io_context &ioc, ssl::context &ctx,
                net::yield_context yield) {
     beast::error_code ec;
 
@@ -206,10 +517,17 @@ private:
                       " websocket-client-coro");
         }));
 
+    if (this_shard._tls_session) {
+      SSL_set_session(ws.next_layer().native_handle(),
+                      this_shard._tls_session.get());
+    }
     // Perform the SSL handshake
     ws.next_layer().async_handshake(ssl::stream_base::client, yield[ec]);
     if (ec)
       return fail(ec, "ssl_handshake");
+    REL_INFO("TLS session {}",
+             SSL_session_reused(ws.next_layer().native_handle()) ? "resumed"
+                                                                 : "new");
 
     // Turn off the timeout on the tcp_stream, because
     // the websocket stream has its own timeout system.
@@ -225,30 +543,94 @@ private:
     ws.set_option(opt);
 
     // Perform the websocket handshake
-    ws.async_handshake(_host, _subscription, yield[ec]);
+    std::string subscription(this->subscription(this_shard));
+    REL_INFO("websocket subscription {}", subscription);
+    ws.async_handshake(_host, subscription, yield[ec]);
     if (ec)
       return fail(ec, "handshake");
+    // TLS 1.3 session tickets have arrived by the end of the upgrade
+    this_shard._tls_session.reset(
+        SSL_get1_session(ws.next_layer().native_handle()));
+    // decompression context lasts as long as the connection
+    std::optional<frame_decompressor> decompressor;
+    std::string compressed;
+    if (_dictionary) {
+      decompressor.emplace(_dictionary, _max_frame_bytes);
+    }
     // main processing loop
+    size_t size_hint(0);
     while (controller::instance().is_active()) {
-      // This buffer will hold the incoming message
-      beast::flat_buffer buffer;
+      // This recycled buffer will hold the incoming message, and travels
+      // with it until post-processing is complete
+      frame_ptr frame(frame_pool::instance().acquire(size_hint));
+      // compressed messages are read to scratch and decompressed to the frame
+      std::string &wire(decompressor ? compressed : *frame);
+      wire.clear();
+      auto buffer(net::dynamic_buffer(wire));
 
       // Read a message into our buffer
       ws.async_read(buffer, yield[ec]);
       if (ec)
         return fail(ec, "read");
-
       // update stats
       metrics_factory::instance()
           .get_counter("websocket_inbound_messages")
-          .Get({{"host", _host}})
+          .Get(this_shard._labels)
           .Increment();
       metrics_factory::instance()
           .get_counter("websocket_inbound_bytes")
-          .Get({{"host", _host}})
-          .Increment(static_cast<double>(buffer.size()));
+          .Get(this_shard._labels)
+          .Increment(static_cast<double>(wire.size()));
+      if (decompressor) {
+        try {
+          decompressor->decompress(compressed, *frame);
+        } catch (std::exception const &exc) {
+          REL_ERROR("datasource error: {}, {} bytes", exc.what(),
+                    compressed.size());
+          continue;
+        }
+        metrics_factory::instance()
+            .get_counter("websocket_compression_bytes")
+            .Get(with_label(this_shard._labels, "bytes", "compressed"))
+            .Increment(static_cast<double>(compressed.size()));
+        metrics_factory::instance()
+            .get_counter("websocket_compression_bytes")
+            .Get(with_label(this_shard._labels, "bytes", "uncompressed"))
+            .Increment(static_cast<double>(frame->size()));
+      }
+      // consecutive messages are similar in size
+      size_hint = frame->size();
+      if (!this_shard._received_messages) {
+        this_shard._received_messages = true;
+        if (this_shard._disconnected_at.has_value()) {
+          metrics_factory::instance()
+              .get_histogram("websocket_downtime")
+              .GetAt(this_shard._labels)
+              .Observe(std::chrono::duration<double>(
+                           std::chrono::steady_clock::now() -
+                           this_shard._disconnected_at.value())
+                           .count());
+          this_shard._disconnected_at.reset();
+        }
+      }
+      int64_t seq(PAYLOAD::seq_from_frame(*frame));
+      if (seq != 0) {
+        if (seq <= this_shard._last_received) {
+          metrics_factory::instance()
+              .get_counter("websocket_reconnects")
+              .Get(with_label(this_shard._labels, "reconnect", "duplicate"))
+              .Increment();
+          continue;
+        }
+        this_shard._last_received = seq;
+      }
+      if (!this_shard._accounts && !is_jetstream_commit(*frame))
+        continue;
+      if (_capture) {
+        _capture->append(seq, *frame);
+      }
 
-      _handler.handle(buffer);
+      this_shard._handler.handle(std::move(frame));
     }
 
     // Close the WebSocket connection
@@ -0,0 +1,87 @@
+#ifndef __exact_set_hpp__
+#define __exact_set_hpp__
+/*************************************************************************
+Public Education Forum Moderation Firehose Client
+Copyright (c) Steve Townsend 2025
+
+>>> SOURCE LICENSE >>>
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation (www.fsf.org); either version 3 of the
+License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+A copy of the GNU General Public License is available at
+http://www.fsf.org/licensing/licenses
+>>> END OF LICENSE >>>
+*************************************************************************/
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Exact tokens looked up in constant time by a perfect hash built when the
+// rules are compiled, using hash and displace: keys are spread over small
+// buckets, and each bucket, largest first, is given the first displacement
+// that moves all of its keys into free slots. A lookup is two hashes, one
+// slot and one comparison with the stored key.
+class exact_set {
+public:
+  typedef uint32_t key_id;
+  static constexpr key_id NoKey = UINT32_MAX;
+  // average keys per bucket
+  static constexpr size_t BucketSize = 4;
+  // displacements tried for one bucket before trying another seed
+  static constexpr uint32_t MaxDisplacement = 1 << 16;
+  static constexpr size_t MaxSeeds = 16;
+
+  exact_set() = default;
+  ~exact_set() = default;
+  exact_set(exact_set const &) = delete;
+  exact_set &operator=(exact_set const &) = delete;
+
+  // build phase only. A repeated key returns the ID it was first given.
+  key_id add(std::string_view key);
+  // After this the set is only read. If no perfect hash is found, keys are
+  // looked up in the build index instead.
+  void compile();
+
+  inline size_t size() const { return _keys.size(); }
+  inline bool empty() const { return _keys.empty(); }
+
+  key_id find(std::string_view key) const;
+
+private:
+  static uint64_t hash(std::string_view key, const uint64_t seed);
+  inline size_t slot_for(const uint64_t key_hash,
+                         const uint32_t displacement) const {
+    return static_cast<size_t>(
+        mix(key_hash ^ (displacement * 0x9e3779b97f4a7c15ULL)) %
+        _slots.size());
+  }
+  static inline uint64_t mix(uint64_t value) {
+    value ^= value >> 30;
+    value *= 0xbf58476d1ce4e5b9ULL;
+    value ^= value >> 27;
+    value *= 0x94d049bb133111ebULL;
+    return value ^ (value >> 31);
+  }
+  bool place(const uint64_t seed);
+
+  std::vector<std::string> _keys;
+  // while building, and after if compile found no perfect hash
+  std::unordered_map<std::string, key_id> _index;
+  uint64_t _seed = 0;
+  // by bucket
+  std::vector<uint32_t> _displacements;
+  // key in each slot, or NoKey
+  std::vector<key_id> _slots;
+};
+
+#endif
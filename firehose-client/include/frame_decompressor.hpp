@@ -0,0 +1,73 @@
+#ifndef __frame_decompressor_hpp__
+#define __frame_decompressor_hpp__
+/*************************************************************************
+Public Education Forum Moderation Firehose Client
+Copyright (c) Steve Townsend 2025
+
+>>> SOURCE LICENSE >>>
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation (www.fsf.org); either version 3 of the
+License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+A copy of the GNU General Public License is available at
+http://www.fsf.org/licensing/licenses
+>>> END OF LICENSE >>>
+*************************************************************************/
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <zstd.h>
+
+// Jetstream compresses each frame with zstd against a published dictionary.
+// The dictionary is digested once at startup and shared read-only by every
+// connection.
+class zstd_dictionary {
+public:
+  zstd_dictionary() = delete;
+  zstd_dictionary(std::string const &filename);
+  ~zstd_dictionary();
+  zstd_dictionary(zstd_dictionary const &) = delete;
+  zstd_dictionary &operator=(zstd_dictionary const &) = delete;
+
+  inline ZSTD_DDict const *get() const { return _dictionary; }
+
+private:
+  ZSTD_DDict *_dictionary = nullptr;
+};
+
+// Decompression context for one connection, reused across its frames. Not
+// thread-safe.
+class frame_decompressor {
+public:
+  // Initial output size for frames that do not record their content size
+  static constexpr size_t ExpansionGuess = 8;
+  // Largest decompressed frame accepted unless configured otherwise
+  static constexpr size_t DefaultMaxFrameBytes = 4 * 1024 * 1024;
+
+  frame_decompressor() = delete;
+  frame_decompressor(std::shared_ptr<const zstd_dictionary> dictionary,
+                     const size_t max_frame_bytes);
+  ~frame_decompressor();
+  frame_decompressor(frame_decompressor const &) = delete;
+  frame_decompressor &operator=(frame_decompressor const &) = delete;
+
+  // Replaces the content of output with the decompressed frame. Throws on
+  // corrupt or truncated input, or a frame over the size limit.
+  void decompress(std::string_view input, std::string &output);
+
+private:
+  std::shared_ptr<const zstd_dictionary> _dictionary;
+  ZSTD_DCtx *_context = nullptr;
+  size_t _max_frame_bytes;
+  // set if the dictionary could not be referenced, every frame fails
+  char const *_dictionary_error = nullptr;
+};
+
+#endif
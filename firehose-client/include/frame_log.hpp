@@ -0,0 +1,134 @@
+#ifndef __frame_log_hpp__
+#define __frame_log_hpp__
+/*************************************************************************
+Public Education Forum Moderation Firehose Client
+Copyright (c) Steve Townsend 2025
+
+>>> SOURCE LICENSE >>>
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation (www.fsf.org); either version 3 of the
+License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+A copy of the GNU General Public License is available at
+http://www.fsf.org/licensing/licenses
+>>> END OF LICENSE >>>
+*************************************************************************/
+
+#include "yaml-cpp/yaml.h"
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Capture log of raw websocket frames, for incident reproduction, offline
+// benchmarking and backfill. Frames are appended to fixed-size memory-mapped
+// segment files. Each segment has a sparse seq->offset index alongside it so
+// replay can start part way through without scanning the whole segment.
+//
+// Segment layout: segment_header, then records of record_header + frame
+// bytes. A zero record length marks the end of the data, which is where a
+// crashed capture stops. Segments are named by their first seq so that
+// lexical order is replay order.
+namespace frame_log {
+
+constexpr std::string_view SegmentSuffix = ".frames";
+constexpr std::string_view IndexSuffix = ".index";
+constexpr char Magic[8] = {'P', 'E', 'F', 'F', 'R', 'A', 'M', 'E'};
+constexpr uint32_t Version = 1;
+// segment_header flag: the capture that wrote this segment also wrote the one
+// before it, so a first record at the previous seq is new, not a repeat
+constexpr uint32_t SegmentContinues = 1;
+
+struct segment_header {
+  char _magic[8];
+  uint32_t _version;
+  uint32_t _flags;
+};
+
+struct record_header {
+  uint32_t _length;
+  uint32_t _reserved;
+  int64_t _seq;
+  // capture time, for real-time-relative replay
+  int64_t _captured_us;
+};
+
+struct index_entry {
+  int64_t _seq;
+  uint64_t _offset;
+};
+
+struct record {
+  int64_t _seq;
+  int64_t _captured_us;
+  std::string_view _frame;
+};
+
+class writer {
+public:
+  static constexpr size_t DefaultSegmentMegabytes = 256;
+  static constexpr size_t DefaultIndexInterval = 1000;
+
+  writer() = delete;
+  writer(YAML::Node const &settings);
+  ~writer();
+
+  // Frames without a seq (e.g. #info) are logged at the last seen seq
+  void append(const int64_t seq, std::string_view frame);
+
+private:
+  void open_segment(const int64_t first_seq, const size_t record_bytes);
+  void close_segment();
+
+  std::filesystem::path _directory;
+  size_t _segment_bytes;
+  size_t _index_interval;
+
+  std::filesystem::path _segment_path;
+  std::unique_ptr<boost::interprocess::mapped_region> _region;
+  std::ofstream _index;
+  size_t _offset = 0;
+  size_t _records = 0;
+  int64_t _last_seq = 0;
+  // set once the first segment is open, later ones continue the capture
+  bool _continuing = false;
+};
+
+class reader {
+public:
+  reader() = delete;
+  reader(std::filesystem::path const &directory, const int64_t from_seq);
+  ~reader() = default;
+
+  // false at end of the log. The frame view is valid until the next call.
+  bool next(record &next_record);
+
+private:
+  bool open_segment();
+
+  std::vector<std::filesystem::path> _segments;
+  size_t _next_segment = 0;
+  int64_t _from_seq;
+  int64_t _last_seq = 0;
+  bool _replayed = false;
+  // last seq replayed before the current segment if that segment starts a
+  // capture that overlaps an earlier one, which repeats it
+  int64_t _overlap_seq = -1;
+  std::unique_ptr<boost::interprocess::mapped_region> _region;
+  size_t _offset = 0;
+};
+
+} // namespace frame_log
+
+#endif
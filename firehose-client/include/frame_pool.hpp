@@ -0,0 +1,72 @@
+#ifndef __frame_pool_hpp__
+#define __frame_pool_hpp__
+/*************************************************************************
+Public Education Forum Moderation Firehose Client
+Copyright (c) Steve Townsend 2025
+
+>>> SOURCE LICENSE >>>
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation (www.fsf.org); either version 3 of the
+License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+A copy of the GNU General Public License is available at
+http://www.fsf.org/licensing/licenses
+>>> END OF LICENSE >>>
+*************************************************************************/
+
+#include <array>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Recycled websocket frame buffers, in power-of-two size classes. A frame is
+// read into a pooled buffer and owned by whatever stage holds it - decoder,
+// then payload. The buffer goes back to the pool, capacity intact, when the
+// owner is destroyed.
+class frame_pool {
+public:
+  // 1KB .. 2MB. Larger frames are rare and are freed, not pooled.
+  static constexpr size_t MinClassShift = 10;
+  static constexpr size_t ClassCount = 12;
+  static constexpr size_t MaxPooledPerClass = 512;
+
+  struct releaser {
+    void operator()(std::string *buffer) const;
+  };
+  typedef std::unique_ptr<std::string, releaser> frame_ptr;
+
+  static frame_pool &instance();
+
+  // Empty buffer with capacity for at least size_hint bytes if one is free
+  frame_ptr acquire(const size_t size_hint);
+  void release(std::string *buffer);
+
+private:
+  frame_pool() = default;
+  ~frame_pool() = default;
+
+  static size_t class_bytes(const size_t size_class) {
+    return size_t(1) << (MinClassShift + size_class);
+  }
+  // smallest class that holds this many bytes
+  static size_t class_for_size(const size_t bytes);
+  // largest class this capacity satisfies
+  static size_t class_for_capacity(const size_t capacity);
+
+  struct free_list {
+    std::mutex _lock;
+    std::vector<std::string *> _buffers;
+  };
+  std::array<free_list, ClassCount> _free;
+};
+
+typedef frame_pool::frame_ptr frame_ptr;
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef __json_scanner_hpp__
+#define __json_scanner_hpp__
+/*************************************************************************
+Public Education Forum Moderation Firehose Client
+Copyright (c) Steve Townsend 2025
+
+>>> SOURCE LICENSE >>>
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation (www.fsf.org); either version 3 of the
+License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+A copy of the GNU General Public License is available at
+http://www.fsf.org/licensing/licenses
+>>> END OF LICENSE >>>
+*************************************************************************/
+
+#include "matcher.hpp"
+#include <optional>
+#include <string_view>
+
+// On-demand extraction of match candidates from a jetstream message, without
+// building a DOM. Only the members on the path to TargetFieldNames are read,
+// everything else is skipped by bracket counting. Results are the same as
+// parser::get_candidates_from_json.
+//
+// Returns nothing for a shape the scanner does not handle (escaped keys,
+// non-string values where strings are expected, bad escapes), and the caller
+// falls back to the DOM. Input is trusted to be well-formed JSON from
+// jetstream, it is not fully validated.
+namespace json_scanner {
+
+std::optional<candidate_list> candidates(std::string_view message);
+
+// Unescaped content of a JSON string literal, false if value is not one or
+// its escapes are not valid
+bool string_value(std::string_view value, std::string &out);
+
+} // namespace json_scanner
+
+#endif
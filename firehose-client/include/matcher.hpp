@@ -20,13 +20,28 @@ http://www.fsf.org/licensing/licenses
 >>> END OF LICENSE >>>
 *************************************************************************/
 #include "common/helpers.hpp"
+#include "automaton.hpp"
+#include "exact_set.hpp"
+#include "regex_set.hpp"
+#include "rule_expression.hpp"
+#include "scan_cache.hpp"
 #include "common/rest_utils.hpp"
-#include <aho_corasick/aho_corasick.hpp>
+#include <array>
+#include <atomic>
 #include <boost/beast/core.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
 #include <mutex>
+#include <optional>
+#include <prometheus/counter.h>
+#include <span>
 #include <string>
+#include <string_view>
 #include <tuple>
 #include <unordered_map>
+#include <vector>
 #include <yaml-cpp/yaml.h>
 
 namespace beast = boost::beast; // from <boost/beast.hpp>
@@ -42,10 +57,20 @@ struct candidate {
 typedef std::vector<candidate> candidate_list;
 typedef std::vector<std::pair<std::string, candidate_list>> path_candidate_list;
 
+// Position of a rule in its compiled rule_set
+typedef uint32_t rule_id;
+class rule_set;
+
 // Stores context that matched one or more filters, and the matches
 struct match_result {
   candidate _candidate;
-  aho_corasick::wtrie::emit_collection _matches;
+  // one entry per keyword hit
+  std::vector<rule_id> _matches;
+  // the rule set the IDs index, kept alive across a rule refresh
+  std::shared_ptr<const rule_set> _rules;
+
+  // for logging, keywords of the matched rules
+  std::string matched_filters() const;
 };
 typedef std::vector<match_result> match_results;
 typedef std::vector<std::pair<std::string, match_results>> path_match_results;
@@ -61,17 +86,23 @@ inline bool candidate::operator==(candidate const &rhs) const {
 
 class matcher {
 public:
+  class rule;
+
   inline static matcher &shared() {
     static matcher instance;
     return instance;
   }
+  static constexpr size_t DefaultScanCacheSize = 65536;
+
   matcher();
   ~matcher() = default;
 
   inline bool is_ready() const { return _is_ready; }
   void set_config(const YAML::Node &filter_config);
   void load_filter_file(std::string const &filename);
-  void refresh_rules(matcher &&replacement);
+  // Replaces the rules in use. Returns false if they are unchanged. Small
+  // changes are layered over the compiled rules instead of rebuilding them.
+  bool refresh_rules(std::vector<rule> &&replacement);
 
   bool matches_any(std::string const &candidate) const;
   bool matches_any(beast::flat_buffer const &beast_data) const;
@@ -81,24 +112,34 @@ public:
   bool check_candidates(candidate_list const &candidates) const;
 
   match_results find_all_matches(beast::flat_buffer const &beast_data) const;
+  match_results find_all_matches(std::string const &frame) const;
   match_results
   all_matches_for_candidates(candidate_list const &candidates) const;
   path_match_results all_matches_for_path_candidates(
       path_candidate_list const &path_candidates) const;
+  // Candidates of many messages scanned in one loop against one snapshot of
+  // the rules. Results are in message order, empty for a message with no
+  // matches.
+  std::vector<match_results>
+  all_matches_for_batch(std::vector<candidate_list> const &batch) const;
 
   void report_if_needed(account_filter_matches &matches);
   inline bool use_db_for_rules() const { return _use_db_for_rules; }
 
   class rule {
   public:
-    enum class match_type { substring, whole_word };
-    enum class content_scope { profile, any };
+    enum class match_type { substring, whole_word, regex, exact, expression };
+    // candidates a rule applies to, beyond content_scope::any. Profile
+    // rules match profile fields, link rules match link fields.
+    enum class content_scope { profile, any, link };
 
     inline content_scope content_scope_from_string(std::string_view str) {
       if (str == "profile")
         return content_scope::profile;
       if (str == "any")
         return content_scope::any;
+      if (str == "link")
+        return content_scope::link;
       std::ostringstream err;
       err << "Bad content scope " << str;
       throw std::invalid_argument(err.str());
@@ -109,6 +150,12 @@ public:
         return match_type::substring;
       if (str == "word")
         return match_type::whole_word;
+      if (str == "regex")
+        return match_type::regex;
+      if (str == "exact")
+        return match_type::exact;
+      if (str == "expr")
+        return match_type::expression;
       std::ostringstream err;
       err << "Bad match type " << str;
       throw std::invalid_argument(err.str());
@@ -119,6 +166,12 @@ public:
         return "substring";
       if (my_match_type == match_type::whole_word)
         return "word";
+      if (my_match_type == match_type::regex)
+        return "regex";
+      if (my_match_type == match_type::exact)
+        return "exact";
+      if (my_match_type == match_type::expression)
+        return "expr";
       return std::string{};
     }
 
@@ -127,7 +180,11 @@ public:
     // for load from DB
     rule(std::string const &filter, std::string const &labels,
          std::string const &actions, std::string const &contingent);
-    rule(rule const &);
+    // compiled once, moved into the rule_set
+    rule(rule const &) = delete;
+    rule(rule &&) = default;
+    rule &operator=(rule const &) = delete;
+    rule &operator=(rule &&) = default;
     inline std::string to_string() const {
       std::ostringstream oss;
       oss << _target << '|' << format_vector(_labels) << '|' << _raw_actions
@@ -135,6 +192,8 @@ public:
       return oss.str();
     }
     std::string _target;
+    // case-folded target, as matched by the automaton, or the regex
+    std::string _keyword;
     std::vector<std::string> _labels;
     std::string _raw_actions;
     bool _track = false;
@@ -144,27 +203,232 @@ public:
     std::string _block_list_name;
     match_type _match_type = match_type::substring;
     std::string _contingent;
+    // contingent strings split into at least one required, none forbidden
+    std::vector<std::string> _required;
+    std::vector<std::string> _forbidden;
+    // target parsed, for match=expr
+    rule_expression _expression;
 
     static constexpr size_t field_count = 4;
-    bool passes_contingent_checks(std::string const &candidate) const;
 
   private:
     void store_actions(std::string_view actions);
-    mutable aho_corasick::wtrie _substring_trie;
-    mutable aho_corasick::wtrie _absent_substring_trie;
+    void store_contingent(std::string_view contingent);
   };
 
-  rule find_rule(std::wstring const &key) const;
-
 private:
-  bool insert_rule(rule &&new_rule);
-  rule find_rule_unchecked(std::wstring const &key) const;
+  bool add_rule(rule &&added);
+  // builds and publishes the rules from add_rule, if they changed
+  void publish_added();
+  void publish(std::unique_ptr<rule_set> &&pending);
+  // full build, from the compiled rules file if it was built from the same
+  // rules, otherwise compiled here and saved for the next start
+  std::unique_ptr<rule_set> build(std::vector<rule> &&rules) const;
+  void append_matches(std::shared_ptr<const rule_set> const &current,
+                      candidate_list const &candidates,
+                      match_results &results) const;
+  // snapshot of the rules in use, valid until this thread's next call
+  std::shared_ptr<const rule_set> const &rules() const;
 
-  mutable std::mutex _lock;
-  bool _is_ready = false;
+  std::atomic<bool> _is_ready = false;
   bool _use_db_for_rules = false;
-  mutable aho_corasick::wtrie _substring_trie;
-  mutable aho_corasick::wtrie _whole_word_trie;
-  std::unordered_map<std::wstring, rule> _rule_lookup;
+  // rules from add_rule, built together by the first scan after a change
+  std::mutex _added_lock;
+  std::vector<rule> _added;
+  std::atomic<bool> _added_changed = false;
+  // rules in use for matching. Scans read a snapshot without locking and
+  // a refresh swaps in a new one; the old one is freed with its last reader.
+  std::atomic<std::shared_ptr<const rule_set>> _rules;
+  // new on each publish and unique across matchers, so readers know when
+  // their cached copy is stale
+  std::atomic<uint64_t> _generation;
+  // of the rules last passed to refresh_rules
+  size_t _fingerprint = 0;
+  // compiled rules file, empty to always compile at startup
+  std::filesystem::path _compiled_rules;
+  // hits by canonical text, for rule set versions from publish
+  mutable scan_cache _scan_cache;
+  // looked up once, not per candidate
+  prometheus::Counter *_cache_hits = nullptr;
+  prometheus::Counter *_cache_misses = nullptr;
+};
+
+// Rules compiled once into an immutable table. A rule ID is the rule's
+// position in the table. Rules are partitioned by content scope. Targets
+// and contingent strings of the rules in a partition are patterns in one
+// automaton, and each pattern lists the rules that use it and how, so a
+// candidate is scanned once per partition and rules are accepted or
+// rejected from the hits. Regex targets are matched by a second pass over
+// the candidate with the partition's combined regex set. Exact targets are
+// looked up by hash for each token of the candidate: the whole text if it
+// is one word, such as a handle, and each hashtag, mention and link host.
+// The leaves of an expression rule are patterns like any other, recorded as
+// one bit per leaf, and the expression is evaluated on those bits once the
+// candidate has been scanned.
+//
+// A candidate is scanned by the rules for any content, plus those for its
+// own scope: profile rules only see profile fields and link rules only see
+// link fields.
+//
+// A refresh that changes a few rules builds an overlay instead: a rule_set
+// holding only the added rules, layered over the compiled base with the
+// removed base rules hidden. Base rules keep their IDs and overlay IDs
+// follow on from them.
+//
+// A compiled rule_set can be saved to a file and loaded on a later start by
+// memory-mapping it, so the automata are not rebuilt. The rules themselves
+// are still inserted, in the same order, to recreate the rule IDs.
+class rule_set {
+public:
+  typedef matcher::rule::content_scope content_scope;
+  static constexpr char Magic[8] = {'P', 'E', 'F', 'R', 'U', 'L', 'E', 'S'};
+  static constexpr uint32_t Version = 3;
+  // rebuild in full once an overlay holds more than 1/N of its base
+  static constexpr size_t OverlayFraction = 4;
+
+  rule_set() = default;
+  // overlay on a base that is not itself an overlay
+  rule_set(std::shared_ptr<const rule_set> base, std::vector<bool> &&removed);
+  ~rule_set() = default;
+  rule_set(rule_set const &) = delete;
+  rule_set &operator=(rule_set const &) = delete;
+
+  // build phase only, not thread-safe
+  bool insert(matcher::rule &&new_rule);
+  // completes the automata. After this the set is only read.
+  void compile();
+  // Before insert, maps the compiled file if it was built from rules with
+  // this key. Returns false if it is missing, invalid or stale.
+  bool load_compiled(std::filesystem::path const &path, const uint64_t key);
+  // after insert, false if the loaded file does not fit the inserted rules
+  bool matches_compiled() const;
+  // after compile, writes the file for load_compiled
+  void save_compiled(std::filesystem::path const &path,
+                     const uint64_t key) const;
+  // the rules as inserted, for a rebuild
+  inline std::vector<matcher::rule> release_rules() {
+    return std::move(_rules);
+  }
+  inline void set_version(const uint64_t version) { _version = version; }
+  // from publish, 0 if never published
+  inline uint64_t version() const { return _version; }
+
+  // IDs run to size(), including base rules hidden by an overlay
+  inline size_t size() const { return _first_id + _rules.size(); }
+  inline matcher::rule const &at(const rule_id id) const {
+    return id < _first_id ? _base->at(id) : _rules[id - _first_id];
+  }
+  // the compiled rules this overlays, or null
+  inline std::shared_ptr<const rule_set> const &base() const { return _base; }
+  // ID of the rule built from this source, as given by rule::to_string
+  std::optional<rule_id> find(std::string const &source) const;
+
+  // of the rules, in any order, to tell if a refresh changes them
+  static size_t fingerprint(std::vector<matcher::rule> const &rules);
+  // For a refresh of current: the rules of replacement not in current's
+  // compiled base layered over it, with the base rules not in replacement
+  // hidden. The layered rules are moved out of replacement. Null, leaving
+  // replacement as it was, if more than 1/OverlayFraction of the base
+  // changed and it should be rebuilt.
+  static std::unique_ptr<rule_set>
+  overlay_for(std::shared_ptr<const rule_set> current,
+              std::vector<matcher::rule> &replacement);
+
+  // the rules that can apply to a candidate, by where its text came from
+  static content_scope scope_of(candidate const &target);
+  bool matches_any_substring(std::string_view canonical,
+                             const content_scope scope) const;
+  // appends IDs of rules whose target and contingent strings match, one per
+  // occurrence of a literal target and one for any regex, exact or
+  // expression match. field qualifies expression leaves.
+  void scan(std::string_view canonical, const content_scope scope,
+            std::string_view field, std::vector<rule_id> &hits) const;
+
+private:
+  static constexpr size_t ScopeCount = 3;
+  // what a pattern means to a rule that uses it
+  enum class role : uint8_t {
+    substring,
+    whole_word,
+    required,
+    forbidden,
+    leaf
+  };
+  struct pattern_use {
+    rule_id _rule;
+    role _role;
+    // of a leaf of the rule expression
+    uint8_t _leaf = 0;
+  };
+  // the patterns and regexes of the rules with one content scope
+  struct partition {
+    utf8_automaton _automaton;
+    // indexed by automaton pattern ID, while building
+    std::vector<std::vector<pattern_use>> _uses;
+    // compiled from _uses, or viewed in the compiled file: the uses of
+    // pattern N run from offset N to offset N+1
+    std::vector<uint32_t> _use_offsets;
+    std::vector<pattern_use> _use_list;
+    std::span<const uint32_t> _use_offset_table;
+    std::span<const pattern_use> _use_table;
+    regex_set _regexes;
+    // indexed by regex pattern ID
+    std::vector<rule_id> _regex_rules;
+    exact_set _exact;
+    // indexed by exact key ID
+    std::vector<rule_id> _exact_rules;
+
+    inline std::span<const pattern_use>
+    uses_of(const utf8_automaton::pattern_id pattern) const {
+      return _use_table.subspan(_use_offset_table[pattern],
+                                _use_offset_table[pattern + 1] -
+                                    _use_offset_table[pattern]);
+    }
+  };
+  struct compiled_header {
+    char _magic[8];
+    uint32_t _version;
+    uint32_t _reserved;
+    uint64_t _key;
+    uint64_t _rule_count;
+    // by content scope
+    uint64_t _automaton_size[ScopeCount];
+    uint64_t _use_count[ScopeCount];
+  };
+  inline partition &partition_for(const content_scope scope) {
+    return _partitions[static_cast<size_t>(scope)];
+  }
+  inline partition const &partition_for(const content_scope scope) const {
+    return _partitions[static_cast<size_t>(scope)];
+  }
+  void add_pattern(partition &target, std::string const &canonical,
+                   const rule_id id, const role use, const uint8_t leaf = 0);
+  // calls visit with the ID of each exact rule matching a token
+  template <typename Visitor>
+  void find_exact(partition const &target, std::string_view canonical,
+                  std::vector<bool> const *hidden, Visitor &&visit) const;
+  // this layer only, skipping rules flagged in hidden
+  bool any_substring(std::string_view canonical, const content_scope scope,
+                     std::vector<bool> const *hidden) const;
+  void scan_layer(std::string_view canonical, const content_scope scope,
+                  std::string_view field, std::vector<rule_id> &hits,
+                  std::vector<bool> const *hidden) const;
+  bool is_duplicate(std::string const &canonical) const;
+
+  uint64_t _version = 0;
+  std::shared_ptr<const rule_set> _base;
+  // indexed by base rule ID
+  std::vector<bool> _removed;
+  rule_id _first_id = 0;
+  std::vector<matcher::rule> _rules;
+  // duplicate detection, kept for overlays
+  std::unordered_map<std::string, rule_id> _ids;
+  // rule::to_string of each rule, for refresh
+  std::unordered_map<std::string, rule_id> _sources;
+  // indexed by content scope
+  std::array<partition, ScopeCount> _partitions;
+  // the mapped compiled file, if loaded
+  std::unique_ptr<boost::interprocess::mapped_region> _compiled;
+  uint64_t _compiled_rule_count = 0;
 };
-#endif
\ No newline at end of file
+#endif
@@ -19,6 +19,7 @@ A copy of the GNU General Public License is available at
 http://www.fsf.org/licensing/licenses
 >>> END OF LICENSE >>>
 *************************************************************************/
+#include "binary_cid.hpp"
 #include "blockingconcurrentqueue.h"
 #include "common/helpers.hpp"
 #include "jwt-cpp/jwt.h"
@@ -39,13 +40,13 @@ struct external {
   std::string _uri;
 };
 struct image {
-  nlohmann::json _cid;
+  atproto::binary_cid _cid;
 };
 struct record {
   std::string _uri;
 };
 struct video {
-  nlohmann::json _cid;
+  atproto::binary_cid _cid;
 };
 typedef std::variant<external, image, record, video> embed_info;
 
@@ -115,7 +116,7 @@ public:
   void wait_enqueue(embed::embed_info_list &&value);
   void refresh_hosts(std::unordered_set<std::string> &&new_hosts);
   void image_seen(std::string const &repo, std::string const &path,
-                  std::string const &cid);
+                  atproto::binary_cid const &cid);
   void record_seen(std::string const &repo, std::string const &path,
                    std::string const &uri);
   bool should_process_uri(std::string const &uri);
@@ -123,7 +124,7 @@ public:
   bool uri_seen(std::string const &repo, std::string const &path,
                 std::string const &uri);
   void video_seen(std::string const &repo, std::string const &path,
-                  std::string const &cid);
+                  atproto::binary_cid const &cid);
   inline bool follow_links() const { return _follow_links; }
 
 private:
@@ -138,10 +139,10 @@ private:
   moodycamel::BlockingConcurrentQueue<embed::embed_info_list> _queue;
   bool _follow_links = false;
   size_t _number_of_threads = DefaultNumberOfThreads;
-  std::unordered_map<std::string, size_t> _checked_images;
+  std::unordered_map<atproto::binary_cid, size_t> _checked_images;
   std::unordered_map<std::string, size_t> _checked_records;
   std::unordered_map<std::string, size_t> _checked_uris;
-  std::unordered_map<std::string, size_t> _checked_videos;
+  std::unordered_map<atproto::binary_cid, size_t> _checked_videos;
   std::unordered_set<std::string> _popular_hosts;
 
   // LFU cache of recently-active accounts
@@ -20,6 +20,7 @@ http://www.fsf.org/licensing/licenses
 >>> END OF LICENSE >>>
 *************************************************************************/
 
+#include "binary_cid.hpp"
 #include "common/config.hpp"
 #include "common/helpers.hpp"
 #include "common/log_wrapper.hpp"
@@ -27,7 +28,6 @@ http://www.fsf.org/licensing/licenses
 #include "nlohmann/json.hpp"
 #include <algorithm>
 #include <boost/beast/core.hpp>
-#include <multiformats/cid.hpp>
 #include <string_view>
 #include <tuple>
 #include <unordered_set>
@@ -47,6 +47,7 @@ public:
   get_candidates_from_string(std::string const &full_content) const;
   candidate_list
   get_candidates_from_flat_buffer(beast::flat_buffer const &beast_data);
+  candidate_list get_candidates_from_frame(std::string_view frame);
   candidate_list get_candidates_from_json(nlohmann::json &full_json) const;
   static candidate_list
   get_candidates_from_record(nlohmann::json const &record);
@@ -146,24 +147,24 @@ public:
       uint64_t version(read_u64_leb128(get_char));
       uint64_t codec(read_u64_leb128());
       uint64_t digest_length(0);
+      std::vector<uint8_t> raw;
+      raw.reserve(atproto::binary_cid::Size);
       if (version == 0x12 && codec == 0x20) {
-        // handle v0 CID - digest is always 32 bytes
+        // handle v0 CID - multihash only, digest is always 32 bytes
         digest_length = 32;
-        version = 0;
       } else {
         // arcane knowledge - DAG-PB wrapper on the 32-byte digest
         digest_length = 34;
       }
-      std::vector<uint8_t> digest(digest_length);
-      for (auto next = digest.begin(); next != digest.end(); ++next) {
-        *next = static_cast<uint8_t>(this->get());
+      raw.push_back(static_cast<uint8_t>(version));
+      raw.push_back(static_cast<uint8_t>(codec));
+      for (uint64_t next = 0; next < digest_length; ++next) {
+        raw.push_back(static_cast<uint8_t>(this->get()));
       }
-      // Caller needs to process according to context
-      Multiformats::Cid cid({version}, {codec},
-                            {digest.cbegin(), digest.cend()});
+      // Caller needs to process according to context. Kept binary, base32 is
+      // only rendered for display.
       nlohmann::json result(
-          {{"__readable_cid__",
-            cid.to_string(Multiformats::Multibase::Protocol::Base32)}});
+          {{"__binary_cid__", nlohmann::json::binary(std::move(raw))}});
       return _callback(0, nlohmann::detail::parse_event_t::result, result);
     }
 
@@ -268,9 +269,15 @@ public:
   }
 
   static void set_config(std::shared_ptr<config> &settings);
+  // decode only the CAR blocks that commit ops refer to
+  static inline bool lazy_car() { return _lazy_car; }
+
+  // classify a decoded CAR block by its $type
+  bool add_block(atproto::binary_cid const &cid, nlohmann::json &&block);
 
   // CAR file in "blocks" contains atproto content indexed by CIDs
-  typedef std::vector<std::pair<std::string, nlohmann::json>> indexed_cbors;
+  typedef std::vector<std::pair<atproto::binary_cid, nlohmann::json>>
+      indexed_cbors;
   const indexed_cbors &other_cbors() const { return _other_cbors; }
   const indexed_cbors &content_cbors() const { return _content_cbors; }
   const indexed_cbors &matchable_cbors() const { return _matchable_cbors; }
@@ -278,18 +285,20 @@ public:
   std::string dump_parse_matched() const;
   std::string dump_parse_other() const;
 
-  inline std::string block_cid() const { return _block_cid; }
+  inline atproto::binary_cid const &block_cid() const { return _block_cid; }
 
 private:
   bool cbor_callback(int depth, nlohmann::json::parse_event_t event,
                      nlohmann::json &parsed);
 
   // CAR file in "blocks" contains atproto content indexed by CIDs
-  std::string _block_cid;
-  std::unordered_set<std::string> _cids;
+  atproto::binary_cid _block_cid;
+  std::unordered_set<atproto::binary_cid> _cids;
   indexed_cbors _other_cbors;
   indexed_cbors _content_cbors;
   indexed_cbors _matchable_cbors;
   static std::shared_ptr<config> _settings;
+  static bool _is_full;
+  static bool _lazy_car;
 };
 #endif
\ No newline at end of file
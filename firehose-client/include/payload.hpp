@@ -20,37 +20,47 @@ http://www.fsf.org/licensing/licenses
 >>> END OF LICENSE >>>
 *************************************************************************/
 
+#include "binary_cid.hpp"
+#include "car_index.hpp"
 #include "common/activity/event_recorder.hpp"
 #include "common/helpers.hpp"
+#include "dag_cbor.hpp"
+#include "frame_pool.hpp"
 #include "matcher.hpp"
 #include "parser.hpp"
 #include "post_processor.hpp"
+#include <optional>
 #include <unordered_map>
 
 class jetstream_payload {
 public:
   jetstream_payload();
-  jetstream_payload(std::string json_msg, match_results matches);
+  jetstream_payload(frame_ptr &&frame, match_results matches);
+  // time_us of the message, 0 if not present
+  static int64_t seq_from_frame(std::string_view frame);
+  inline int64_t seq() const { return _frame ? seq_from_frame(*_frame) : 0; }
+  // collection, or event kind if not a commit
+  std::string admission_class() const;
   void handle(post_processor<jetstream_payload> &processor);
-  inline std::string to_string() const { return _json_msg; }
+  inline std::string to_string() const { return _frame ? *_frame : ""; }
 
 private:
-  std::string _json_msg;
+  // the JSON message, returned to frame_pool when payload is destroyed
+  frame_ptr _frame;
   match_results _matches;
 };
 class firehose_payload {
 public:
   firehose_payload();
-  firehose_payload(parser &my_parser);
+  // decodes the frame, throws dag_cbor::decode_error if malformed
+  firehose_payload(frame_ptr &&frame);
+  // seq of the message, 0 if not present e.g. #info
+  static int64_t seq_from_frame(std::string_view frame);
+  inline int64_t seq() const { return _frame ? seq_from_frame(*_frame) : 0; }
+  // collection of the first op, or event type if not a commit
+  std::string admission_class() const;
   void handle(post_processor<firehose_payload> &processor);
-  inline std::string to_string() const {
-    auto const &header(_parser.other_cbors().front().second);
-    auto const &message(_parser.other_cbors().back().second);
-    std::ostringstream oss;
-    oss << "header (" << dump_json(header) << ") message ("
-        << dump_json(message) << ')';
-    return oss.str();
-  }
+  std::string to_string() const;
 
 private:
   struct context {
@@ -75,15 +85,24 @@ private:
     std::vector<embed::embed_info> _embeds;
   };
   void handle_content(post_processor<firehose_payload> &processor,
-                      std::string const &repo, std::string const &cid,
+                      std::string const &repo, atproto::binary_cid const &cid,
                       nlohmann::json const &content);
   void handle_matchable_content(post_processor<firehose_payload> &processor,
-                                std::string const &repo, std::string const &cid,
+                                std::string const &repo,
+                                atproto::binary_cid const &cid,
                                 nlohmann::json const &content);
+  // header and message maps
+  bool is_well_formed() const;
+  static bool is_lazy_collection(std::string const &collection);
+  static void decode_block(car_index const &blocks_index, parser &block_parser,
+                           atproto::binary_cid const &cid);
 
-  parser _parser;
+  // raw CBOR message, returned to frame_pool when payload is destroyed
+  frame_ptr _frame;
+  // header and message, viewing _frame
+  dag_cbor::document_ptr _document;
   path_candidate_list _path_candidates;
-  std::unordered_map<std::string, std::string> _path_by_cid;
+  std::unordered_map<atproto::binary_cid, std::string> _path_by_cid;
 };
 
 #endif
\ No newline at end of file
@@ -25,10 +25,17 @@ http://www.fsf.org/licensing/licenses
 #include "common/helpers.hpp"
 #include "common/log_wrapper.hpp"
 #include "common/metrics_factory.hpp"
+#include "dag_cbor.hpp"
 #include "matcher.hpp"
 #include "moderation/embed_checker.hpp"
 #include "parser.hpp"
 #include "readerwriterqueue.h"
+#include "yaml-cpp/yaml.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
 #include <nlohmann/detail/exceptions.hpp>
 #include <prometheus/counter.h>
 #include <prometheus/gauge.h>
@@ -98,9 +105,20 @@ inline op_kind op_kind_from_string(std::string const &op_kind_str) {
 
 } // namespace firehose
 
+// Admission to the queue is bounded. Past the shedding backlog, configured
+// payload classes (collections) are sampled or dropped. Other classes are
+// never dropped, and the producer waits for space, pushing back on the
+// websocket instead of growing without limit. Only one thread enqueues.
+// Frames that need no post-processing are tracked against the queue, so the
+// processed seq only advances past them once the payloads ahead are handled.
+// Progress is per instance, each connection resumes from what its own
+// pipeline has processed.
 template <typename T> class post_processor {
 public:
   static constexpr size_t QueueLimit = 10000;
+  static constexpr size_t DefaultShedBacklog = QueueLimit / 2;
+  static constexpr std::chrono::milliseconds EnqueueRetryInterval =
+      std::chrono::milliseconds(10);
 
   post_processor() : _queue(QueueLimit) {
     _thread = std::thread([&, this] {
@@ -118,7 +136,11 @@ public:
           } catch (nlohmann::detail::exception const &exc) {
             REL_ERROR("post_processor JSON error {} on payload {}", exc.what(),
                       my_payload.to_string());
+          } catch (dag_cbor::type_error const &exc) {
+            REL_ERROR("post_processor CBOR error {} on payload {}", exc.what(),
+                      my_payload.to_string());
           }
+          handled(my_payload.seq());
         }
       } catch (std::exception const &exc) {
         REL_ERROR("post_processor exception {}", exc.what());
@@ -128,21 +150,123 @@ public:
     });
   }
   ~post_processor() = default;
+
+  void set_config(YAML::Node const &settings) {
+    _shed_backlog =
+        std::min(settings["shed_backlog"].as<size_t>(DefaultShedBacklog),
+                 QueueLimit);
+    for (auto const &policy : settings["shed"]) {
+      _keep_one_in.insert(
+          {policy.first.as<std::string>(), policy.second.as<size_t>()});
+      REL_INFO("post_processor sheds {} past backlog {}, keeps 1 in {}",
+               policy.first.as<std::string>(), _shed_backlog,
+               policy.second.as<size_t>());
+    }
+  }
+
   void wait_enqueue(T &&value) {
-    _queue.enqueue(value);
+    size_t backlog(_queue.size_approx());
+    if (backlog >= _shed_backlog && !_keep_one_in.empty()) {
+      std::string admission_class(value.admission_class());
+      auto policy(_keep_one_in.find(admission_class));
+      if (policy != _keep_one_in.end()) {
+        if (policy->second == 0 ||
+            ++_shed_count[admission_class] % policy->second != 0) {
+          metrics_factory::instance()
+              .get_counter("post_processor_admission")
+              .Get({{"class", admission_class}, {"admission", "dropped"}})
+              .Increment();
+          return;
+        }
+        metrics_factory::instance()
+            .get_counter("post_processor_admission")
+            .Get({{"class", admission_class}, {"admission", "sampled"}})
+            .Increment();
+      }
+    }
+    // everything admitted waits for space
+    if (!_queue.try_enqueue(std::move(value))) {
+      metrics_factory::instance()
+          .get_counter("post_processor_admission")
+          .Get({{"class", value.admission_class()}, {"admission", "delayed"}})
+          .Increment();
+      do {
+        if (!controller::instance().is_active())
+          return;
+        std::this_thread::sleep_for(EnqueueRetryInterval);
+      } while (!_queue.try_enqueue(std::move(value)));
+    }
+    {
+      std::lock_guard guard(_progress_lock);
+      ++_enqueued;
+    }
     metrics_factory::instance()
         .get_gauge("process_operation")
         .Get({{"message", "backlog"}})
         .Increment();
+    if (backlog >= _high_water) {
+      _high_water = backlog + 1;
+      metrics_factory::instance()
+          .get_gauge("process_operation")
+          .Get({{"message", "backlog_high_water"}})
+          .Set(static_cast<double>(_high_water));
+    }
+  }
+  // seq of a frame that needed no post-processing, in wire order
+  void skip(const int64_t seq) {
+    std::lock_guard guard(_progress_lock);
+    if (_handled == _enqueued) {
+      processed(seq);
+      return;
+    }
+    // only the latest seq behind each queued payload matters
+    if (!_skipped.empty() && _skipped.back().first == _enqueued) {
+      _skipped.back().second = seq;
+    } else {
+      _skipped.emplace_back(_enqueued, seq);
+    }
   }
+
+  // Resume point for reconnect, 0 until something is processed
+  inline int64_t last_processed() const { return _last_processed.load(); }
+
   inline void request_recording(activity::timed_event &&event) {
     activity::event_recorder::instance().wait_enqueue(std::move(event));
   }
 
 private:
+  void handled(const int64_t seq) {
+    std::lock_guard guard(_progress_lock);
+    ++_handled;
+    processed(seq);
+    while (!_skipped.empty() && _skipped.front().first <= _handled) {
+      processed(_skipped.front().second);
+      _skipped.pop_front();
+    }
+  }
+
+  // caller holds _progress_lock, never moves backwards
+  void processed(const int64_t seq) {
+    if (seq > _last_processed.load()) {
+      _last_processed.store(seq);
+    }
+  }
+
   // Declare queue between websocket and match post-processing
   moodycamel::BlockingReaderWriterQueue<T> _queue;
   std::thread _thread;
+  size_t _shed_backlog = DefaultShedBacklog;
+  // 0 drops the class while shedding
+  std::unordered_map<std::string, size_t> _keep_one_in;
+  std::unordered_map<std::string, size_t> _shed_count;
+  size_t _high_water = 0;
+  // payloads enqueued and handled, and the skipped seq to record once the
+  // payloads enqueued before it are handled
+  std::mutex _progress_lock;
+  uint64_t _enqueued = 0;
+  uint64_t _handled = 0;
+  std::deque<std::pair<uint64_t, int64_t>> _skipped;
+  std::atomic<int64_t> _last_processed = 0;
 };
 
 #endif
\ No newline at end of file
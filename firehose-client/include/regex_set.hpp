@@ -0,0 +1,82 @@
+#ifndef __regex_set_hpp__
+#define __regex_set_hpp__
+/*************************************************************************
+Public Education Forum Moderation Firehose Client
+Copyright (c) Steve Townsend 2025
+
+>>> SOURCE LICENSE >>>
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation (www.fsf.org); either version 3 of the
+License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+A copy of the GNU General Public License is available at
+http://www.fsf.org/licensing/licenses
+>>> END OF LICENSE >>>
+*************************************************************************/
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <prometheus/counter.h>
+#include <re2/re2.h>
+#include <re2/set.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Unanchored, case-insensitive RE2 patterns matched together by one DFA, so
+// a candidate is scanned once however many patterns there are. RE2 runs in
+// time linear in the text; patterns are still vetted one by one as they are
+// added, so that one costly or catch-all pattern cannot bloat the shared DFA
+// or match every candidate.
+class regex_set {
+public:
+  typedef uint32_t pattern_id;
+  static constexpr pattern_id NoPattern = UINT32_MAX;
+  // compiled program size allowed for one pattern
+  static constexpr int MaxProgramSize = 2000;
+  // and for all of them
+  static constexpr int MaxTotalProgramSize = 200000;
+  // memory budget of the combined DFA
+  static constexpr int64_t MaxMemory = 64 * 1024 * 1024;
+
+  explicit regex_set(const int64_t max_memory = MaxMemory);
+  ~regex_set() = default;
+  regex_set(regex_set const &) = delete;
+  regex_set &operator=(regex_set const &) = delete;
+
+  // build phase only. Returns NoPattern with the reason in error if the
+  // pattern is rejected.
+  pattern_id add(std::string_view pattern, std::string &error);
+  // After this the set is only read. If the combined DFA cannot be built,
+  // patterns are matched one by one.
+  void compile();
+
+  inline size_t pattern_count() const { return _patterns.size(); }
+  inline bool empty() const { return _patterns.empty(); }
+
+  // replaces matches with the IDs of patterns found in text, in no order
+  void scan(std::string_view text, std::vector<int> &matches) const;
+  // counts scans, by any set, that match the patterns one by one. Null for
+  // none.
+  static void set_fallback_counter(prometheus::Counter *counter);
+
+private:
+  RE2::Options _options;
+  std::unique_ptr<RE2::Set> _set;
+  bool _compiled = false;
+  int _program_size = 0;
+  // each pattern alone, for vetting and if the combined DFA runs out of
+  // memory
+  std::vector<std::unique_ptr<RE2>> _patterns;
+  // the combined DFA ran out of memory in a scan, logged once
+  mutable std::atomic<bool> _fallback_logged = false;
+};
+
+#endif
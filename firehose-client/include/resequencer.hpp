@@ -0,0 +1,138 @@
+#ifndef __resequencer_hpp__
+#define __resequencer_hpp__
+/*************************************************************************
+Public Education Forum Moderation Firehose Client
+Copyright (c) Steve Townsend 2025
+
+>>> SOURCE LICENSE >>>
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation (www.fsf.org); either version 3 of the
+License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+A copy of the GNU General Public License is available at
+http://www.fsf.org/licensing/licenses
+>>> END OF LICENSE >>>
+*************************************************************************/
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+// Restores wire order for work completed out of order by a pool of threads.
+// Each item is tagged with the ordinal it was read at. Completed items are
+// released to the sink strictly in ordinal order. The sink is called outside
+// the lock by one thread at a time, so it sees a single producer, and a sink
+// that blocks does not hold up threads completing later items. Empty results
+// (nothing to pass on, or a failed decode) must still be completed or the
+// stream stalls behind them.
+// The reader waits for admission before handing out an ordinal, so at most
+// window items are between the reader and the sink: queued, in progress or
+// pending. A sink that blocks pushes back on the reader.
+template <typename T> class resequencer {
+public:
+  typedef std::function<void(T &&)> sink_t;
+
+  resequencer() = delete;
+  resequencer(sink_t sink,
+              const size_t window = std::numeric_limits<size_t>::max())
+      : _sink(sink), _window(window) {}
+  ~resequencer() = default;
+
+  // true once ordinal is within the window after the items the sink is done
+  // with, false on timeout
+  template <typename Rep, typename Period>
+  bool wait_admission(const uint64_t ordinal,
+                      std::chrono::duration<Rep, Period> const &timeout) {
+    std::unique_lock guard(_lock);
+    return _admission.wait_for(guard, timeout, [&, this] {
+      return ordinal - _released < _window;
+    });
+  }
+
+  void complete(const uint64_t ordinal, std::optional<T> &&value) {
+    std::vector<std::optional<T>> ready;
+    {
+      std::lock_guard guard(_lock);
+      // another thread is releasing, it takes this item when it gets there
+      if (ordinal != _next || _releasing) {
+        _pending.emplace(ordinal, std::move(value));
+        if (_pending.size() > _high_water) {
+          _high_water = _pending.size();
+        }
+        return;
+      }
+      _releasing = true;
+      ready.push_back(std::move(value));
+      ++_next;
+      take_ready(ready);
+    }
+    try {
+      while (!ready.empty()) {
+        for (auto &next : ready) {
+          if (next.has_value()) {
+            _sink(std::move(next.value()));
+          }
+        }
+        std::lock_guard guard(_lock);
+        _released += ready.size();
+        _admission.notify_all();
+        ready.clear();
+        take_ready(ready);
+        if (ready.empty()) {
+          _releasing = false;
+        }
+      }
+    } catch (...) {
+      std::lock_guard guard(_lock);
+      _releasing = false;
+      throw;
+    }
+  }
+
+  // items completed but waiting on an earlier ordinal
+  size_t pending() const {
+    std::lock_guard guard(_lock);
+    return _pending.size();
+  }
+  size_t high_water() const {
+    std::lock_guard guard(_lock);
+    return _high_water;
+  }
+
+private:
+  // moves the run of items that follow those already released, under the lock
+  void take_ready(std::vector<std::optional<T>> &ready) {
+    for (auto next = _pending.begin();
+         next != _pending.end() && next->first == _next;
+         next = _pending.erase(next)) {
+      ready.push_back(std::move(next->second));
+      ++_next;
+    }
+  }
+
+  mutable std::mutex _lock;
+  sink_t _sink;
+  size_t _window;
+  std::condition_variable _admission;
+  uint64_t _next = 0;
+  // items the sink is done with, _next also counts those being released
+  uint64_t _released = 0;
+  // one thread at a time calls the sink
+  bool _releasing = false;
+  size_t _high_water = 0;
+  std::map<uint64_t, std::optional<T>> _pending;
+};
+
+#endif
@@ -0,0 +1,123 @@
+#ifndef __rule_expression_hpp__
+#define __rule_expression_hpp__
+/*************************************************************************
+Public Education Forum Moderation Firehose Client
+Copyright (c) Steve Townsend 2025
+
+>>> SOURCE LICENSE >>>
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation (www.fsf.org); either version 3 of the
+License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+A copy of the GNU General Public License is available at
+http://www.fsf.org/licensing/licenses
+>>> END OF LICENSE >>>
+*************************************************************************/
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Boolean rule expression over substrings, for match=expr rules. Leaves are
+// substrings, quoted if they contain spaces, optionally qualified by the
+// candidate field they must be found in:
+//
+//   scam AND (crypto OR "wallet drainer") AND NOT text:giveaway
+//   free NEAR/3 followers
+//
+// NEAR/N binds tightest, joining the terms either side when they are found
+// within N words of each other, then NOT, then AND, then OR. Adjacent terms
+// are ANDed.
+// Each candidate field is scanned on its own, so terms qualified with
+// different fields cannot be joined by AND or NEAR.
+// Leaves are compiled into the rule automaton, and the expression is
+// evaluated against the set of leaves a candidate contains, one bit each.
+class rule_expression {
+public:
+  static constexpr size_t MaxLeaves = 64;
+  // of NOT and brackets, and of operands pending evaluation, one bit each
+  static constexpr size_t MaxDepth = 64;
+  // fields a leaf can be qualified with, as the last segment of a
+  // candidate's field, lower case
+  static constexpr std::string_view Fields[] = {
+      "text", "description", "displayname", "title", "uri", "alt", "handle"};
+  // candidate fields holding a link whose names do not end in "uri": a link
+  // facet, and a redirect target from embed_checker. Leaves qualified with
+  // "uri" match them too.
+  static constexpr std::string_view LinkFields[] = {
+      "app.bsky.richtext.facet#link", "redirected_url"};
+
+  struct leaf {
+    std::string _text;
+    // empty for any field
+    std::string _field;
+  };
+
+  rule_expression() = default;
+  // throws std::invalid_argument if malformed, or if it holds for a
+  // candidate with no leaves in it
+  explicit rule_expression(std::string_view source);
+
+  inline bool empty() const { return _program.empty(); }
+  inline std::vector<leaf> const &leaves() const { return _leaves; }
+  inline bool has_proximity() const { return _has_proximity; }
+  // true if field, a candidate field such as "/embed/external/uri",
+  // qualifies for the leaf
+  bool field_matches(const size_t index, std::string_view field) const;
+
+  // seen has bit N set if leaf N is in the candidate. within(first, second,
+  // distance) says whether the two leaves occur within distance words.
+  template <typename Within>
+  bool evaluate(const uint64_t seen, Within &&within) const {
+    // one bit per operand
+    uint64_t stack(0);
+    for (auto const &next : _program) {
+      switch (next._op) {
+      case op::leaf:
+        stack = (stack << 1) | ((seen >> next._leaf) & 1);
+        break;
+      case op::negate:
+        stack ^= 1;
+        break;
+      case op::both:
+        stack = (stack >> 1) & (stack | ~uint64_t(1));
+        break;
+      case op::either:
+        stack = (stack >> 1) | (stack & 1);
+        break;
+      case op::near: {
+        const uint64_t pair((uint64_t(1) << next._leaf) |
+                            (uint64_t(1) << next._other));
+        const bool found((seen & pair) == pair &&
+                         within(next._leaf, next._other, next._distance));
+        stack = (stack << 1) | (found ? 1 : 0);
+      } break;
+      }
+    }
+    return (stack & 1) != 0;
+  }
+
+private:
+  enum class op : uint8_t { leaf, negate, both, either, near };
+  struct step {
+    op _op;
+    uint8_t _leaf;
+    uint8_t _other;
+    uint16_t _distance;
+  };
+  class parser;
+
+  std::vector<leaf> _leaves;
+  // postfix
+  std::vector<step> _program;
+  bool _has_proximity = false;
+};
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef __scan_cache_hpp__
+#define __scan_cache_hpp__
+/*************************************************************************
+Public Education Forum Moderation Firehose Client
+Copyright (c) Steve Townsend 2025
+
+>>> SOURCE LICENSE >>>
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation (www.fsf.org); either version 3 of the
+License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+A copy of the GNU General Public License is available at
+http://www.fsf.org/licensing/licenses
+>>> END OF LICENSE >>>
+*************************************************************************/
+
+#include <array>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Rule hits for recently scanned canonical text, so repeated text (spam,
+// copy-pasta, display names) is not scanned again. Keyed by a 64-bit hash
+// of the text and what else the hits depend on, plus the version of the
+// rules that scanned it, so a rule refresh invalidates every entry. The text
+// and field are kept and compared, so texts whose hashes collide never share
+// hits. Entries live in a fixed number of slots, split across independently
+// locked shards; a new entry replaces whatever occupied its slot.
+class scan_cache {
+public:
+  static constexpr size_t ShardCount = 64;
+
+  scan_cache() = default;
+  ~scan_cache() = default;
+  scan_cache(scan_cache const &) = delete;
+  scan_cache &operator=(scan_cache const &) = delete;
+
+  // not thread-safe. Drops all entries, 0 disables the cache.
+  void set_capacity(const size_t capacity);
+  inline bool is_enabled() const { return _slots_per_shard > 0; }
+
+  static uint64_t hash(std::string_view text);
+  // replaces hits with the cached hits, returns false if not cached
+  bool find(std::string_view text, std::string_view field,
+            const uint64_t text_hash, const uint64_t version,
+            std::vector<uint32_t> &hits) const;
+  void store(std::string_view text, std::string_view field,
+             const uint64_t text_hash, const uint64_t version,
+             std::vector<uint32_t> const &hits);
+
+private:
+  struct entry {
+    uint64_t _hash = 0;
+    std::string _text;
+    std::string _field;
+    // 0 is an empty slot
+    uint64_t _version = 0;
+    std::vector<uint32_t> _hits;
+  };
+  struct shard {
+    mutable std::mutex _lock;
+    std::vector<entry> _slots;
+  };
+  inline shard &shard_for(const uint64_t text_hash) const {
+    return _shards[text_hash % ShardCount];
+  }
+  inline size_t slot_for(const uint64_t text_hash) const {
+    return (text_hash / ShardCount) % _slots_per_shard;
+  }
+
+  mutable std::array<shard, ShardCount> _shards;
+  size_t _slots_per_shard = 0;
+};
+
+#endif
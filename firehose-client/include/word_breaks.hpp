@@ -0,0 +1,65 @@
+#ifndef __word_breaks_hpp__
+#define __word_breaks_hpp__
+/*************************************************************************
+Public Education Forum Moderation Firehose Client
+Copyright (c) Steve Townsend 2025
+
+>>> SOURCE LICENSE >>>
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation (www.fsf.org); either version 3 of the
+License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+A copy of the GNU General Public License is available at
+http://www.fsf.org/licensing/licenses
+>>> END OF LICENSE >>>
+*************************************************************************/
+
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <unicode/brkiter.h>
+#include <vector>
+
+// Word boundaries of one case-folded text, for whole-word rules. Each edge
+// of a match is decided on its own. Where the code points either side of
+// the edge are in scripts that separate words with spaces or punctuation,
+// the code point outside the match must not be a letter, so emoji, dashes
+// and apostrophes elsewhere in the text change nothing. Where either is in
+// a script written without spaces - Han, Hiragana, Katakana, Thai, Lao,
+// Khmer or Myanmar - the edge must be a boundary from an ICU dictionary-based
+// word break iterator, run once per text and only when first needed. The
+// iterator and boundary buffer are reused from one text to the next, so keep
+// one instance per thread.
+class word_breaks {
+public:
+  word_breaks() = default;
+  ~word_breaks() = default;
+  word_breaks(word_breaks const &) = delete;
+  word_breaks &operator=(word_breaks const &) = delete;
+
+  // text must outlive any query before the next reset
+  void reset(std::string_view text);
+  // true if [start, end) of the text starts and ends on word boundaries
+  bool is_whole_word(const size_t start, const size_t end);
+
+private:
+  enum class segmentation : uint8_t { pending, done, failed };
+  // outside and inside are the code points either side of offset
+  bool is_edge(const size_t offset, char32_t const outside,
+               char32_t const inside);
+  bool segment();
+
+  std::string_view _text;
+  segmentation _segmentation = segmentation::pending;
+  std::unique_ptr<icu::BreakIterator> _iterator;
+  // byte offsets, in order
+  std::vector<int32_t> _boundaries;
+};
+
+#endif
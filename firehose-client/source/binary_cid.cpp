@@ -0,0 +1,54 @@
+/*************************************************************************
+Public Education Forum Moderation Firehose Client
+Copyright (c) Steve Townsend 2025
+
+>>> SOURCE LICENSE >>>
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation (www.fsf.org); either version 3 of the
+License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+A copy of the GNU General Public License is available at
+http://www.fsf.org/licensing/licenses
+>>> END OF LICENSE >>>
+*************************************************************************/
+
+#include "binary_cid.hpp"
+#include "common/bluesky/platform.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+namespace atproto {
+
+binary_cid::binary_cid(bytes raw) {
+  if (raw.size() == Size) {
+    std::ranges::copy(raw, _bytes.begin());
+  } else if (raw.size() == Size - V0Offset) {
+    // CIDv0 is a bare sha2-256 multihash, version and codec stay zero
+    std::ranges::copy(raw, _bytes.begin() + V0Offset);
+  } else {
+    throw std::invalid_argument("CID has unsupported length " +
+                                std::to_string(raw.size()));
+  }
+}
+
+binary_cid binary_cid::from_link(bytes link) {
+  if (link.empty() || link[0] != 0) {
+    throw std::invalid_argument("CID link has no multibase prefix");
+  }
+  return binary_cid(link.subspan(1));
+}
+
+std::string binary_cid::to_string() const {
+  if (!is_valid())
+    return {};
+  bytes wire(raw());
+  return cid_decoder<bytes::iterator>(wire.begin(), wire.end()).as_string();
+}
+
+} // namespace atproto
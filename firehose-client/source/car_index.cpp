@@ -0,0 +1,82 @@
+/*************************************************************************
+Public Education Forum Moderation Firehose Client
+Copyright (c) Steve Townsend 2025
+
+>>> SOURCE LICENSE >>>
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation (www.fsf.org); either version 3 of the
+License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+A copy of the GNU General Public License is available at
+http://www.fsf.org/licensing/licenses
+>>> END OF LICENSE >>>
+*************************************************************************/
+
+#include "car_index.hpp"
+
+namespace {
+inline std::string_view as_key(car_index::bytes cid) {
+  return std::string_view(reinterpret_cast<const char *>(cid.data()),
+                          cid.size());
+}
+} // namespace
+
+car_index::car_index(bytes car) {
+  size_t offset(0);
+  uint64_t length(0);
+  // header is DAG-CBOR with roots, not needed
+  if (!read_varint(car, offset, length) || length > car.size() - offset)
+    return;
+  offset += length;
+  while (offset < car.size()) {
+    if (!read_varint(car, offset, length) || length > car.size() - offset)
+      return;
+    size_t block_end(offset + length);
+    size_t cid_start(offset);
+    if (!read_cid(car, offset) || offset > block_end)
+      return;
+    _blocks.insert({as_key(car.subspan(cid_start, offset - cid_start)),
+                    car.subspan(offset, block_end - offset)});
+    offset = block_end;
+  }
+  _valid = true;
+}
+
+car_index::bytes car_index::find(bytes cid) const {
+  auto block(_blocks.find(as_key(cid)));
+  return block == _blocks.cend() ? bytes() : block->second;
+}
+
+bool car_index::read_varint(bytes car, size_t &offset, uint64_t &value) const {
+  value = 0;
+  for (uint32_t shift = 0; offset < car.size() && shift < 64; shift += 7) {
+    uint8_t next(car[offset++]);
+    value |= static_cast<uint64_t>(next & 0x7f) << shift;
+    if (!(next & 0x80))
+      return true;
+  }
+  return false;
+}
+
+bool car_index::read_cid(bytes car, size_t &offset) const {
+  // v0 is a bare sha2-256 multihash
+  if (offset + 2 <= car.size() && car[offset] == 0x12 &&
+      car[offset + 1] == 0x20) {
+    offset += 34;
+    return offset <= car.size();
+  }
+  uint64_t version, codec, hash_code, digest_length;
+  if (!read_varint(car, offset, version) || !read_varint(car, offset, codec) ||
+      !read_varint(car, offset, hash_code) ||
+      !read_varint(car, offset, digest_length) ||
+      digest_length > car.size() - offset)
+    return false;
+  offset += digest_length;
+  return true;
+}
@@ -0,0 +1,308 @@
+/*************************************************************************
+Public Education Forum Moderation Firehose Client
+Copyright (c) Steve Townsend 2025
+
+>>> SOURCE LICENSE >>>
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation (www.fsf.org); either version 3 of the
+License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+A copy of the GNU General Public License is available at
+http://www.fsf.org/licensing/licenses
+>>> END OF LICENSE >>>
+*************************************************************************/
+
+#include "case_folding.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <unicode/uchar.h>
+#include <unicode/ustring.h>
+#include <unicode/utf16.h>
+#include <vector>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace case_folding {
+
+namespace {
+
+constexpr char32_t Replacement = 0xFFFD;
+constexpr char32_t FirstSupplementary = 0x10000;
+
+// writes up to 4 bytes, returning the count
+size_t encode(char32_t const code_point, char *output) {
+  if (code_point < 0x80) {
+    output[0] = static_cast<char>(code_point);
+    return 1;
+  }
+  if (code_point < 0x800) {
+    output[0] = static_cast<char>(0xC0 | (code_point >> 6));
+    output[1] = static_cast<char>(0x80 | (code_point & 0x3F));
+    return 2;
+  }
+  if (code_point < FirstSupplementary) {
+    output[0] = static_cast<char>(0xE0 | (code_point >> 12));
+    output[1] = static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+    output[2] = static_cast<char>(0x80 | (code_point & 0x3F));
+    return 3;
+  }
+  output[0] = static_cast<char>(0xF0 | (code_point >> 18));
+  output[1] = static_cast<char>(0x80 | ((code_point >> 12) & 0x3F));
+  output[2] = static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+  output[3] = static_cast<char>(0x80 | (code_point & 0x3F));
+  return 4;
+}
+
+// length of the code point at offset, or 0 if it is malformed
+size_t decode(std::string_view text, const size_t offset,
+              char32_t &code_point) {
+  const uint8_t lead(static_cast<uint8_t>(text[offset]));
+  if (lead < 0x80) {
+    code_point = lead;
+    return 1;
+  }
+  size_t length;
+  char32_t value;
+  char32_t minimum;
+  if ((lead & 0xE0) == 0xC0) {
+    length = 2;
+    value = lead & 0x1F;
+    minimum = 0x80;
+  } else if ((lead & 0xF0) == 0xE0) {
+    length = 3;
+    value = lead & 0x0F;
+    minimum = 0x800;
+  } else if ((lead & 0xF8) == 0xF0) {
+    length = 4;
+    value = lead & 0x07;
+    minimum = FirstSupplementary;
+  } else {
+    return 0;
+  }
+  if (offset + length > text.length())
+    return 0;
+  for (size_t next = 1; next < length; ++next) {
+    const uint8_t trail(static_cast<uint8_t>(text[offset + next]));
+    if ((trail & 0xC0) != 0x80)
+      return 0;
+    value = (value << 6) | (trail & 0x3F);
+  }
+  // overlong, surrogate or out of range
+  if (value < minimum || value > 0x10FFFF ||
+      (value >= 0xD800 && value <= 0xDFFF))
+    return 0;
+  code_point = value;
+  return length;
+}
+
+// Folded UTF-8 for every BMP code point, built once from ICU. Stage one maps
+// a block of code points to a block of entries; most blocks fold nothing and
+// share one all-zero block. An entry is the offset of the folded bytes
+// shifted left by 4, plus their length, or 0 if the code point folds to
+// itself.
+class fold_table {
+public:
+  fold_table() {
+    std::map<std::vector<uint32_t>, uint16_t> known_blocks;
+    std::vector<uint32_t> block(BlockSize);
+    for (char32_t first = 0; first < FirstSupplementary; first += BlockSize) {
+      for (char32_t low = 0; low < BlockSize; ++low) {
+        block[low] = entry_for(first + low);
+      }
+      auto known(known_blocks.find(block));
+      if (known == known_blocks.end()) {
+        known = known_blocks
+                    .insert({block, static_cast<uint16_t>(_entries.size() /
+                                                          BlockSize)})
+                    .first;
+        _entries.insert(_entries.end(), block.cbegin(), block.cend());
+      }
+      _blocks.push_back(known->second);
+    }
+  }
+
+  // empty if the code point folds to itself
+  inline std::string_view lookup(char32_t const code_point) const {
+    const uint32_t entry(
+        _entries[(static_cast<size_t>(_blocks[code_point >> BlockBits])
+                  << BlockBits) |
+                 (code_point & BlockMask)]);
+    return std::string_view(_folded).substr(entry >> 4, entry & 0xF);
+  }
+
+private:
+  static constexpr size_t BlockBits = 7;
+  static constexpr char32_t BlockSize = 1 << BlockBits;
+  static constexpr char32_t BlockMask = BlockSize - 1;
+
+  uint32_t entry_for(char32_t const code_point) {
+    if (code_point < 0x80 || U16_IS_SURROGATE(code_point))
+      return 0;
+    const UChar source(static_cast<UChar>(code_point));
+    UChar target[8];
+    UErrorCode error(U_ZERO_ERROR);
+    const int32_t length(u_strFoldCase(target, 8, &source, 1,
+                                       U_FOLD_CASE_DEFAULT, &error));
+    if (U_FAILURE(error) || (length == 1 && target[0] == source))
+      return 0;
+    const size_t offset(_folded.length());
+    for (int32_t next = 0; next < length;) {
+      UChar32 folded;
+      U16_NEXT(target, next, length, folded);
+      char encoded[4];
+      _folded.append(encoded,
+                     encode(static_cast<char32_t>(folded), encoded));
+    }
+    return static_cast<uint32_t>((offset << 4) | (_folded.length() - offset));
+  }
+
+  std::vector<uint16_t> _blocks;
+  std::vector<uint32_t> _entries;
+  std::string _folded;
+};
+
+inline char ascii_fold(char const next) {
+  return static_cast<uint8_t>(next - 'A') < 26 ? static_cast<char>(next + 32)
+                                                : next;
+}
+
+// Writes into a string sized up front, since almost all text folds to the
+// same length, growing it only when folding expands the text
+class writer {
+public:
+  writer(std::string &output, const size_t expected) : _output(output) {
+    _output.resize(expected);
+  }
+  ~writer() { _output.resize(_written); }
+
+  inline char *reserve(const size_t length) {
+    if (_written + length > _output.length())
+      _output.resize(std::max(_output.length() * 2, _written + length));
+    return _output.data() + _written;
+  }
+  inline void commit(const size_t length) { _written += length; }
+  inline void append(std::string_view bytes) {
+    std::memcpy(reserve(bytes.length()), bytes.data(), bytes.length());
+    commit(bytes.length());
+  }
+  inline void append(char32_t const code_point) {
+    commit(encode(code_point, reserve(4)));
+  }
+
+private:
+  std::string &_output;
+  size_t _written = 0;
+};
+
+// folds the leading run of ASCII, returning its length
+size_t fold_ascii(std::string_view input, writer &output) {
+  char *target(output.reserve(input.length()));
+  size_t offset(0);
+#if defined(__SSE2__)
+  const __m128i before_upper(_mm_set1_epi8('A' - 1));
+  const __m128i after_upper(_mm_set1_epi8('Z' + 1));
+  const __m128i case_bit(_mm_set1_epi8(0x20));
+  for (; offset + 16 <= input.length(); offset += 16) {
+    __m128i chunk(_mm_loadu_si128(
+        reinterpret_cast<__m128i const *>(input.data() + offset)));
+    // any byte with the top bit set starts a multi-byte sequence
+    if (_mm_movemask_epi8(chunk) != 0)
+      break;
+    const __m128i upper(_mm_and_si128(_mm_cmpgt_epi8(chunk, before_upper),
+                                      _mm_cmplt_epi8(chunk, after_upper)));
+    chunk = _mm_or_si128(chunk, _mm_and_si128(upper, case_bit));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(target + offset), chunk);
+  }
+#endif
+  for (; offset < input.length() && static_cast<uint8_t>(input[offset]) < 0x80;
+       ++offset) {
+    target[offset] = ascii_fold(input[offset]);
+  }
+  output.commit(offset);
+  return offset;
+}
+
+} // namespace
+
+void fold(std::string_view input, std::string &output) {
+  static const fold_table table;
+  writer folded_output(output, input.length());
+  size_t offset(0);
+  while (offset < input.length()) {
+    if (static_cast<uint8_t>(input[offset]) < 0x80) {
+      offset += fold_ascii(input.substr(offset), folded_output);
+      continue;
+    }
+    // copy a run of code points that fold to themselves in one go
+    const size_t unchanged(offset);
+    std::string_view folded;
+    char32_t code_point;
+    size_t length(0);
+    while (offset < input.length() &&
+           static_cast<uint8_t>(input[offset]) >= 0x80) {
+      length = decode(input, offset, code_point);
+      if (length == 0)
+        break;
+      if (code_point >= FirstSupplementary) {
+        // folding outside the BMP is one to one
+        if (u_foldCase(static_cast<UChar32>(code_point),
+                       U_FOLD_CASE_DEFAULT) !=
+            static_cast<UChar32>(code_point))
+          break;
+      } else {
+        folded = table.lookup(code_point);
+        if (!folded.empty())
+          break;
+      }
+      offset += length;
+    }
+    folded_output.append(input.substr(unchanged, offset - unchanged));
+    if (offset == input.length() ||
+        static_cast<uint8_t>(input[offset]) < 0x80)
+      continue;
+    if (length == 0) {
+      folded_output.append(Replacement);
+      ++offset;
+    } else if (code_point >= FirstSupplementary) {
+      folded_output.append(static_cast<char32_t>(u_foldCase(
+          static_cast<UChar32>(code_point), U_FOLD_CASE_DEFAULT)));
+      offset += length;
+    } else {
+      folded_output.append(folded);
+      offset += length;
+    }
+  }
+}
+
+std::string folded(std::string_view input) {
+  std::string output;
+  fold(input, output);
+  return output;
+}
+
+char32_t code_point_at(std::string_view text, const size_t offset) {
+  char32_t code_point;
+  return decode(text, offset, code_point) == 0 ? Replacement : code_point;
+}
+
+char32_t code_point_before(std::string_view text, const size_t offset) {
+  size_t start(offset);
+  do {
+    --start;
+  } while (start > 0 && offset - start < 4 &&
+           (static_cast<uint8_t>(text[start]) & 0xC0) == 0x80);
+  char32_t code_point;
+  return decode(text, start, code_point) == offset - start ? code_point
+                                                           : Replacement;
+}
+
+} // namespace case_folding
@@ -22,9 +22,24 @@ http://www.fsf.org/licensing/licenses
 #include "payload.hpp"
 
 template <>
-void content_handler<firehose_payload>::handle(
-    beast::flat_buffer const &beast_data) {
-  parser my_parser;
-  my_parser.get_candidates_from_flat_buffer(beast_data);
-  _post_processor.wait_enqueue(firehose_payload(my_parser));
-}
\ No newline at end of file
+content_handler<firehose_payload>::decoded
+content_handler<firehose_payload>::decode(frame_ptr &&frame) {
+  return {firehose_payload(std::move(frame))};
+}
+
+// matched during post-processing, one message at a time
+template <>
+void content_handler<firehose_payload>::decode_batch(
+    std::vector<raw_frame> &frames, const size_t count) {
+  for (size_t index = 0; index < count; ++index) {
+    std::optional<decoded> result;
+    try {
+      result = decode(std::move(frames[index]._data));
+    } catch (std::exception const &exc) {
+      REL_ERROR("decoder error {} on frame {}", exc.what(),
+                frames[index]._ordinal);
+    }
+    _resequencer.complete(frames[index]._ordinal, std::move(result));
+    frames[index]._data.reset();
+  }
+}
@@ -0,0 +1,364 @@
+/*************************************************************************
+Public Education Forum Moderation Firehose Client
+Copyright (c) Steve Townsend 2025
+
+>>> SOURCE LICENSE >>>
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation (www.fsf.org); either version 3 of the
+License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+A copy of the GNU General Public License is available at
+http://www.fsf.org/licensing/licenses
+>>> END OF LICENSE >>>
+*************************************************************************/
+
+#include "dag_cbor.hpp"
+#include <bit>
+#include <cstring>
+#include <format>
+#include <limits>
+#include <new>
+
+namespace dag_cbor {
+
+namespace {
+constexpr uint64_t LinkTag = 42;
+
+constexpr std::string_view kind_name(kind type) {
+  constexpr std::array<std::string_view, 9> names = {
+      "null", "boolean", "integer", "floating", "bytes",
+      "text", "array",   "map",     "link"};
+  return names[static_cast<size_t>(type)];
+}
+
+[[noreturn]] void wrong_type(kind actual, kind expected) {
+  throw type_error(std::format("DAG-CBOR {} accessed as {}",
+                               kind_name(actual), kind_name(expected)));
+}
+} // namespace
+
+class reader {
+public:
+  reader(std::string_view data, size_t offset, std::pmr::memory_resource &arena)
+      : _data(data), _offset(offset), _arena(arena) {}
+
+  inline size_t offset() const { return _offset; }
+
+  void decode(value &result, const size_t depth) {
+    if (depth > MaxDepth)
+      throw decode_error("DAG-CBOR nesting too deep");
+    uint8_t major;
+    uint64_t argument;
+    head(major, argument);
+    switch (major) {
+    case 0:
+    case 1:
+      // -1 - argument fits int64_t exactly when argument does
+      if (argument > static_cast<uint64_t>(std::numeric_limits<int64_t>::max()))
+        throw decode_error("DAG-CBOR integer out of range");
+      result._kind = kind::integer;
+      result._integer = major == 0 ? static_cast<int64_t>(argument)
+                                   : -1 - static_cast<int64_t>(argument);
+      break;
+    case 2:
+    case 3:
+      result._kind = major == 2 ? kind::bytes : kind::text;
+      result._data = take(argument);
+      result._size = argument;
+      break;
+    case 4: {
+      value *items(allocate<value>(argument));
+      for (uint64_t item = 0; item < argument; ++item) {
+        decode(items[item], depth + 1);
+      }
+      result._kind = kind::array;
+      result._data = items;
+      result._size = argument;
+      break;
+    }
+    case 5: {
+      entry *entries(allocate<entry>(argument));
+      for (uint64_t item = 0; item < argument; ++item) {
+        uint64_t length;
+        head(major, length);
+        // DAG-CBOR map keys are always strings
+        if (major != 3)
+          throw decode_error("DAG-CBOR map key is not a string");
+        entries[item]._key =
+            std::string_view(static_cast<const char *>(take(length)), length);
+        decode(entries[item]._value, depth + 1);
+      }
+      result._kind = kind::map;
+      result._data = entries;
+      result._size = argument;
+      break;
+    }
+    case 6:
+      decode(result, depth + 1);
+      if (argument == LinkTag) {
+        if (result._kind != kind::bytes)
+          throw decode_error("DAG-CBOR link is not bytes");
+        result._kind = kind::link;
+      }
+      break;
+    case 7:
+      simple(result, argument);
+      break;
+    }
+  }
+
+private:
+  void head(uint8_t &major, uint64_t &argument) {
+    if (_offset >= _data.size())
+      throw decode_error("DAG-CBOR truncated");
+    uint8_t initial(static_cast<uint8_t>(_data[_offset++]));
+    major = initial >> 5;
+    uint8_t info(initial & 0x1f);
+    _info = info;
+    if (info < 24) {
+      argument = info;
+      return;
+    }
+    // no indefinite lengths in DAG-CBOR
+    if (info > 27)
+      throw decode_error("DAG-CBOR invalid additional info");
+    size_t length(size_t(1) << (info - 24));
+    const uint8_t *next(static_cast<const uint8_t *>(take(length)));
+    argument = 0;
+    for (size_t count = 0; count < length; ++count) {
+      argument = (argument << 8) | next[count];
+    }
+  }
+
+  void simple(value &result, const uint64_t argument) {
+    switch (_info) {
+    case 20:
+    case 21:
+      result._kind = kind::boolean;
+      result._boolean = _info == 21;
+      return;
+    case 22:
+    case 23:
+      result._kind = kind::null_;
+      return;
+    case 26:
+      result._kind = kind::floating;
+      result._floating = std::bit_cast<float>(static_cast<uint32_t>(argument));
+      return;
+    case 27:
+      result._kind = kind::floating;
+      result._floating = std::bit_cast<double>(argument);
+      return;
+    default:
+      throw decode_error("DAG-CBOR unsupported simple value");
+    }
+  }
+
+  const void *take(const uint64_t length) {
+    if (length > _data.size() - _offset)
+      throw decode_error("DAG-CBOR truncated");
+    const void *start(_data.data() + _offset);
+    _offset += length;
+    return start;
+  }
+
+  template <typename T> T *allocate(const uint64_t count) {
+    // every element needs at least one input byte
+    if (count > _data.size() - _offset)
+      throw decode_error("DAG-CBOR truncated");
+    if (count == 0)
+      return nullptr;
+    T *items(static_cast<T *>(_arena.allocate(count * sizeof(T), alignof(T))));
+    for (uint64_t item = 0; item < count; ++item) {
+      new (items + item) T();
+    }
+    return items;
+  }
+
+  std::string_view _data;
+  size_t _offset;
+  uint8_t _info = 0;
+  std::pmr::memory_resource &_arena;
+};
+
+bool value::as_bool() const {
+  if (_kind != kind::boolean)
+    wrong_type(_kind, kind::boolean);
+  return _boolean;
+}
+
+int64_t value::as_integer() const {
+  if (_kind != kind::integer)
+    wrong_type(_kind, kind::integer);
+  return _integer;
+}
+
+double value::as_double() const {
+  if (_kind == kind::integer)
+    return static_cast<double>(_integer);
+  if (_kind != kind::floating)
+    wrong_type(_kind, kind::floating);
+  return _floating;
+}
+
+std::string_view value::as_text() const {
+  if (_kind != kind::text)
+    wrong_type(_kind, kind::text);
+  return std::string_view(static_cast<const char *>(_data), _size);
+}
+
+bytes value::as_bytes() const {
+  if (_kind != kind::bytes && _kind != kind::link)
+    wrong_type(_kind, kind::bytes);
+  return bytes(static_cast<const uint8_t *>(_data), _size);
+}
+
+std::span<const value> value::items() const {
+  if (_kind != kind::array)
+    wrong_type(_kind, kind::array);
+  return std::span<const value>(static_cast<const value *>(_data), _size);
+}
+
+std::span<const entry> value::entries() const {
+  if (_kind != kind::map)
+    wrong_type(_kind, kind::map);
+  return std::span<const entry>(static_cast<const entry *>(_data), _size);
+}
+
+value const *value::find(std::string_view key) const {
+  if (_kind != kind::map)
+    return nullptr;
+  // atproto maps are small, linear beats hashing
+  for (auto const &next : entries()) {
+    if (next._key == key)
+      return &next._value;
+  }
+  return nullptr;
+}
+
+value const &value::operator[](std::string_view key) const {
+  value const *found(find(key));
+  if (!found)
+    throw type_error(std::format("DAG-CBOR map has no key {}", key));
+  return *found;
+}
+
+size_t value::size() const {
+  return _kind == kind::array || _kind == kind::map ? _size : 0;
+}
+
+value decode(std::string_view data, size_t &offset,
+             std::pmr::memory_resource &arena) {
+  reader item_reader(data, offset, arena);
+  value result;
+  item_reader.decode(result, 0);
+  offset = item_reader.offset();
+  return result;
+}
+
+nlohmann::json to_json(value const &item) {
+  switch (item.type()) {
+  case kind::null_:
+    return nullptr;
+  case kind::boolean:
+    return item.as_bool();
+  case kind::integer:
+    return item.as_integer();
+  case kind::floating:
+    return item.as_double();
+  case kind::bytes: {
+    auto content(item.as_bytes());
+    return nlohmann::json::binary({content.begin(), content.end()});
+  }
+  case kind::link: {
+    auto content(item.as_bytes());
+    return nlohmann::json::binary({content.begin(), content.end()}, LinkTag);
+  }
+  case kind::text:
+    return std::string(item.as_text());
+  case kind::array: {
+    nlohmann::json result(nlohmann::json::array());
+    for (auto const &next : item.items()) {
+      result.push_back(to_json(next));
+    }
+    return result;
+  }
+  case kind::map: {
+    nlohmann::json result(nlohmann::json::object());
+    for (auto const &next : item.entries()) {
+      result[std::string(next._key)] = to_json(next._value);
+    }
+    return result;
+  }
+  }
+  return nullptr;
+}
+
+document::document(std::string_view frame)
+    : _arena(_initial.data(), _initial.size()), _items(&_arena) {
+  assign(frame);
+}
+
+void document::assign(std::string_view frame) {
+  // values point into the arena, drop them before it is reused
+  _items = std::pmr::vector<value>(&_arena);
+  _arena.release();
+  // firehose frames are header and message
+  _items.reserve(2);
+  size_t offset(0);
+  while (offset < frame.size()) {
+    _items.push_back(decode(frame, offset, _arena));
+  }
+}
+
+void document_pool::releaser::operator()(document *item) const {
+  document_pool::instance().release(item);
+}
+
+// never destroyed, payloads owned by other singletons release documents late
+// in process exit
+document_pool &document_pool::instance() {
+  static document_pool *my_instance(new document_pool);
+  return *my_instance;
+}
+
+document_ptr document_pool::acquire(std::string_view frame) {
+  document *item(nullptr);
+  {
+    std::lock_guard guard(_lock);
+    if (!_free.empty()) {
+      item = _free.back();
+      _free.pop_back();
+    }
+  }
+  if (!item) {
+    return document_ptr(new document(frame));
+  }
+  // back to the pool if decode throws
+  document_ptr result(item);
+  result->assign(frame);
+  return result;
+}
+
+void document_pool::release(document *item) {
+  if (!item)
+    return;
+  // free any arena overflow from a large frame while pooled
+  item->assign({});
+  {
+    std::lock_guard guard(_lock);
+    if (_free.size() < MaxPooled) {
+      _free.push_back(item);
+      return;
+    }
+  }
+  delete item;
+}
+
+} // namespace dag_cbor
@@ -0,0 +1,124 @@
+/*************************************************************************
+Public Education Forum Moderation Firehose Client
+Copyright (c) Steve Townsend 2025
+
+>>> SOURCE LICENSE >>>
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation (www.fsf.org); either version 3 of the
+License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+A copy of the GNU General Public License is available at
+http://www.fsf.org/licensing/licenses
+>>> END OF LICENSE >>>
+*************************************************************************/
+
+#include "exact_set.hpp"
+#include "common/log_wrapper.hpp"
+#include <algorithm>
+#include <numeric>
+
+exact_set::key_id exact_set::add(std::string_view key) {
+  if (key.empty())
+    return NoKey;
+  auto const inserted(
+      _index.insert({std::string(key), static_cast<key_id>(_keys.size())}));
+  if (inserted.second)
+    _keys.emplace_back(key);
+  return inserted.first->second;
+}
+
+void exact_set::compile() {
+  _slots.clear();
+  _displacements.clear();
+  if (_keys.empty())
+    return;
+  for (size_t attempt = 0; attempt < MaxSeeds; ++attempt) {
+    if (place(mix(attempt + 1))) {
+      _index.clear();
+      return;
+    }
+  }
+  _slots.clear();
+  _displacements.clear();
+  REL_ERROR("exact_set: no perfect hash for {} keys, using index",
+            _keys.size());
+}
+
+// FNV-1a from a seeded basis, then mixed so every bit is used
+uint64_t exact_set::hash(std::string_view key, const uint64_t seed) {
+  uint64_t value(0xcbf29ce484222325ULL ^ seed);
+  for (const char next : key) {
+    value ^= static_cast<uint8_t>(next);
+    value *= 0x100000001b3ULL;
+  }
+  return mix(value);
+}
+
+bool exact_set::place(const uint64_t seed) {
+  const size_t bucket_count((_keys.size() + BucketSize - 1) / BucketSize);
+  // some spare slots keep the displacement search short
+  _slots.assign(_keys.size() + _keys.size() / 4 + 1, NoKey);
+  _displacements.assign(bucket_count, 0);
+  std::vector<std::vector<std::pair<uint64_t, key_id>>> buckets(bucket_count);
+  for (key_id id = 0; id < _keys.size(); ++id) {
+    const uint64_t key_hash(hash(_keys[id], seed));
+    buckets[key_hash % bucket_count].emplace_back(key_hash, id);
+  }
+  std::vector<size_t> order(bucket_count);
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(),
+                   [&](size_t const lhs, size_t const rhs) {
+                     return buckets[lhs].size() > buckets[rhs].size();
+                   });
+  std::vector<size_t> placed;
+  for (auto const bucket : order) {
+    auto const &members(buckets[bucket]);
+    if (members.empty())
+      break;
+    bool fits(false);
+    for (uint32_t displacement = 0; !fits && displacement < MaxDisplacement;
+         ++displacement) {
+      fits = true;
+      placed.clear();
+      for (auto const &member : members) {
+        const size_t slot(slot_for(member.first, displacement));
+        if (_slots[slot] != NoKey) {
+          fits = false;
+          break;
+        }
+        _slots[slot] = member.second;
+        placed.push_back(slot);
+      }
+      if (fits) {
+        _displacements[bucket] = displacement;
+      } else {
+        for (auto const slot : placed) {
+          _slots[slot] = NoKey;
+        }
+      }
+    }
+    if (!fits)
+      return false;
+  }
+  _seed = seed;
+  return true;
+}
+
+exact_set::key_id exact_set::find(std::string_view key) const {
+  if (_slots.empty()) {
+    if (_index.empty())
+      return NoKey;
+    auto const found(_index.find(std::string(key)));
+    return found != _index.cend() ? found->second : NoKey;
+  }
+  const uint64_t key_hash(hash(key, _seed));
+  const key_id id(_slots[slot_for(
+      key_hash, _displacements[key_hash % _displacements.size()])]);
+  return id != NoKey && _keys[id] == key ? id : NoKey;
+}
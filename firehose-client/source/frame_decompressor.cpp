@@ -0,0 +1,122 @@
+/*************************************************************************
+Public Education Forum Moderation Firehose Client
+Copyright (c) Steve Townsend 2025
+
+>>> SOURCE LICENSE >>>
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation (www.fsf.org); either version 3 of the
+License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+A copy of the GNU General Public License is available at
+http://www.fsf.org/licensing/licenses
+>>> END OF LICENSE >>>
+*************************************************************************/
+
+#include "frame_decompressor.hpp"
+#include "common/log_wrapper.hpp"
+#include <algorithm>
+#include <format>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+zstd_dictionary::zstd_dictionary(std::string const &filename) {
+  std::ifstream dictionary_file(filename, std::ios::binary);
+  if (!dictionary_file) {
+    throw std::runtime_error(
+        std::format("zstd dictionary {} cannot be opened", filename));
+  }
+  std::string content((std::istreambuf_iterator<char>(dictionary_file)),
+                      std::istreambuf_iterator<char>());
+  _dictionary = ZSTD_createDDict(content.data(), content.size());
+  if (!_dictionary) {
+    throw std::runtime_error(
+        std::format("zstd dictionary {} is invalid", filename));
+  }
+  REL_INFO("zstd dictionary {} loaded, {} bytes, id {}", filename,
+           content.size(), ZSTD_getDictID_fromDDict(_dictionary));
+}
+
+zstd_dictionary::~zstd_dictionary() { ZSTD_freeDDict(_dictionary); }
+
+frame_decompressor::frame_decompressor(
+    std::shared_ptr<const zstd_dictionary> dictionary,
+    const size_t max_frame_bytes)
+    : _dictionary(dictionary), _context(ZSTD_createDCtx()),
+      _max_frame_bytes(max_frame_bytes) {
+  if (!_context) {
+    throw std::runtime_error("zstd decompression context allocation failed");
+  }
+  const size_t result(ZSTD_DCtx_refDDict(_context, _dictionary->get()));
+  if (ZSTD_isError(result)) {
+    _dictionary_error = ZSTD_getErrorName(result);
+    REL_ERROR("zstd dictionary reference failed: {}", _dictionary_error);
+  }
+}
+
+frame_decompressor::~frame_decompressor() { ZSTD_freeDCtx(_context); }
+
+void frame_decompressor::decompress(std::string_view input,
+                                    std::string &output) {
+  if (_dictionary_error) {
+    throw std::runtime_error(
+        std::format("zstd dictionary {}", _dictionary_error));
+  }
+  // keep the dictionary, discard any state left by a failed frame
+  ZSTD_DCtx_reset(_context, ZSTD_reset_session_only);
+  unsigned long long content_size(
+      ZSTD_getFrameContentSize(input.data(), input.size()));
+  if (content_size == ZSTD_CONTENTSIZE_ERROR) {
+    throw std::runtime_error("zstd frame header is invalid");
+  }
+  // zstd checks the declared size, so a frame declaring more cannot fit
+  if (content_size != ZSTD_CONTENTSIZE_UNKNOWN &&
+      content_size > _max_frame_bytes) {
+    throw std::runtime_error(std::format(
+        "zstd frame declares {} bytes, limit {}", content_size,
+        _max_frame_bytes));
+  }
+  // One byte over the limit lets a frame of exactly the limit finish. An
+  // unknown size grows from a guess as the frame streams in.
+  const size_t limit(_max_frame_bytes + 1);
+  output.resize(content_size != ZSTD_CONTENTSIZE_UNKNOWN
+                    ? static_cast<size_t>(content_size)
+                    : std::min(std::max(input.size() * ExpansionGuess,
+                                        output.capacity()),
+                               limit));
+  ZSTD_inBuffer in{input.data(), input.size(), 0};
+  size_t produced(0);
+  while (true) {
+    ZSTD_outBuffer out{output.data(), output.size(), produced};
+    size_t result(ZSTD_decompressStream(_context, &out, &in));
+    if (ZSTD_isError(result)) {
+      throw std::runtime_error(
+          std::format("zstd decompression {}", ZSTD_getErrorName(result)));
+    }
+    produced = out.pos;
+    // frame complete and flushed
+    if (result == 0)
+      break;
+    if (out.pos == out.size) {
+      if (output.size() >= limit) {
+        throw std::runtime_error(
+            std::format("zstd frame exceeds {} bytes", _max_frame_bytes));
+      }
+      output.resize(std::min(std::max(output.size() * 2, ZSTD_DStreamOutSize()),
+                             limit));
+    } else if (in.pos == in.size) {
+      throw std::runtime_error("zstd frame is truncated");
+    }
+  }
+  if (produced > _max_frame_bytes) {
+    throw std::runtime_error(
+        std::format("zstd frame exceeds {} bytes", _max_frame_bytes));
+  }
+  output.resize(produced);
+}
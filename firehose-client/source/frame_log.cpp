@@ -0,0 +1,228 @@
+/*************************************************************************
+Public Education Forum Moderation Firehose Client
+Copyright (c) Steve Townsend 2025
+
+>>> SOURCE LICENSE >>>
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation (www.fsf.org); either version 3 of the
+License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+A copy of the GNU General Public License is available at
+http://www.fsf.org/licensing/licenses
+>>> END OF LICENSE >>>
+*************************************************************************/
+
+#include "frame_log.hpp"
+#include "common/log_wrapper.hpp"
+#include "common/metrics_factory.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <format>
+
+namespace frame_log {
+
+namespace {
+int64_t now_us() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+// segment file name is <first seq>-<capture start>
+int64_t first_seq_of(std::filesystem::path const &segment) {
+  std::string stem(segment.stem().string());
+  return std::stoll(stem.substr(0, stem.find('-')));
+}
+} // namespace
+
+writer::writer(YAML::Node const &settings)
+    : _directory(settings["directory"].as<std::string>()),
+      _segment_bytes(
+          settings["segment_mb"].as<size_t>(DefaultSegmentMegabytes) * 1024 *
+          1024),
+      _index_interval(
+          settings["index_interval"].as<size_t>(DefaultIndexInterval)) {
+  std::filesystem::create_directories(_directory);
+  REL_INFO("frame capture to {}, segment size {} bytes", _directory.string(),
+           _segment_bytes);
+}
+
+writer::~writer() { close_segment(); }
+
+void writer::append(const int64_t seq, std::string_view frame) {
+  // zero length marks end of data
+  if (frame.empty())
+    return;
+  int64_t record_seq(seq != 0 ? seq : _last_seq);
+  size_t record_bytes(sizeof(record_header) + frame.size());
+  if (_region && _offset + record_bytes > _region->get_size()) {
+    close_segment();
+  }
+  if (!_region) {
+    open_segment(record_seq, record_bytes);
+  }
+  if (_records % _index_interval == 0) {
+    index_entry entry{record_seq, _offset};
+    _index.write(reinterpret_cast<const char *>(&entry), sizeof(entry));
+    _index.flush();
+  }
+  char *base(static_cast<char *>(_region->get_address()));
+  record_header header{static_cast<uint32_t>(frame.size()), 0, record_seq,
+                       now_us()};
+  // header last, a torn record reads as end of data
+  std::memcpy(base + _offset + sizeof(header), frame.data(), frame.size());
+  std::memcpy(base + _offset, &header, sizeof(header));
+  _offset += record_bytes;
+  ++_records;
+  _last_seq = record_seq;
+  metrics_factory::instance()
+      .get_counter("frame_log")
+      .Get({{"frames", "captured"}})
+      .Increment();
+}
+
+void writer::open_segment(const int64_t first_seq, const size_t record_bytes) {
+  std::string stem(std::format("{:020}-{}", first_seq, now_us()));
+  _segment_path = _directory / (stem + std::string(SegmentSuffix));
+  {
+    std::ofstream create(_segment_path, std::ios::binary | std::ios::trunc);
+  }
+  // oversized frames get a segment to themselves
+  std::filesystem::resize_file(
+      _segment_path,
+      std::max(_segment_bytes, sizeof(segment_header) + record_bytes));
+  boost::interprocess::file_mapping mapping(_segment_path.string().c_str(),
+                                            boost::interprocess::read_write);
+  _region = std::make_unique<boost::interprocess::mapped_region>(
+      mapping, boost::interprocess::read_write);
+
+  segment_header header{{}, Version, _continuing ? SegmentContinues : 0};
+  std::memcpy(header._magic, Magic, sizeof(Magic));
+  std::memcpy(_region->get_address(), &header, sizeof(header));
+  _offset = sizeof(header);
+  _records = 0;
+  _continuing = true;
+  _index.open(_directory / (stem + std::string(IndexSuffix)),
+              std::ios::binary | std::ios::trunc);
+  REL_INFO("frame capture segment {} opened", _segment_path.string());
+}
+
+void writer::close_segment() {
+  if (!_region)
+    return;
+  _region->flush();
+  _region.reset();
+  _index.close();
+  // drop the unused tail
+  std::filesystem::resize_file(_segment_path, _offset);
+  REL_INFO("frame capture segment {} closed, {} frames, {} bytes",
+           _segment_path.string(), _records, _offset);
+}
+
+reader::reader(std::filesystem::path const &directory, const int64_t from_seq)
+    : _from_seq(from_seq) {
+  for (auto const &entry : std::filesystem::directory_iterator(directory)) {
+    if (entry.is_regular_file() &&
+        entry.path().extension() == SegmentSuffix) {
+      _segments.push_back(entry.path());
+    }
+  }
+  std::sort(_segments.begin(), _segments.end());
+  // skip segments that end before the requested start
+  if (_from_seq > 0) {
+    for (size_t segment = 0; segment < _segments.size(); ++segment) {
+      if (first_seq_of(_segments[segment]) <= _from_seq) {
+        _next_segment = segment;
+      }
+    }
+  }
+  REL_INFO("frame replay from {}, {} segments from seq {}", directory.string(),
+           _segments.size() - _next_segment, _from_seq);
+}
+
+bool reader::open_segment() {
+  while (_next_segment < _segments.size()) {
+    std::filesystem::path const &segment(_segments[_next_segment++]);
+    if (std::filesystem::file_size(segment) <= sizeof(segment_header)) {
+      continue;
+    }
+    boost::interprocess::file_mapping mapping(segment.string().c_str(),
+                                              boost::interprocess::read_only);
+    _region = std::make_unique<boost::interprocess::mapped_region>(
+        mapping, boost::interprocess::read_only);
+    segment_header header;
+    std::memcpy(&header, _region->get_address(), sizeof(header));
+    if (std::memcmp(header._magic, Magic, sizeof(Magic)) != 0 ||
+        header._version != Version) {
+      REL_WARNING("frame replay skips invalid segment {}", segment.string());
+      _region.reset();
+      continue;
+    }
+    _offset = sizeof(header);
+    // a frame without a seq can open a segment at the seq before it, only a
+    // restarted capture repeats seqs
+    _overlap_seq = _replayed && (header._flags & SegmentContinues) == 0 &&
+                           first_seq_of(segment) <= _last_seq
+                       ? _last_seq
+                       : -1;
+    // use the sparse index to skip ahead to the requested start
+    if (_from_seq > _last_seq) {
+      std::filesystem::path index_path(segment);
+      index_path.replace_extension(IndexSuffix);
+      std::ifstream index(index_path, std::ios::binary);
+      index_entry entry;
+      while (index.read(reinterpret_cast<char *>(&entry), sizeof(entry))) {
+        if (entry._seq > _from_seq)
+          break;
+        _offset = entry._offset;
+      }
+    }
+    REL_INFO("frame replay segment {} opened at offset {}", segment.string(),
+             _offset);
+    return true;
+  }
+  return false;
+}
+
+bool reader::next(record &next_record) {
+  while (true) {
+    if (!_region && !open_segment())
+      return false;
+    const char *base(static_cast<const char *>(_region->get_address()));
+    size_t size(_region->get_size());
+    record_header header;
+    if (_offset + sizeof(header) > size) {
+      _region.reset();
+      continue;
+    }
+    std::memcpy(&header, base + _offset, sizeof(header));
+    if (header._length == 0 ||
+        _offset + sizeof(header) + header._length > size) {
+      _region.reset();
+      continue;
+    }
+    std::string_view frame(base + _offset + sizeof(header), header._length);
+    _offset += sizeof(header) + header._length;
+    // overlapping captures after a rewind are replayed once
+    if (header._seq < _from_seq || header._seq < _last_seq ||
+        header._seq <= _overlap_seq)
+      continue;
+    _last_seq = header._seq;
+    _replayed = true;
+    next_record = {header._seq, header._captured_us, frame};
+    metrics_factory::instance()
+        .get_counter("frame_log")
+        .Get({{"frames", "replayed"}})
+        .Increment();
+    return true;
+  }
+}
+
+} // namespace frame_log
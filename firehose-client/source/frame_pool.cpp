@@ -0,0 +1,89 @@
+/*************************************************************************
+Public Education Forum Moderation Firehose Client
+Copyright (c) Steve Townsend 2025
+
+>>> SOURCE LICENSE >>>
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation (www.fsf.org); either version 3 of the
+License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+A copy of the GNU General Public License is available at
+http://www.fsf.org/licensing/licenses
+>>> END OF LICENSE >>>
+*************************************************************************/
+
+#include "frame_pool.hpp"
+#include "common/metrics_factory.hpp"
+#include <bit>
+
+void frame_pool::releaser::operator()(std::string *buffer) const {
+  frame_pool::instance().release(buffer);
+}
+
+// never destroyed, payloads owned by other singletons release buffers late
+// in process exit
+frame_pool &frame_pool::instance() {
+  static frame_pool *my_instance(new frame_pool);
+  return *my_instance;
+}
+
+size_t frame_pool::class_for_size(const size_t bytes) {
+  if (bytes <= class_bytes(0))
+    return 0;
+  return std::bit_width(bytes - 1) - MinClassShift;
+}
+
+size_t frame_pool::class_for_capacity(const size_t capacity) {
+  return std::bit_width(capacity) - 1 - MinClassShift;
+}
+
+frame_ptr frame_pool::acquire(const size_t size_hint) {
+  for (size_t size_class = class_for_size(size_hint); size_class < ClassCount;
+       ++size_class) {
+    free_list &free(_free[size_class]);
+    std::lock_guard guard(free._lock);
+    if (!free._buffers.empty()) {
+      std::string *buffer(free._buffers.back());
+      free._buffers.pop_back();
+      metrics_factory::instance()
+          .get_counter("frame_pool")
+          .Get({{"buffers", "reused"}})
+          .Increment();
+      return frame_ptr(buffer);
+    }
+  }
+  metrics_factory::instance()
+      .get_counter("frame_pool")
+      .Get({{"buffers", "allocated"}})
+      .Increment();
+  std::string *buffer(new std::string);
+  buffer->reserve(
+      class_bytes(std::min(class_for_size(size_hint), ClassCount - 1)));
+  return frame_ptr(buffer);
+}
+
+void frame_pool::release(std::string *buffer) {
+  if (!buffer)
+    return;
+  buffer->clear();
+  if (buffer->capacity() >= class_bytes(0) &&
+      buffer->capacity() < class_bytes(ClassCount)) {
+    free_list &free(_free[class_for_capacity(buffer->capacity())]);
+    std::lock_guard guard(free._lock);
+    if (free._buffers.size() < MaxPooledPerClass) {
+      free._buffers.push_back(buffer);
+      return;
+    }
+  }
+  metrics_factory::instance()
+      .get_counter("frame_pool")
+      .Get({{"buffers", "discarded"}})
+      .Increment();
+  delete buffer;
+}
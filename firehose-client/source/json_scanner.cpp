@@ -0,0 +1,493 @@
+/*************************************************************************
+Public Education Forum Moderation Firehose Client
+Copyright (c) Steve Townsend 2025
+
+>>> SOURCE LICENSE >>>
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation (www.fsf.org); either version 3 of the
+License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+A copy of the GNU General Public License is available at
+http://www.fsf.org/licensing/licenses
+>>> END OF LICENSE >>>
+*************************************************************************/
+
+#include "json_scanner.hpp"
+#include "common/rest_utils.hpp"
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <map>
+
+namespace json_scanner {
+
+namespace {
+
+enum class lookup { found, absent, fallback };
+
+// character classes, a table lookup is much cheaper than find_first_of
+enum char_class : uint8_t {
+  other = 0,
+  whitespace = 1,
+  quote = 2,
+  backslash = 4,
+  open = 8,
+  close = 16,
+  separator = 32
+};
+
+constexpr std::array<uint8_t, 256> CharClasses = [] {
+  std::array<uint8_t, 256> classes = {};
+  for (char next : {' ', '\t', '\r', '\n'}) {
+    classes[static_cast<uint8_t>(next)] = whitespace;
+  }
+  classes['"'] = quote;
+  classes['\\'] = backslash;
+  classes['{'] = classes['['] = open;
+  classes['}'] = classes[']'] = close;
+  classes[','] = separator;
+  return classes;
+}();
+
+inline uint8_t class_of(char next) {
+  return CharClasses[static_cast<uint8_t>(next)];
+}
+
+// first position at or after pos with a class in the mask
+inline size_t find_class(std::string_view text, size_t pos, uint8_t mask) {
+  while (pos < text.size() && !(class_of(text[pos]) & mask)) {
+    ++pos;
+  }
+  return pos;
+}
+
+inline size_t skip_whitespace(std::string_view text, size_t pos) {
+  while (pos < text.size() && class_of(text[pos]) == whitespace) {
+    ++pos;
+  }
+  return pos;
+}
+
+// pos is at the opening quote, leaves pos after the closing quote
+bool skip_string(std::string_view text, size_t &pos) {
+  ++pos;
+  while (true) {
+    pos = find_class(text, pos, quote | backslash);
+    if (pos >= text.size())
+      return false;
+    if (text[pos] == '"') {
+      ++pos;
+      return true;
+    }
+    // escaped character
+    pos += 2;
+  }
+}
+
+// pos is at the start of a value, leaves pos after it
+bool skip_value(std::string_view text, size_t &pos) {
+  if (pos >= text.size())
+    return false;
+  uint8_t first(class_of(text[pos]));
+  if (first == quote)
+    return skip_string(text, pos);
+  if (first == open) {
+    size_t depth(0);
+    while (true) {
+      pos = find_class(text, pos, quote | open | close);
+      if (pos >= text.size())
+        return false;
+      switch (class_of(text[pos])) {
+      case quote:
+        if (!skip_string(text, pos))
+          return false;
+        continue;
+      case open:
+        ++depth;
+        break;
+      default:
+        if (--depth == 0) {
+          ++pos;
+          return true;
+        }
+        break;
+      }
+      ++pos;
+    }
+  }
+  // number or literal
+  pos = find_class(text, pos, whitespace | close | separator);
+  return true;
+}
+
+// Calls on_member(key, value) for each member of the object, in order. False
+// if the object is malformed or has an escaped key.
+template <typename CALLBACK>
+bool for_each_member(std::string_view object, CALLBACK &&on_member) {
+  if (object.empty() || object.front() != '{')
+    return false;
+  size_t pos(skip_whitespace(object, 1));
+  if (pos < object.size() && object[pos] == '}')
+    return true;
+  while (pos < object.size()) {
+    if (object[pos] != '"')
+      return false;
+    size_t key_start(pos + 1);
+    if (!skip_string(object, pos))
+      return false;
+    std::string_view key(object.substr(key_start, pos - key_start - 1));
+    if (key.find('\\') != std::string_view::npos)
+      return false;
+    pos = skip_whitespace(object, pos);
+    if (pos >= object.size() || object[pos] != ':')
+      return false;
+    pos = skip_whitespace(object, pos + 1);
+    size_t value_start(pos);
+    if (!skip_value(object, pos))
+      return false;
+    on_member(key, object.substr(value_start, pos - value_start));
+    pos = skip_whitespace(object, pos);
+    if (pos >= object.size())
+      return false;
+    if (object[pos] == '}')
+      return true;
+    if (object[pos] != ',')
+      return false;
+    pos = skip_whitespace(object, pos + 1);
+  }
+  return false;
+}
+
+// Value of a member of the object, the last one if the key is repeated as
+// for the DOM
+lookup member(std::string_view object, std::string_view key,
+              std::string_view &value) {
+  bool found(false);
+  if (!for_each_member(object, [&](std::string_view this_key,
+                                   std::string_view this_value) {
+        if (this_key == key) {
+          value = this_value;
+          found = true;
+        }
+      }))
+    return lookup::fallback;
+  return found ? lookup::found : lookup::absent;
+}
+
+lookup element(std::string_view array, size_t index, std::string_view &value) {
+  size_t pos(skip_whitespace(array, 1));
+  if (pos < array.size() && array[pos] == ']')
+    return lookup::absent;
+  for (size_t count = 0; pos < array.size(); ++count) {
+    size_t value_start(pos);
+    if (!skip_value(array, pos))
+      return lookup::fallback;
+    if (count == index) {
+      value = array.substr(value_start, pos - value_start);
+      return lookup::found;
+    }
+    pos = skip_whitespace(array, pos);
+    if (pos >= array.size())
+      return lookup::fallback;
+    if (array[pos] == ']')
+      return lookup::absent;
+    if (array[pos] != ',')
+      return lookup::fallback;
+    pos = skip_whitespace(array, pos + 1);
+  }
+  return lookup::fallback;
+}
+
+void append_utf8(std::string &out, uint32_t code_point) {
+  if (code_point < 0x80) {
+    out.push_back(static_cast<char>(code_point));
+  } else if (code_point < 0x800) {
+    out.push_back(static_cast<char>(0xC0 | (code_point >> 6)));
+    out.push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+  } else if (code_point < 0x10000) {
+    out.push_back(static_cast<char>(0xE0 | (code_point >> 12)));
+    out.push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3F)));
+    out.push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+  } else {
+    out.push_back(static_cast<char>(0xF0 | (code_point >> 18)));
+    out.push_back(static_cast<char>(0x80 | ((code_point >> 12) & 0x3F)));
+    out.push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3F)));
+    out.push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+  }
+}
+
+bool read_hex4(std::string_view text, size_t pos, uint32_t &value) {
+  if (pos + 4 > text.size())
+    return false;
+  auto result(std::from_chars(text.data() + pos, text.data() + pos + 4, value,
+                              16));
+  return result.ec == std::errc() && result.ptr == text.data() + pos + 4;
+}
+
+} // namespace
+
+bool string_value(std::string_view value, std::string &out) {
+  if (value.size() < 2 || value.front() != '"' || value.back() != '"')
+    return false;
+  value = value.substr(1, value.size() - 2);
+  out.clear();
+  out.reserve(value.size());
+  size_t pos(0);
+  while (pos < value.size()) {
+    size_t escape(value.find('\\', pos));
+    std::string_view plain(value.substr(pos, escape - pos));
+    for (char next : plain) {
+      // DOM parser rejects raw control characters
+      if (static_cast<unsigned char>(next) < 0x20)
+        return false;
+    }
+    out.append(plain);
+    if (escape == std::string_view::npos)
+      break;
+    if (escape + 1 >= value.size())
+      return false;
+    pos = escape + 2;
+    switch (value[escape + 1]) {
+    case '"':
+      out.push_back('"');
+      break;
+    case '\\':
+      out.push_back('\\');
+      break;
+    case '/':
+      out.push_back('/');
+      break;
+    case 'b':
+      out.push_back('\b');
+      break;
+    case 'f':
+      out.push_back('\f');
+      break;
+    case 'n':
+      out.push_back('\n');
+      break;
+    case 'r':
+      out.push_back('\r');
+      break;
+    case 't':
+      out.push_back('\t');
+      break;
+    case 'u': {
+      uint32_t code_point(0);
+      if (!read_hex4(value, pos, code_point))
+        return false;
+      pos += 4;
+      if (code_point >= 0xD800 && code_point <= 0xDBFF) {
+        // high surrogate must be followed by an escaped low surrogate
+        uint32_t low(0);
+        if (value.substr(pos, 2) != "\\u" || !read_hex4(value, pos + 2, low) ||
+            low < 0xDC00 || low > 0xDFFF)
+          return false;
+        pos += 6;
+        code_point = 0x10000 + ((code_point - 0xD800) << 10) + (low - 0xDC00);
+      } else if (code_point >= 0xDC00 && code_point <= 0xDFFF) {
+        return false;
+      }
+      append_utf8(out, code_point);
+      break;
+    }
+    default:
+      return false;
+    }
+  }
+  return true;
+}
+
+namespace {
+
+// Follow the rest of a JSON pointer token by token, as json::contains and
+// operator[] would
+lookup resolve(std::string_view value, std::vector<std::string> const &tokens,
+               size_t first, std::string_view &result) {
+  for (auto token = tokens.cbegin() + first; token != tokens.cend(); ++token) {
+    if (value.empty())
+      return lookup::fallback;
+    std::string_view next;
+    lookup found(lookup::absent);
+    if (value.front() == '{') {
+      found = member(value, *token, next);
+    } else if (value.front() == '[') {
+      // array index is digits without a leading zero
+      size_t index(0);
+      auto parsed(std::from_chars(token->data(),
+                                  token->data() + token->size(), index));
+      if (token->empty() || (token->size() > 1 && token->front() == '0') ||
+          parsed.ec != std::errc() ||
+          parsed.ptr != token->data() + token->size())
+        return lookup::absent;
+      found = element(value, index, next);
+    }
+    if (found != lookup::found)
+      return found;
+    value = next;
+  }
+  result = value;
+  return lookup::found;
+}
+
+struct target_field {
+  std::string _name;
+  std::vector<std::string> _tokens;
+};
+
+// TargetFieldNames pointers split into unescaped reference tokens, once
+std::map<std::string_view, std::vector<target_field>> const &target_fields() {
+  static const std::map<std::string_view, std::vector<target_field>> fields(
+      [] {
+        std::map<std::string_view, std::vector<target_field>> result;
+        for (auto const &record_type : json::TargetFieldNames) {
+          auto &this_type(result[record_type.first]);
+          for (auto const &pointer : record_type.second) {
+            target_field field{pointer.to_string(), {}};
+            size_t start(1);
+            while (start <= field._name.size()) {
+              size_t end(field._name.find('/', start));
+              if (end == std::string::npos)
+                end = field._name.size();
+              std::string token(field._name.substr(start, end - start));
+              // ~1 is '/', ~0 is '~', in that order per RFC 6901
+              for (size_t tilde = token.find("~1");
+                   tilde != std::string::npos; tilde = token.find("~1")) {
+                token.replace(tilde, 2, "/");
+              }
+              for (size_t tilde = token.find("~0");
+                   tilde != std::string::npos; tilde = token.find("~0")) {
+                token.replace(tilde, 2, "~");
+              }
+              field._tokens.push_back(std::move(token));
+              start = end + 1;
+            }
+            this_type.push_back(std::move(field));
+          }
+        }
+        return result;
+      }());
+  return fields;
+}
+
+std::optional<candidate_list> record_candidates(std::string_view record) {
+  // one pass over the top level, target fields are resolved from there
+  std::vector<std::pair<std::string_view, std::string_view>> members;
+  members.reserve(16);
+  if (!for_each_member(record, [&](std::string_view key,
+                                   std::string_view value) {
+        members.emplace_back(key, value);
+      }))
+    return {};
+  // repeated keys, the DOM keeps the last
+  auto find = [&members](std::string_view key) {
+    auto found(std::find_if(members.crbegin(), members.crend(),
+                            [key](auto const &next) {
+                              return next.first == key;
+                            }));
+    return found == members.crend() ? std::string_view() : found->second;
+  };
+
+  std::string record_type;
+  if (!string_value(find("$type"), record_type))
+    return {};
+  candidate_list results;
+  auto const record_fields(target_fields().find(record_type));
+  if (record_fields == target_fields().cend())
+    return results;
+  std::string text;
+  for (auto const &field : record_fields->second) {
+    std::string_view value(find(field._tokens.front()));
+    if (value.empty())
+      continue;
+    switch (resolve(value, field._tokens, 1, value)) {
+    case lookup::fallback:
+      return {};
+    case lookup::absent:
+      continue;
+    case lookup::found:
+      if (!string_value(value, text))
+        return {};
+      // serialized as the DOM path does
+      results.emplace_back(record_type, field._name,
+                           nlohmann::to_string(nlohmann::json(text)));
+      break;
+    }
+  }
+  return results;
+}
+
+} // namespace
+
+std::optional<candidate_list> candidates(std::string_view message) {
+  try {
+    message = message.substr(skip_whitespace(message, 0));
+    std::string_view kind_value;
+    std::string_view identity;
+    std::string_view commit;
+    if (!for_each_member(message, [&](std::string_view key,
+                                      std::string_view value) {
+          if (key == "kind") {
+            kind_value = value;
+          } else if (key == "commit") {
+            commit = value;
+          } else if (key == "identity") {
+            identity = value;
+          }
+        }))
+      return {};
+    if (kind_value.empty())
+      return candidate_list();
+    std::string kind;
+    if (!string_value(kind_value, kind))
+      return {};
+
+    // handle updates
+    if (kind == "identity") {
+      if (identity.empty())
+        return candidate_list();
+      std::string_view handle_value;
+      lookup found(member(identity, "handle", handle_value));
+      if (found == lookup::absent)
+        return candidate_list();
+      std::string handle;
+      if (found == lookup::fallback || !string_value(handle_value, handle))
+        return {};
+      return candidate_list({{"identity", "handle", handle}});
+    }
+
+    // other than handles, only interested in commits
+    if (kind != "commit")
+      return candidate_list();
+
+    std::string_view operation_value;
+    std::string_view record;
+    if (!for_each_member(commit, [&](std::string_view key,
+                                     std::string_view value) {
+          if (key == "operation") {
+            operation_value = value;
+          } else if (key == "record") {
+            record = value;
+          }
+        }))
+      return {};
+    // Skip deletions
+    std::string operation;
+    if (!operation_value.empty() && !string_value(operation_value, operation))
+      return {};
+    if (operation == "delete")
+      return candidate_list();
+    return record_candidates(record);
+  } catch (std::exception const &) {
+    // e.g. invalid UTF-8, let the DOM path report it
+  }
+  return {};
+}
+
+} // namespace json_scanner
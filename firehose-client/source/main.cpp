@@ -125,14 +125,15 @@ int main(int argc, char **argv) {
       REL_INFO("No graph DB configured, returned error {}", exc.what());
     }
 
+    // decode and post-processing backlogs, in either mode
+    metrics_factory::instance().add_gauge(
+        "process_operation", "Statistics about process internals");
     if (is_full(*settings)) {
       metrics_factory::instance().add_counter(
           "automation",
           "Automated moderation activity: block-list, report, emit-event");
       metrics_factory::instance().add_counter(
           "realtime_alerts", "Alerts generated for possibly suspect activity");
-      metrics_factory::instance().add_gauge(
-          "process_operation", "Statistics about process internals");
 
       // seed database monitors before we start post-processing firehose
       // messages
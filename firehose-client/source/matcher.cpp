@@ -19,22 +19,62 @@ http://www.fsf.org/licensing/licenses
 *************************************************************************/
 
 #include "matcher.hpp"
+#include "case_folding.hpp"
 #include "common/helpers.hpp"
 #include "common/log_wrapper.hpp"
 #include "common/metrics_factory.hpp"
 #include "common/moderation/report_agent.hpp"
 #include "moderation/list_manager.hpp"
 #include "parser.hpp"
+#include <algorithm>
 #include <exception>
 #include <fstream>
-#include <ranges>
-#include <string_view>
+#include <unicode/uversion.h>
+#include <utility>
+
+namespace {
+// rules are built once and moved into a rule_set, this builds another
+matcher::rule copy_of(matcher::rule const &source) {
+  std::string labels;
+  for (auto const &label : source._labels) {
+    if (!labels.empty())
+      labels.push_back(',');
+    labels.append(label);
+  }
+  return matcher::rule(source._target, labels, source._raw_actions,
+                       source._contingent);
+}
 
-matcher::matcher() { _whole_word_trie.only_whole_words(); }
+// shared by all matchers, so no two publishes have the same generation
+std::atomic<uint64_t> last_generation(0);
+
+inline uint64_t next_generation() {
+  return last_generation.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+} // namespace
+
+matcher::matcher()
+    : _rules(std::make_shared<rule_set>()), _generation(next_generation()) {}
 
 // load from file, or wait for DB to load
 void matcher::set_config(const YAML::Node &filter_config) {
   _use_db_for_rules = filter_config["use_db"].as<bool>();
+  _scan_cache.set_capacity(
+      filter_config["scan_cache_size"].as<size_t>(DefaultScanCacheSize));
+  if (_scan_cache.is_enabled()) {
+    metrics_factory::instance().add_counter(
+        "matcher_cache", "Lookups of candidate text in the scan result cache");
+    auto &lookups(metrics_factory::instance().get_counter("matcher_cache"));
+    _cache_hits = &lookups.Get({{"lookup", "hit"}});
+    _cache_misses = &lookups.Get({{"lookup", "miss"}});
+  }
+  metrics_factory::instance().add_counter(
+      "matcher_regex_fallback",
+      "Scans of candidate text by regex rules one pattern at a time");
+  regex_set::set_fallback_counter(&metrics_factory::instance()
+                                       .get_counter("matcher_regex_fallback")
+                                       .Get({}));
+  _compiled_rules = filter_config["compiled_rules"].as<std::string>("");
   if (!_use_db_for_rules) {
     load_filter_file(filter_config["filename"].as<std::string>());
   }
@@ -46,6 +86,7 @@ void matcher::load_filter_file(std::string const &filename) {
   if (!file.is_open())
     throw std::invalid_argument("Cannot open " + filename);
 
+  std::vector<rule> rules;
   std::string str;
   size_t line(0);
   while (std::getline(file, str)) {
@@ -61,58 +102,142 @@ void matcher::load_filter_file(std::string const &filename) {
       continue;
     }
 
-    if (!add_rule(str)) {
-      REL_WARNING("Skipped rule at line {}: '{}'", line, str);
-    } else {
-      REL_INFO("Stored rule at line {}: '{}'", line, str);
+    rules.emplace_back(str);
+  }
+  publish(build(std::move(rules)));
+}
+
+bool matcher::refresh_rules(std::vector<rule> &&replacement) {
+  const size_t fingerprint(rule_set::fingerprint(replacement));
+  if (_is_ready && fingerprint == _fingerprint) {
+    REL_INFO("Rules unchanged, {} rules", replacement.size());
+    return false;
+  }
+  _fingerprint = fingerprint;
+  auto overlay(rule_set::overlay_for(_rules.load(std::memory_order_acquire),
+                                     replacement));
+  if (overlay) {
+    publish(std::move(overlay));
+  } else {
+    publish(build(std::move(replacement)));
+  }
+  return true;
+}
+
+std::unique_ptr<rule_set> matcher::build(std::vector<rule> &&rules) const {
+  auto built(std::make_unique<rule_set>());
+  bool loaded(false);
+  uint64_t key(0);
+  if (!_compiled_rules.empty()) {
+    // the same rules in the same order, folded by the same ICU, compile to
+    // the same automaton
+    std::string all_sources(U_ICU_VERSION);
+    for (auto const &next : rules) {
+      all_sources.append(1, '\n').append(next.to_string());
+    }
+    key = static_cast<uint64_t>(std::hash<std::string>()(all_sources));
+    loaded = built->load_compiled(_compiled_rules, key);
+  }
+  for (auto &next : rules) {
+    built->insert(std::move(next));
+  }
+  if (loaded && !built->matches_compiled()) {
+    REL_WARNING("Compiled rules {} do not fit the rules, rebuilding",
+                _compiled_rules.string());
+    std::vector<rule> inserted(built->release_rules());
+    built = std::make_unique<rule_set>();
+    for (auto &next : inserted) {
+      built->insert(std::move(next));
     }
+    loaded = false;
+  }
+  built->compile();
+  if (!_compiled_rules.empty() && !loaded) {
+    built->save_compiled(_compiled_rules, key);
   }
+  return built;
 }
 
-void matcher::refresh_rules(matcher &&replacement) {
-  std::lock_guard log(_lock);
-  _rule_lookup.swap(replacement._rule_lookup);
-  _substring_trie = std::move(replacement._substring_trie);
-  _whole_word_trie = std::move(replacement._whole_word_trie);
+// scans in progress finish on the snapshot they started with
+void matcher::publish(std::unique_ptr<rule_set> &&pending) {
+  // block lists say why accounts were added, for the rules new to this set
+  const size_t first_added(pending->base() ? pending->base()->size() : 0);
+  for (size_t id = first_added; id < pending->size(); ++id) {
+    rule const &added(pending->at(static_cast<rule_id>(id)));
+    if (!added._block_list_name.empty()) {
+      list_manager::instance().register_block_reason(added._block_list_name,
+                                                     added._target);
+    }
+  }
+  const uint64_t generation(next_generation());
+  pending->set_version(generation);
+  _rules.store(std::shared_ptr<const rule_set>(std::move(pending)),
+               std::memory_order_release);
+  _generation.store(generation, std::memory_order_release);
   _is_ready = true;
 }
 
+// Each thread caches its own reference to the current rules and reloads it
+// only after a publish, so steady-state scans share no writable cache line.
+// Generations are unique across matchers, so a copy cached from a matcher
+// since destroyed is never taken for one at the same address.
+// An idle thread keeps a replaced rule set alive until its next scan.
+std::shared_ptr<const rule_set> const &matcher::rules() const {
+  if (_added_changed.load(std::memory_order_acquire)) {
+    // add_rule is for tests and tools, which never scan a const matcher
+    const_cast<matcher *>(this)->publish_added();
+  }
+  struct snapshot {
+    uint64_t _generation = 0;
+    std::shared_ptr<const rule_set> _rules;
+  };
+  thread_local snapshot cached;
+  const uint64_t generation(_generation.load(std::memory_order_acquire));
+  if (cached._generation != generation) {
+    cached._generation = generation;
+    cached._rules = _rules.load(std::memory_order_acquire);
+  }
+  return cached._rules;
+}
+
+// For tests and tools. Rules are checked and kept here, then built and
+// published together by the next scan, so adding N rules builds them once.
 bool matcher::add_rule(std::string const &match_rule) {
-  return insert_rule(rule(match_rule));
+  return add_rule(rule(match_rule));
 }
 
 bool matcher::add_rule(std::string const &filter, std::string const &labels,
                        std::string const &actions,
                        std::string const &contingent) {
-  return insert_rule(rule(filter, labels, actions, contingent));
+  return add_rule(rule(filter, labels, actions, contingent));
 }
 
-// thread-safe by design
-bool matcher::insert_rule(rule &&new_rule) {
+bool matcher::add_rule(rule &&added) {
   // Check for intentionally-skipped rule
-  if (!new_rule._track) {
-    REL_WARNING("Skipped rule '{}'", new_rule.to_string());
+  if (!added._track) {
+    REL_WARNING("Skipped rule '{}'", added.to_string());
     return false;
   }
-  // TODO handle this for refresh case
-  if (!new_rule._block_list_name.empty()) {
-    list_manager::instance().register_block_reason(new_rule._block_list_name,
-                                                   new_rule._target);
-  }
-  std::wstring canonical_form(to_canonical(new_rule._target));
-  // use ICU canonical form for multilanguage support
-  if (new_rule._match_type == rule::match_type::substring)
-    _substring_trie.insert(canonical_form);
-  else if (new_rule._match_type == rule::match_type::whole_word)
-    _whole_word_trie.insert(canonical_form);
-  if (_rule_lookup.insert({canonical_form, new_rule}).second) {
-    REL_INFO("Stored rule '{}'", new_rule.to_string());
-  } else {
-    REL_WARNING("Duplicate rule '{}'", new_rule.to_string());
-  }
+  std::lock_guard guard(_added_lock);
+  _added.push_back(std::move(added));
+  _added_changed.store(true, std::memory_order_release);
   return true;
 }
 
+// the added rules are kept for the next refresh, which gets copies
+void matcher::publish_added() {
+  std::lock_guard guard(_added_lock);
+  if (!_added_changed.load(std::memory_order_relaxed))
+    return;
+  std::vector<rule> copies;
+  copies.reserve(_added.size());
+  for (auto const &next : _added) {
+    copies.push_back(copy_of(next));
+  }
+  refresh_rules(std::move(copies));
+  _added_changed.store(false, std::memory_order_release);
+}
+
 bool matcher::matches_any(std::string const &candidate) const {
   auto candidates(parser().get_candidates_from_string(candidate));
   return check_candidates(candidates);
@@ -124,13 +249,14 @@ bool matcher::matches_any(beast::flat_buffer const &beast_data) const {
 }
 
 bool matcher::check_candidates(candidate_list const &candidates) const {
-  std::lock_guard lock(_lock);
+  auto const &current(rules());
+  thread_local std::string canonical;
   for (auto &next : candidates) {
     if (next._value.empty())
       continue;
-    // use ICU canonical form for multilanguage support
-    auto result = _substring_trie.parse_text(to_canonical(next._value));
-    if (!result.empty())
+    // case-folded for multilanguage support
+    case_folding::fold(next._value, canonical);
+    if (current->matches_any_substring(canonical, rule_set::scope_of(next)))
       return true;
   }
   return false;
@@ -142,45 +268,63 @@ matcher::find_all_matches(beast::flat_buffer const &beast_data) const {
   return all_matches_for_candidates(candidates);
 }
 
+match_results matcher::find_all_matches(std::string const &frame) const {
+  auto candidates(parser().get_candidates_from_frame(frame));
+  return all_matches_for_candidates(candidates);
+}
+
 match_results
 matcher::all_matches_for_candidates(candidate_list const &candidates) const {
-  std::lock_guard lock(_lock);
   match_results results;
+  append_matches(rules(), candidates, results);
+  return results;
+}
+
+std::vector<match_results>
+matcher::all_matches_for_batch(std::vector<candidate_list> const &batch) const {
+  auto const &current(rules());
+  std::vector<match_results> results(batch.size());
+  for (size_t message = 0; message < batch.size(); ++message) {
+    append_matches(current, batch[message], results[message]);
+  }
+  return results;
+}
+
+void matcher::append_matches(std::shared_ptr<const rule_set> const &current,
+                             candidate_list const &candidates,
+                             match_results &results) const {
+  std::vector<rule_id> hits;
+  thread_local std::string canonical;
+  const bool use_cache(_scan_cache.is_enabled() && current->version() != 0);
   for (auto &next : candidates) {
     if (next._value.empty())
       continue;
-    // use ICU canonical form for multilanguage support
-    std::wstring canonical_form(to_canonical(next._value));
-    aho_corasick::basic_trie<wchar_t>::emit_collection all_matches(
-        _substring_trie.parse_text(canonical_form));
-    aho_corasick::basic_trie<wchar_t>::emit_collection whole_words(
-        _whole_word_trie.parse_text(canonical_form));
-    if (!whole_words.empty())
-      all_matches.insert(all_matches.end(), whole_words.cbegin(),
-                         whole_words.cend());
-    if (!all_matches.empty()) {
-      results.emplace_back(next, all_matches);
-    }
-  }
-
-  // strip out matches which do not pass contingent string matching in rule
-  for (auto next_match = results.begin(); next_match != results.end();) {
-    for (auto rule_key = next_match->_matches.begin();
-         rule_key != next_match->_matches.end();) {
-      matcher::rule this_rule = find_rule_unchecked(rule_key->get_keyword());
-      if (!this_rule.passes_contingent_checks(next_match->_candidate._value)) {
-        rule_key = next_match->_matches.erase(rule_key);
+    // case-folded for multilanguage support
+    case_folding::fold(next._value, canonical);
+    const rule_set::content_scope scope(rule_set::scope_of(next));
+    if (use_cache) {
+      // the same text in another scope or field can match other rules
+      const uint64_t text_hash(
+          scan_cache::hash(canonical) ^
+          (static_cast<uint64_t>(scope) * 0x9e3779b97f4a7c15ULL) ^
+          (scan_cache::hash(next._field) * 0xc2b2ae3d27d4eb4fULL));
+      if (_scan_cache.find(canonical, next._field, text_hash,
+                           current->version(), hits)) {
+        _cache_hits->Increment();
       } else {
-        ++rule_key;
+        current->scan(canonical, scope, next._field, hits);
+        _scan_cache.store(canonical, next._field, text_hash,
+                          current->version(), hits);
+        _cache_misses->Increment();
       }
-    }
-    if (next_match->_matches.empty()) {
-      next_match = results.erase(next_match);
     } else {
-      ++next_match;
+      current->scan(canonical, scope, next._field, hits);
+    }
+    if (!hits.empty()) {
+      results.emplace_back(next, std::move(hits), current);
+      hits.clear();
     }
   }
-  return results;
 }
 
 path_match_results matcher::all_matches_for_path_candidates(
@@ -209,7 +353,7 @@ void matcher::report_if_needed(account_filter_matches &matches) {
     std::vector<std::string> filters;
     for (auto const &next_match : result.second) {
       for (auto const &match : next_match._matches) {
-        matcher::rule matched_rule(find_rule(match.get_keyword()));
+        matcher::rule const &matched_rule(next_match._rules->at(match));
         if (!matched_rule._report && !matched_rule._label) {
           // auto-moderation not requested for this rule
           continue;
@@ -224,14 +368,14 @@ void matcher::report_if_needed(account_filter_matches &matches) {
           list_manager::instance().wait_enqueue(
               {matches._did, matched_rule._block_list_name});
         }
-        if (matched_rule._content_scope == matcher::rule::content_scope::any) {
-          filters.push_back(matched_rule._target);
-        } else if (matched_rule._content_scope ==
-                   matcher::rule::content_scope::profile) {
+        if (matched_rule._content_scope ==
+            matcher::rule::content_scope::profile) {
           // report only if seen in profile
           if (next_match._candidate._type == bsky::AppBskyActorProfile) {
             filters.push_back(matched_rule._block_list_name);
           }
+        } else {
+          filters.push_back(matched_rule._target);
         }
       }
       if (!filters.empty()) {
@@ -254,179 +398,3 @@ void matcher::report_if_needed(account_filter_matches &matches) {
             bsky::moderation::filter_matches(all_filters, paths, labels)));
   }
 }
-
-matcher::rule::rule(std::string const &rule_string) {
-  size_t count = 0;
-  if (rule_string.empty() || rule_string[0] == '|')
-    throw std::invalid_argument("Malformed rule, missing filter string " +
-                                rule_string);
-  for (const auto token : std::views::split(rule_string, '|')) {
-    // with string_view's C++23 range constructor:
-    std::string_view field(token);
-    switch (count) {
-    case 0:
-      if (field.empty())
-        throw std::invalid_argument("Blank target in filter rule " +
-                                    rule_string);
-      _target = field;
-      break;
-    case 1:
-      if (field.empty())
-        throw std::invalid_argument("Blank labels in filter rule " +
-                                    rule_string);
-      for (const auto subtoken : std::views::split(std::string(field), ',')) {
-        _labels.push_back(std::string(subtoken.cbegin(), subtoken.cend()));
-      }
-      break;
-    case 2:
-      store_actions(field);
-      break;
-    case 3:
-      if (field.empty())
-        continue;
-      _contingent = field;
-      // make a trie of 'contingent strings' to confirm rule_string context
-      for (const auto subtoken : std::views::split(_contingent, ',')) {
-        std::string next(subtoken.cbegin(), subtoken.cend());
-        if (starts_with(next, "!")) {
-          next = next.substr(1);
-          _absent_substring_trie.insert(
-              to_canonical(std::string_view(subtoken)));
-        } else {
-          _substring_trie.insert(to_canonical(std::string_view(subtoken)));
-        }
-      }
-      break;
-    default:
-      throw std::invalid_argument("More than " + std::to_string(field_count) +
-                                  " fields in filter rule " + rule_string);
-      break;
-    }
-    ++count;
-  }
-  // final field, contingent strings to match, is currently optional
-  if (count < field_count - 1)
-    throw std::invalid_argument("Less than " + std::to_string(field_count) +
-                                " fields in filter rule " + rule_string);
-}
-
-matcher::rule::rule(std::string const &filter, std::string const &labels,
-                    std::string const &actions, std::string const &contingent) {
-  if (filter.empty())
-    throw std::invalid_argument("Blank filter");
-  _target = filter;
-  if (labels.empty())
-    throw std::invalid_argument("Blank labels");
-  for (const auto subtoken : std::views::split(std::string(labels), ',')) {
-    _labels.push_back(std::string(subtoken.cbegin(), subtoken.cend()));
-  }
-  store_actions(actions);
-  if (contingent.empty())
-    return;
-  _contingent = contingent;
-  // make a trie of 'contingent strings' to confirm rule_string context
-  for (const auto subtoken : std::views::split(_contingent, ',')) {
-    std::string next(subtoken.cbegin(), subtoken.cend());
-    if (starts_with(next, "!")) {
-      next = next.substr(1);
-      _absent_substring_trie.insert(to_canonical(std::string_view(subtoken)));
-    } else {
-      _substring_trie.insert(to_canonical(std::string_view(subtoken)));
-    }
-  }
-}
-
-void matcher::rule::store_actions(std::string_view actions) {
-  _raw_actions = actions;
-  // with string_view's C++23 range constructor:
-  for (const auto token : std::views::split(actions, ',')) {
-    std::string field(token.cbegin(), token.cend());
-    size_t offset(field.find('='));
-    if (offset == std::string::npos || offset == 0) {
-      throw std::invalid_argument("Invalid rule action " + field +
-                                  ", malformed key-value pair");
-    }
-    std::string value(field, offset + 1);
-    if (offset == std::string::npos) {
-      throw std::invalid_argument("Invalid rule action " + field +
-                                  ", blank value");
-    }
-    if (starts_with(field, "track=")) {
-      _track = bool_from_string(value);
-      continue;
-    }
-    if (starts_with(field, "report=")) {
-      _report = bool_from_string(value);
-      continue;
-    }
-    if (starts_with(field, "label=")) {
-      _label = bool_from_string(value);
-      continue;
-    }
-    if (starts_with(field, "scope=")) {
-      _content_scope = content_scope_from_string(value);
-      continue;
-    }
-    if (starts_with(field, "match=")) {
-      _match_type = match_type_from_string(value);
-      continue;
-    }
-    if (starts_with(field, "block=")) {
-      if (!list_manager::is_active_list_for_group(value)) {
-        throw std::invalid_argument(
-            "Invalid rule action " + field +
-            ", hyphen not permitted in list-troup name");
-      }
-      _block_list_name = value;
-      continue;
-    }
-    throw std::invalid_argument("Invalid rule action " + field +
-                                ", invalid key");
-  }
-}
-
-matcher::rule::rule(matcher::rule const &rhs)
-    : _target(rhs._target), _labels(rhs._labels), _track(rhs._track),
-      _report(rhs._report), _label(rhs._label),
-      _content_scope(rhs._content_scope),
-      _block_list_name(rhs._block_list_name), _match_type(rhs._match_type),
-      _contingent(rhs._contingent) {
-  // make a trie that is used to confirm the rule match
-  for (const auto subtoken : std::views::split(_contingent, ',')) {
-    std::string next(subtoken.cbegin(), subtoken.cend());
-    if (starts_with(next, "!")) {
-      next = next.substr(1);
-      _absent_substring_trie.insert(to_canonical(std::string_view(subtoken)));
-    } else {
-      _substring_trie.insert(to_canonical(std::string_view(subtoken)));
-    }
-  }
-}
-
-bool matcher::rule::passes_contingent_checks(
-    std::string const &candidate) const {
-  if (_contingent.empty())
-    return true;
-  // use ICU canonical form for multilanguage support
-  auto normalized(to_canonical(candidate));
-  auto required = _substring_trie.parse_text(normalized); // at least one match
-  auto disallowed =
-      _absent_substring_trie.parse_text(normalized); // zero matches
-
-  return !required.empty() && disallowed.empty();
-}
-
-matcher::rule matcher::find_rule(std::wstring const &key) const {
-  std::lock_guard lock(_lock);
-  return find_rule_unchecked(key);
-}
-
-matcher::rule matcher::find_rule_unchecked(std::wstring const &key) const {
-  auto result(_rule_lookup.find(key));
-  if (result != _rule_lookup.cend())
-    return result->second;
-
-  std::ostringstream oss;
-  oss << "Rule lookup failed for key " << wstring_to_utf8(key);
-  throw std::runtime_error(oss.str());
-}
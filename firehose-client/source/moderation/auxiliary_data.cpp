@@ -145,12 +145,13 @@ void auxiliary_data::update_match_filters() {
           now - _last_match_filter_refresh) > MatchFiltersRefreshInterval) {
     pqxx::work tx(*_cx);
     bool load_failed(false);
-    matcher replacement;
+    std::vector<matcher::rule> replacement;
     for (auto [filter, labels, actions, contingent] :
          tx.query<std::string, std::string, std::string,
                   std::optional<std::string>>("SELECT * FROM match_filters;")) {
       try {
-        replacement.add_rule(filter, labels, actions, contingent.value_or(""));
+        replacement.emplace_back(filter, labels, actions,
+                                 contingent.value_or(""));
       } catch (std::exception const &exc) {
         REL_ERROR("check_refresh_match_filters '{}|{}|{}|{}' error {}", filter,
                   labels, actions, contingent.value_or(""), exc.what());
@@ -159,7 +160,7 @@ void auxiliary_data::update_match_filters() {
     }
 
     if (!load_failed) {
-      // switch replacement rules into the main matcher
+      // switch replacement rules into the main matcher, if they changed
       std::lock_guard guard(_lock);
       matcher::shared().refresh_rules(std::move(replacement));
       _last_match_filter_refresh = std::chrono::steady_clock::now();
@@ -145,7 +145,7 @@ void embed_checker::refresh_hosts(std::unordered_set<std::string> &&new_hosts) {
 }
 
 void embed_checker::image_seen(std::string const &repo, std::string const &path,
-                               std::string const &cid) {
+                               atproto::binary_cid const &cid) {
   // return true if insert fails, we already know this one
   metrics_factory::instance()
       .get_counter("embedded_content")
@@ -156,7 +156,7 @@ void embed_checker::image_seen(std::string const &repo, std::string const &path,
   if (!inserted.second) {
     if (alert_needed(++(inserted.first->second), ImageFactor)) {
       REL_INFO("Image repetition count {:6} {} at {}/{}",
-               inserted.first->second, cid, repo, path);
+               inserted.first->second, cid.to_string(), repo, path);
       metrics_factory::instance()
           .get_counter("embedded_content")
           .Get({{"images", "repetition"}})
@@ -408,7 +408,7 @@ bool embed_handler::on_url_redirect(int code, std::string &url,
 }
 
 void embed_checker::video_seen(std::string const &repo, std::string const &path,
-                               std::string const &cid) {
+                               atproto::binary_cid const &cid) {
   // return true if insert fails, we already know this one
   metrics_factory::instance()
       .get_counter("embedded_content")
@@ -419,7 +419,7 @@ void embed_checker::video_seen(std::string const &repo, std::string const &path,
   if (!inserted.second) {
     if (alert_needed(++(inserted.first->second), VideoFactor)) {
       REL_INFO("Video repetition count {:6} {} at {}/{}",
-               inserted.first->second, cid, repo, path);
+               inserted.first->second, cid.to_string(), repo, path);
       metrics_factory::instance()
           .get_counter("embedded_content")
           .Get({{"videos", "repetition"}})
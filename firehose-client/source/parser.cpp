@@ -22,10 +22,13 @@ http://www.fsf.org/licensing/licenses
 #include "common/helpers.hpp"
 #include "common/rest_utils.hpp"
 #include "datasource.hpp"
+#include "json_scanner.hpp"
 #include <boost/asio/buffers_iterator.hpp>
 #include <sstream>
 
 std::shared_ptr<config> parser::_settings;
+bool parser::_is_full = false;
+bool parser::_lazy_car = false;
 
 // Extract UTF-8 string containing the material to be checked,  which is
 // context-dependent
@@ -38,15 +41,25 @@ parser::get_candidates_from_string(std::string const &full_content) const {
 candidate_list
 parser::get_candidates_from_flat_buffer(beast::flat_buffer const &beast_data) {
   auto buffer(beast_data.data());
-  if (is_full(*_settings)) {
-    bool parsed(json_from_cbor(buffers_begin(buffer), buffers_end(buffer)));
+  return get_candidates_from_frame(std::string_view(
+      static_cast<const char *>(buffer.data()), buffer.size()));
+}
+
+candidate_list parser::get_candidates_from_frame(std::string_view frame) {
+  if (_is_full) {
+    bool parsed(json_from_cbor(frame.cbegin(), frame.cend()));
     if (!parsed) {
       // TODO error handling
     }
     return {};
   } else {
+    // pull out only the target fields, the DOM is for shapes the scanner
+    // does not handle
+    auto candidates(json_scanner::candidates(frame));
+    if (candidates.has_value())
+      return std::move(candidates.value());
     nlohmann::json full_json(
-        nlohmann::json::parse(buffers_begin(buffer), buffers_end(buffer)));
+        nlohmann::json::parse(frame.cbegin(), frame.cend()));
     return get_candidates_from_json(full_json);
   }
 }
@@ -108,40 +121,12 @@ inline bool parser::cbor_callback(int /* depth */,
     // Check for "roots" and decode embedded CIDs is found
     if (parsed.contains("roots")) {
       DBG_TRACE("JSON roots  {}", parsed.dump());
-    } else if (parsed.contains("__readable_cid__")) {
+    } else if (parsed.contains("__binary_cid__")) {
       // DBG_TRACE("JSON block cid {}", parsed.dump());
-      _block_cid = parsed["__readable_cid__"].template get<std::string>();
+      _block_cid = atproto::binary_cid(parsed["__binary_cid__"].get_binary());
     } else {
       DBG_TRACE("JSON Result  {}", parsed.dump());
-      if (parsed.contains("$type")) {
-        if (_block_cid.empty()) {
-          REL_ERROR("Block CID empty, block={}", parsed.dump());
-          return false;
-        }
-        // if this is a potential match source store it for scanning
-        // There may be more than one per message if user posted multiple
-        // replies to a post, or a new thread.
-        std::string block_type(parsed["$type"].template get<std::string>());
-        if (json::TargetFieldNames.contains(block_type)) {
-          // block may contains string-matching content
-          if (!_cids.insert(_block_cid).second) {
-            REL_ERROR("Matchable Block CID {} already stored, block={}",
-                      _block_cid, parsed.dump());
-            return false;
-          }
-          _matchable_cbors.emplace_back(_block_cid, std::move(parsed));
-        } else {
-          // Also store other typed CBORs.
-          if (!_cids.insert(_block_cid).second) {
-            REL_ERROR("Content Block CID {} already stored, block={}",
-                      _block_cid, parsed.dump());
-            return false;
-          }
-          _content_cbors.emplace_back(_block_cid, std::move(parsed));
-        }
-      } else {
-        _other_cbors.emplace_back(_block_cid, std::move(parsed));
-      }
+      return add_block(_block_cid, std::move(parsed));
     }
   } else if (event == nlohmann::json::parse_event_t::key) {
     DBG_TRACE("JSON Key     {}", parsed.dump());
@@ -160,8 +145,46 @@ inline bool parser::cbor_callback(int /* depth */,
   return true;
 }
 
+bool parser::add_block(atproto::binary_cid const &cid,
+                       nlohmann::json &&block) {
+  if (block.contains("$type")) {
+    if (!cid.is_valid()) {
+      REL_ERROR("Block CID empty, block={}", block.dump());
+      return false;
+    }
+    // if this is a potential match source store it for scanning
+    // There may be more than one per message if user posted multiple
+    // replies to a post, or a new thread.
+    std::string block_type(block["$type"].template get<std::string>());
+    if (json::TargetFieldNames.contains(block_type)) {
+      // block may contains string-matching content
+      if (!_cids.insert(cid).second) {
+        REL_ERROR("Matchable Block CID {} already stored, block={}",
+                  cid.to_string(), block.dump());
+        return false;
+      }
+      _matchable_cbors.emplace_back(cid, std::move(block));
+    } else {
+      // Also store other typed CBORs.
+      if (!_cids.insert(cid).second) {
+        REL_ERROR("Content Block CID {} already stored, block={}",
+                  cid.to_string(), block.dump());
+        return false;
+      }
+      _content_cbors.emplace_back(cid, std::move(block));
+    }
+  } else {
+    _other_cbors.emplace_back(cid, std::move(block));
+  }
+  return true;
+}
+
 void parser::set_config(std::shared_ptr<config> &settings) {
   _settings = settings;
+  // decoders run on many threads, avoid concurrent YAML lookups per frame
+  _is_full = is_full(*_settings);
+  _lazy_car = _settings->get_config()[PROJECT_NAME]["datasource"]["lazy_car"]
+                  .as<bool>(false);
 }
 
 std::string parser::dump_parse_content() const {
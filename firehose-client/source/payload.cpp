@@ -22,17 +22,119 @@ http://www.fsf.org/licensing/licenses
 #include "common/activity/account_events.hpp"
 #include "common/activity/event_recorder.hpp"
 #include "common/moderation/ozone_adapter.hpp"
+#include "dag_cbor.hpp"
 #include "moderation/action_router.hpp"
 #include "moderation/auxiliary_data.hpp"
 #include "moderation/embed_checker.hpp"
 #include "parser.hpp"
 #include "payload.hpp"
-#include <multiformats/cid.hpp>
+#include <charconv>
+
+namespace {
+// Just enough CBOR to walk a frame for its seq without a full decode
+class cbor_cursor {
+public:
+  cbor_cursor(std::string_view data) : _data(data) {}
+
+  bool head(uint8_t &major, uint64_t &value) {
+    if (_pos >= _data.size())
+      return false;
+    uint8_t initial(static_cast<uint8_t>(_data[_pos++]));
+    major = initial >> 5;
+    uint8_t info(initial & 0x1f);
+    if (info < 24) {
+      value = info;
+      return true;
+    }
+    // DAG-CBOR has no indefinite lengths
+    if (info > 27)
+      return false;
+    size_t bytes(size_t(1) << (info - 24));
+    if (_pos + bytes > _data.size())
+      return false;
+    value = 0;
+    for (size_t next = 0; next < bytes; ++next) {
+      value = (value << 8) | static_cast<uint8_t>(_data[_pos++]);
+    }
+    return true;
+  }
+
+  bool text(std::string_view &value) {
+    uint8_t major;
+    uint64_t length;
+    if (!head(major, length) || major != 3 || _pos + length > _data.size())
+      return false;
+    value = _data.substr(_pos, length);
+    _pos += length;
+    return true;
+  }
+
+  bool skip() {
+    uint8_t major;
+    uint64_t value;
+    if (!head(major, value))
+      return false;
+    switch (major) {
+    case 2:
+    case 3:
+      if (_pos + value > _data.size())
+        return false;
+      _pos += value;
+      return true;
+    case 4:
+      for (uint64_t item = 0; item < value; ++item) {
+        if (!skip())
+          return false;
+      }
+      return true;
+    case 5:
+      for (uint64_t item = 0; item < value * 2; ++item) {
+        if (!skip())
+          return false;
+      }
+      return true;
+    case 6:
+      return skip();
+    default:
+      return true;
+    }
+  }
+
+private:
+  std::string_view _data;
+  size_t _pos = 0;
+};
+} // namespace
 
 jetstream_payload::jetstream_payload() {}
-jetstream_payload::jetstream_payload(std::string json_msg,
-                                     match_results matches)
-    : _json_msg(json_msg), _matches(matches) {}
+jetstream_payload::jetstream_payload(frame_ptr &&frame, match_results matches)
+    : _frame(std::move(frame)), _matches(std::move(matches)) {}
+
+int64_t jetstream_payload::seq_from_frame(std::string_view frame) {
+  constexpr std::string_view time_us = "\"time_us\":";
+  size_t found(frame.find(time_us));
+  if (found == std::string_view::npos)
+    return 0;
+  found = frame.find_first_not_of(" \t", found + time_us.size());
+  if (found == std::string_view::npos)
+    return 0;
+  int64_t seq(0);
+  std::from_chars(frame.data() + found, frame.data() + frame.size(), seq);
+  return seq;
+}
+
+std::string jetstream_payload::admission_class() const {
+  if (!_frame)
+    return {};
+  for (std::string_view key : {"\"collection\":\"", "\"kind\":\""}) {
+    size_t start(_frame->find(key));
+    if (start != std::string::npos) {
+      start += key.size();
+      return _frame->substr(start, _frame->find('"', start) - start);
+    }
+  }
+  return {};
+}
 
 void jetstream_payload::handle(post_processor<jetstream_payload> &) {
   // TODO almost identical to jetstream_payload::handle
@@ -42,12 +144,12 @@ void jetstream_payload::handle(post_processor<jetstream_payload> &) {
     // desired strings
     REL_INFO("Candidate {}|{}|{}\nmatches {}\non message:{}",
              result._candidate._type, result._candidate._field,
-             result._candidate._value, result._matches, _json_msg);
+             result._candidate._value, result.matched_filters(), *_frame);
     for (auto const &match : result._matches) {
       prometheus::Labels labels(
           {{"type", result._candidate._type},
            {"field", result._candidate._field},
-           {"filter", wstring_to_utf8(match.get_keyword())}});
+           {"filter", result._rules->at(match)._keyword}});
       metrics_factory::instance()
           .get_counter("message_string_matches")
           .Get(labels)
@@ -57,24 +159,77 @@ void jetstream_payload::handle(post_processor<jetstream_payload> &) {
 }
 
 firehose_payload::firehose_payload() {}
-firehose_payload::firehose_payload(parser &my_parser)
-    : _parser(std::move(my_parser)) {}
 
-void firehose_payload::handle(post_processor<firehose_payload> &processor) {
-  auto const &other_cbors(_parser.other_cbors());
-  if (other_cbors.size() != 2) {
-    std::ostringstream oss;
-    for (auto const &cbor : _parser.other_cbors()) {
-      oss << cbor.second.dump();
+int64_t firehose_payload::seq_from_frame(std::string_view frame) {
+  // frame is header then message, both maps
+  cbor_cursor cursor(frame);
+  uint8_t major;
+  uint64_t entries;
+  if (!cursor.skip() || !cursor.head(major, entries) || major != 5)
+    return 0;
+  for (uint64_t entry = 0; entry < entries; ++entry) {
+    std::string_view key;
+    if (!cursor.text(key))
+      return 0;
+    if (key == "seq") {
+      uint64_t seq;
+      return cursor.head(major, seq) && major == 0 ? static_cast<int64_t>(seq)
+                                                   : 0;
     }
-    REL_ERROR("Malformed firehose message {}", oss.str());
+    if (!cursor.skip())
+      return 0;
+  }
+  return 0;
+}
+firehose_payload::firehose_payload(frame_ptr &&frame)
+    : _frame(std::move(frame)),
+      _document(dag_cbor::document_pool::instance().acquire(*_frame)) {}
+
+std::string firehose_payload::to_string() const {
+  if (!_document)
+    return {};
+  std::ostringstream oss;
+  for (auto const &item : _document->items()) {
+    oss << '(' << dump_json(dag_cbor::to_json(item)) << ')';
+  }
+  return oss.str();
+}
+
+std::string firehose_payload::admission_class() const {
+  if (!is_well_formed())
+    return {};
+  auto const &header(_document->items().front());
+  auto const &message(_document->items().back());
+  auto op_type(header.find("t"));
+  if (!op_type || !op_type->is_text())
+    return {};
+  if (op_type->as_text() != firehose::OpTypeCommit)
+    return std::string(op_type->as_text());
+  auto ops(message.find("ops"));
+  if (!ops || !ops->is_array() || ops->size() == 0)
+    return std::string(op_type->as_text());
+  auto path(ops->items().front().find("path"));
+  if (!path || !path->is_text())
+    return {};
+  return std::string(path->as_text().substr(0, path->as_text().find('/')));
+}
+
+bool firehose_payload::is_well_formed() const {
+  return _document && _document->items().size() == 2 &&
+         _document->items().front().is_map() &&
+         _document->items().back().is_map();
+}
+
+void firehose_payload::handle(post_processor<firehose_payload> &processor) {
+  if (!is_well_formed()) {
+    REL_ERROR("Malformed firehose message {}", to_string());
     return;
   }
-  auto const &header(other_cbors.front().second);
-  auto const &message(other_cbors.back().second);
-  REL_DEBUG("Firehose header:  {}", dump_json(header));
-  REL_DEBUG("         message: {}", dump_json(message));
-  int op(header["op"].template get<int>());
+  auto const &header(_document->items().front());
+  auto const &message(_document->items().back());
+  REL_DEBUG("Firehose header:  {}", dump_json(dag_cbor::to_json(header)));
+  REL_DEBUG("         message: {}", dump_json(dag_cbor::to_json(message)));
+  int op(header["op"].as_integer());
   if (op == static_cast<int>(firehose::op::error)) {
     metrics_factory::instance()
         .get_counter("firehose_content")
@@ -85,7 +240,7 @@ void firehose_payload::handle(post_processor<firehose_payload> &processor) {
         .get_counter("firehose_content")
         .Get({{"op", "message"}})
         .Increment();
-    std::string op_type(header["t"].template get<std::string>());
+    std::string op_type(header["t"].as_text());
     metrics_factory::instance()
         .get_counter("firehose_content")
         .Get({{"op", "message"}, {"type", op_type}})
@@ -93,11 +248,18 @@ void firehose_payload::handle(post_processor<firehose_payload> &processor) {
     std::string repo;
     parser block_parser;
     if (op_type == firehose::OpTypeCommit) {
-      repo = message["repo"].template get<std::string>();
-      if (message.contains("blocks")) {
+      repo = std::string(message["repo"].as_text());
+      std::optional<car_index> blocks_index;
+      if (message.contains("blocks") && parser::lazy_car()) {
+        // CAR file - index only, record blocks are decoded per op below
+        blocks_index.emplace(message["blocks"].as_bytes());
+        if (!blocks_index->is_valid()) {
+          REL_ERROR("Malformed CAR, indexed {} blocks", blocks_index->size());
+        }
+      } else if (message.contains("blocks")) {
         // CAR file - nested in-situ parse to extract as JSON
-        auto blocks(message["blocks"].template get<nlohmann::json::binary_t>());
-        bool parsed(block_parser.json_from_car(blocks.cbegin(), blocks.cend()));
+        auto blocks(message["blocks"].as_bytes());
+        bool parsed(block_parser.json_from_car(blocks.begin(), blocks.end()));
         if (parsed) {
           DBG_DEBUG("Commit content blocks: {}",
                     block_parser.dump_parse_content());
@@ -106,10 +268,11 @@ void firehose_payload::handle(post_processor<firehose_payload> &processor) {
           // TODO error handling
         }
       }
-      for (auto const &oper : message["ops"]) {
+      for (auto const &oper : message["ops"].items()) {
         size_t count = 0;
-        auto path(oper["path"].template get<std::string>());
-        auto kind(oper["action"].template get<std::string>());
+        std::string collection;
+        std::string path(oper["path"].as_text());
+        std::string kind(oper["action"].as_text());
         firehose::op_kind oper_kind(firehose::op_kind_from_string(kind));
         for (const auto token : std::views::split(path, '/')) {
           // with string_view's C++23 range constructor:
@@ -119,6 +282,7 @@ void firehose_payload::handle(post_processor<firehose_payload> &processor) {
             if (field.empty())
               throw std::invalid_argument("Blank collection in op.path " +
                                           path);
+            collection = field;
             metrics_factory::instance()
                 .get_counter("firehose_content")
                 .Get({{"op", "message"},
@@ -139,32 +303,34 @@ void firehose_payload::handle(post_processor<firehose_payload> &processor) {
           processor.request_recording(
               {repo,
                bsky::time_stamp_from_iso_8601(
-                   message["time"].template get<std::string>()),
+                   std::string(message["time"].as_text())),
                activity::deleted(path)});
         } else if (oper.contains("cid") && !oper["cid"].is_null()) {
-          auto cid(oper["cid"].template get<nlohmann::json::binary_t>());
           try {
-            // nlhomann parser gives us a leading zero
-            atproto::cid_decoder decoder(cid.cbegin() + 1, cid.cend());
-            std::string friendly_cid(decoder.as_string());
-            auto insertion(_path_by_cid.insert({friendly_cid, path}));
+            auto cid(atproto::binary_cid::from_link(oper["cid"].as_bytes()));
+            auto insertion(_path_by_cid.insert({cid, path}));
             if (!insertion.second) {
               // We see this for Block operations very rarely. Log to try to
               // track it down
               REL_ERROR(
                   "Duplicate cid {} at op.path {}, already used for path {}",
-                  friendly_cid, path, insertion.first->second);
-              REL_ERROR("Firehose header:  {}", dump_json(header));
-              REL_ERROR("         message: {}", dump_json(message));
+                  cid.to_string(), path, insertion.first->second);
+              REL_ERROR("Firehose header:  {}",
+                        dump_json(dag_cbor::to_json(header)));
+              REL_ERROR("         message: {}",
+                        dump_json(dag_cbor::to_json(message)));
               REL_ERROR("Content CBORs:  {}",
                         block_parser.dump_parse_content());
               REL_ERROR("Matched CBORs:  {}",
                         block_parser.dump_parse_matched());
               REL_ERROR("Other CBORs:    {}", block_parser.dump_parse_other());
+            } else if (blocks_index.has_value() &&
+                       is_lazy_collection(collection)) {
+              decode_block(*blocks_index, block_parser, cid);
             }
           } catch (std::exception const &exc) {
             REL_ERROR("CID parse error {} in message {}", exc.what(),
-                      dump_json(message));
+                      dump_json(dag_cbor::to_json(message)));
           }
         }
       }
@@ -179,23 +345,24 @@ void firehose_payload::handle(post_processor<firehose_payload> &processor) {
       }
     } else if (op_type == firehose::OpTypeIdentity ||
                op_type == firehose::OpTypeHandle) {
-      repo = message["did"].template get<std::string>();
+      repo = std::string(message["did"].as_text());
       if (message.contains("handle")) {
-        std::string handle(message["handle"].template get<std::string>());
+        std::string handle(message["handle"].as_text());
         _path_candidates.emplace_back(
             std::make_pair<std::string, candidate_list>(
                 "handle", {{op_type, "handle", handle}}));
         processor.request_recording(
             {repo,
              bsky::time_stamp_from_iso_8601(
-                 message["time"].template get<std::string>()),
+                 std::string(message["time"].as_text())),
              activity::handle(handle)});
         activity::event_recorder::instance().update_handle(repo, handle);
       }
-      REL_INFO("{} {}", op_type.c_str(), dump_json(message));
+      REL_INFO("{} {}", op_type.c_str(),
+               dump_json(dag_cbor::to_json(message)));
     } else if (op_type == firehose::OpTypeAccount) {
-      repo = message["did"].template get<std::string>();
-      bool active(message["active"].template get<bool>());
+      repo = std::string(message["did"].as_text());
+      bool active(message["active"].as_bool());
       metrics_factory::instance()
           .get_counter("firehose_content")
           .Get({{"op", "message"},
@@ -206,36 +373,39 @@ void firehose_payload::handle(post_processor<firehose_payload> &processor) {
         processor.request_recording(
             {repo,
              bsky::time_stamp_from_iso_8601(
-                 message["time"].template get<std::string>()),
+                 std::string(message["time"].as_text())),
              activity::active()});
       } else if (message.contains("status")) {
         processor.request_recording(
             {repo,
              bsky::time_stamp_from_iso_8601(
-                 message["time"].template get<std::string>()),
+                 std::string(message["time"].as_text())),
              activity::inactive(bsky::down_reason_from_string(
-                 message["status"].template get<std::string>()))});
+                 std::string(message["status"].as_text())))});
       } else {
         processor.request_recording(
             {repo,
              bsky::time_stamp_from_iso_8601(
-                 message["time"].template get<std::string>()),
+                 std::string(message["time"].as_text())),
              activity::inactive(bsky::down_reason::unknown)});
       }
-      REL_INFO("{} {}", op_type.c_str(), dump_json(message));
+      REL_INFO("{} {}", op_type.c_str(),
+               dump_json(dag_cbor::to_json(message)));
     } else if (op_type == firehose::OpTypeTombstone) {
-      repo = message["did"].template get<std::string>();
+      repo = std::string(message["did"].as_text());
       processor.request_recording(
           {repo,
            bsky::time_stamp_from_iso_8601(
-               message["time"].template get<std::string>()),
+               std::string(message["time"].as_text())),
            activity::inactive(bsky::down_reason::tombstone)});
-      REL_INFO("{} {}", op_type.c_str(), dump_json(message));
+      REL_INFO("{} {}", op_type.c_str(),
+               dump_json(dag_cbor::to_json(message)));
     } else if (op_type == firehose::OpTypeMigrate ||
                op_type == firehose::OpTypeInfo) {
       // no-op
     }
-    REL_TRACE("{} {}", header.dump(), message.dump());
+    REL_TRACE("{} {}", dag_cbor::to_json(header).dump(),
+              dag_cbor::to_json(message).dump());
     if (!_path_candidates.empty()) {
       auto matches(
           matcher::shared().all_matches_for_path_candidates(_path_candidates));
@@ -249,8 +419,9 @@ void firehose_payload::handle(post_processor<firehose_payload> &processor) {
             // this is the substring of the full JSON that matched one or more
             // desired strings
             // start tracking this account if not already
-            REL_INFO("{}/{}/{} matched candidate {}|{}|{}", next_match._matches,
-                     repo, handle, next_match._candidate._type,
+            REL_INFO("{}/{}/{} matched candidate {}|{}|{}",
+                     next_match.matched_filters(), repo, handle,
+                     next_match._candidate._type,
                      next_match._candidate._field,
                      next_match._candidate._value);
             count += next_match._matches.size();
@@ -258,7 +429,7 @@ void firehose_payload::handle(post_processor<firehose_payload> &processor) {
               prometheus::Labels labels(
                   {{"type", next_match._candidate._type},
                    {"field", next_match._candidate._field},
-                   {"filter", wstring_to_utf8(match.get_keyword())}});
+                   {"filter", next_match._rules->at(match)._keyword}});
               metrics_factory::instance()
                   .get_counter("message_string_matches")
                   .Get(labels)
@@ -269,10 +440,12 @@ void firehose_payload::handle(post_processor<firehose_payload> &processor) {
         // only log message once - might be interleaved with other thread output
         if (op_type == firehose::OpTypeCommit) {
           // curate a smaller version of the full message for correlation
-          REL_INFO("in message: {} {} {}", repo, dump_json(message["ops"]),
+          REL_INFO("in message: {} {} {}", repo,
+                   dump_json(dag_cbor::to_json(message["ops"])),
                    block_parser.dump_parse_content());
         } else {
-          REL_INFO("in message: {} {}", repo, dump_json(message));
+          REL_INFO("in message: {} {}", repo,
+                   dump_json(dag_cbor::to_json(message)));
         }
         // record suspect activity as a special-case event
         processor.request_recording(
@@ -284,20 +457,46 @@ void firehose_payload::handle(post_processor<firehose_payload> &processor) {
     }
     // update last-seen sequence number
     if (op_type != firehose::OpTypeInfo) {
-      int64_t seq(message["seq"].template get<int64_t>());
-      std::string emitted_at(message["time"].template get<std::string>());
+      int64_t seq(message["seq"].as_integer());
+      std::string emitted_at(message["time"].as_text());
       bsky::moderation::auxiliary_data::instance().update_rewind_point(
           seq, emitted_at);
     }
   }
 }
 
+// records that post-processing acts on, others are skipped by lazy decode
+bool firehose_payload::is_lazy_collection(std::string const &collection) {
+  return bsky::event_type_from_collection(collection) !=
+             bsky::tracked_event::invalid ||
+         json::TargetFieldNames.contains(collection);
+}
+
+void firehose_payload::decode_block(car_index const &blocks_index,
+                                    parser &block_parser,
+                                    atproto::binary_cid const &cid) {
+  auto block(blocks_index.find(cid.raw()));
+  if (block.empty()) {
+    metrics_factory::instance()
+        .get_counter("firehose_content")
+        .Get({{"car_block", "missing"}})
+        .Increment();
+    return;
+  }
+  block_parser.add_block(
+      cid,
+      nlohmann::json::from_cbor(block.begin(), block.end(), true, true,
+                                nlohmann::json::cbor_tag_handler_t::ignore));
+  metrics_factory::instance()
+      .get_counter("firehose_content")
+      .Get({{"car_block", "decoded"}})
+      .Increment();
+}
+
 bsky::embed_type
 firehose_payload::context::process_embed(nlohmann::json const &embed) {
   // TODO pass along the embeds for checking
   std::string uri;
-  std::string cid;
-  nlohmann::json::binary_t encoded_cid;
   bsky::embed_type embed_type = bsky::embed_type_from_string(_embed_type_str);
   switch (embed_type) {
   case bsky::embed_type::record:
@@ -324,35 +523,23 @@ firehose_payload::context::process_embed(nlohmann::json const &embed) {
     add_embed(
         embed::external(embed["external"]["uri"].template get<std::string>()));
     if (embed["external"].contains("thumb")) {
-      encoded_cid = embed["external"]["thumb"]["ref"]
-                        .template get<nlohmann::json::binary_t>();
       // nlohmann parser leaves a leading zero byte
-      cid = atproto::cid_decoder<nlohmann::json::binary_t::const_iterator>(
-                encoded_cid.cbegin() + 1, encoded_cid.cend())
-                .as_string();
-      add_embed(embed::image(cid));
+      add_embed(embed::image(atproto::binary_cid::from_link(
+          embed["external"]["thumb"]["ref"].get_binary())));
     }
     break;
   case bsky::embed_type::images:
     // pass along the CID in each image
     for (auto const &image : embed["images"]) {
-      encoded_cid =
-          image["image"]["ref"].template get<nlohmann::json::binary_t>();
       // nlohmann parser leaves a leading zero byte
-      cid = atproto::cid_decoder<nlohmann::json::binary_t::const_iterator>(
-                encoded_cid.cbegin() + 1, encoded_cid.cend())
-                .as_string();
-      add_embed(embed::image(cid));
+      add_embed(embed::image(
+          atproto::binary_cid::from_link(image["image"]["ref"].get_binary())));
     }
     break;
   case bsky::embed_type::video:
-    encoded_cid =
-        embed["video"]["ref"].template get<nlohmann::json::binary_t>();
     // nlohmann parser leaves a leading zero byte
-    cid = atproto::cid_decoder<nlohmann::json::binary_t::const_iterator>(
-              encoded_cid.cbegin() + 1, encoded_cid.cend())
-              .as_string();
-    add_embed(embed::video(cid));
+    add_embed(embed::video(
+        atproto::binary_cid::from_link(embed["video"]["ref"].get_binary())));
     break;
   default:
     break;
@@ -362,11 +549,12 @@ firehose_payload::context::process_embed(nlohmann::json const &embed) {
 
 void firehose_payload::handle_content(
     post_processor<firehose_payload> &processor, std::string const &repo,
-    std::string const &cid, nlohmann::json const &content) {
+    atproto::binary_cid const &cid, nlohmann::json const &content) {
   context this_context(processor, content);
   this_context._repo = repo;
-  if (_path_by_cid.contains(cid)) {
-    this_context._this_path = _path_by_cid[cid];
+  auto path(_path_by_cid.find(cid));
+  if (path != _path_by_cid.end()) {
+    this_context._this_path = path->second;
   } else {
     throw std::runtime_error("cannot get URI for cid at " + dump_json(content));
   }
@@ -539,14 +727,15 @@ void firehose_payload::handle_content(
 
 void firehose_payload::handle_matchable_content(
     post_processor<firehose_payload> &processor, std::string const &repo,
-    std::string const &cid, nlohmann::json const &content) {
+    atproto::binary_cid const &cid, nlohmann::json const &content) {
   // common processing
   handle_content(processor, repo, cid, content);
 
   // check for matches
   std::string this_path;
-  if (_path_by_cid.contains(cid)) {
-    this_path = _path_by_cid[cid];
+  auto path(_path_by_cid.find(cid));
+  if (path != _path_by_cid.end()) {
+    this_path = path->second;
   } else {
     throw std::runtime_error("cannot get URI for cid at " + dump_json(content));
   }
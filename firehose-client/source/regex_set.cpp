@@ -0,0 +1,108 @@
+/*************************************************************************
+Public Education Forum Moderation Firehose Client
+Copyright (c) Steve Townsend 2025
+
+>>> SOURCE LICENSE >>>
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation (www.fsf.org); either version 3 of the
+License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+A copy of the GNU General Public License is available at
+http://www.fsf.org/licensing/licenses
+>>> END OF LICENSE >>>
+*************************************************************************/
+
+#include "regex_set.hpp"
+#include "common/log_wrapper.hpp"
+#include <format>
+
+namespace {
+std::atomic<prometheus::Counter *> fallback_counter(nullptr);
+}
+
+regex_set::regex_set(const int64_t max_memory) {
+  _options.set_encoding(RE2::Options::EncodingUTF8);
+  _options.set_case_sensitive(false);
+  _options.set_log_errors(false);
+  _options.set_max_mem(max_memory);
+  _set = std::make_unique<RE2::Set>(_options, RE2::UNANCHORED);
+}
+
+regex_set::pattern_id regex_set::add(std::string_view pattern,
+                                     std::string &error) {
+  RE2::Options single(_options);
+  single.set_max_mem(RE2::Options().max_mem());
+  auto compiled(std::make_unique<RE2>(pattern, single));
+  if (!compiled->ok()) {
+    error = compiled->error();
+    return NoPattern;
+  }
+  if (compiled->ProgramSize() > MaxProgramSize) {
+    error = std::format("program size {} exceeds {}", compiled->ProgramSize(),
+                        MaxProgramSize);
+    return NoPattern;
+  }
+  if (_program_size + compiled->ProgramSize() > MaxTotalProgramSize) {
+    error = std::format("total program size would exceed {}",
+                        MaxTotalProgramSize);
+    return NoPattern;
+  }
+  if (RE2::PartialMatch(std::string_view(), *compiled)) {
+    error = "matches empty text";
+    return NoPattern;
+  }
+  const int index(_set->Add(pattern, &error));
+  if (index < 0)
+    return NoPattern;
+  _program_size += compiled->ProgramSize();
+  _patterns.push_back(std::move(compiled));
+  return static_cast<pattern_id>(index);
+}
+
+void regex_set::compile() {
+  _compiled = _set->Compile();
+  if (!_compiled) {
+    REL_ERROR("regex_set: {} patterns exceed memory budget {}, matching "
+              "singly",
+              _patterns.size(), _options.max_mem());
+  }
+}
+
+void regex_set::scan(std::string_view text, std::vector<int> &matches) const {
+  matches.clear();
+  if (_patterns.empty())
+    return;
+  if (_compiled) {
+    RE2::Set::ErrorInfo error_info;
+    if (_set->Match(text, &matches, &error_info) ||
+        error_info.kind == RE2::Set::kNoError)
+      return;
+    // the shared DFA cache is full, so try each pattern alone. Every such
+    // scan is counted, only the first is logged.
+    if (!_fallback_logged.load(std::memory_order_relaxed) &&
+        !_fallback_logged.exchange(true, std::memory_order_relaxed)) {
+      REL_WARNING("regex_set: match failed with error {}, checking {} "
+                  "patterns singly",
+                  static_cast<int>(error_info.kind), _patterns.size());
+    }
+    matches.clear();
+  }
+  prometheus::Counter *counter(
+      fallback_counter.load(std::memory_order_acquire));
+  if (counter)
+    counter->Increment();
+  for (size_t index = 0; index < _patterns.size(); ++index) {
+    if (RE2::PartialMatch(text, *_patterns[index]))
+      matches.push_back(static_cast<int>(index));
+  }
+}
+
+void regex_set::set_fallback_counter(prometheus::Counter *counter) {
+  fallback_counter.store(counter, std::memory_order_release);
+}
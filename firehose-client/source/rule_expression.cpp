@@ -0,0 +1,256 @@
+/*************************************************************************
+Public Education Forum Moderation Firehose Client
+Copyright (c) Steve Townsend 2025
+
+>>> SOURCE LICENSE >>>
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation (www.fsf.org); either version 3 of the
+License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+A copy of the GNU General Public License is available at
+http://www.fsf.org/licensing/licenses
+>>> END OF LICENSE >>>
+*************************************************************************/
+
+#include "rule_expression.hpp"
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <stdexcept>
+
+// Recursive descent over the source, emitting postfix steps as it goes
+class rule_expression::parser {
+public:
+  parser(rule_expression &target, std::string_view source)
+      : _target(target), _source(source) {}
+
+  void parse() {
+    parse_or();
+    skip_space();
+    if (_offset < _source.length())
+      fail("unexpected '" + std::string(_source.substr(_offset)) + "'");
+  }
+
+private:
+  static constexpr uint16_t MaxDistance = 1000;
+
+  void parse_or() {
+    parse_and();
+    while (take_keyword("OR")) {
+      parse_and();
+      emit({op::either, 0, 0, 0});
+    }
+  }
+  void parse_and() {
+    parse_unary();
+    while (true) {
+      const bool explicit_and(take_keyword("AND"));
+      skip_space();
+      if (!explicit_and &&
+          (_offset == _source.length() || _source[_offset] == ')' ||
+           at_keyword("OR")))
+        return;
+      parse_unary();
+      emit({op::both, 0, 0, 0});
+    }
+  }
+  void parse_unary() {
+    if (take_keyword("NOT")) {
+      enter();
+      parse_unary();
+      --_nesting;
+      emit({op::negate, 0, 0, 0});
+      return;
+    }
+    skip_space();
+    if (_offset < _source.length() && _source[_offset] == '(') {
+      ++_offset;
+      enter();
+      parse_or();
+      --_nesting;
+      skip_space();
+      if (_offset == _source.length() || _source[_offset] != ')')
+        fail("missing ')'");
+      ++_offset;
+      return;
+    }
+    const uint8_t first(parse_term());
+    uint16_t distance(0);
+    if (take_near(distance)) {
+      const uint8_t second(parse_term());
+      emit({op::near, first, second, distance});
+      _target._has_proximity = true;
+    } else {
+      emit({op::leaf, first, 0, 0});
+    }
+  }
+  // a word or quoted phrase, optionally field:, as a leaf index
+  uint8_t parse_term() {
+    skip_space();
+    if (_offset == _source.length())
+      fail("missing term");
+    leaf term;
+    const size_t colon(_source.find_first_of(": \t\r\n()\"", _offset));
+    if (colon != std::string_view::npos && _source[colon] == ':') {
+      std::string field(_source.substr(_offset, colon - _offset));
+      std::ranges::transform(field, field.begin(), [](const char next) {
+        return static_cast<char>(std::tolower(static_cast<unsigned char>(next)));
+      });
+      if (std::ranges::find(Fields, field) != std::end(Fields)) {
+        term._field = std::move(field);
+        _offset = colon + 1;
+      }
+    }
+    if (_offset < _source.length() && _source[_offset] == '"') {
+      const size_t end(_source.find('"', _offset + 1));
+      if (end == std::string_view::npos)
+        fail("missing '\"'");
+      term._text = _source.substr(_offset + 1, end - _offset - 1);
+      _offset = end + 1;
+    } else {
+      const size_t start(_offset);
+      while (_offset < _source.length() && !is_space(_source[_offset]) &&
+             _source[_offset] != '(' && _source[_offset] != ')' &&
+             _source[_offset] != '"')
+        ++_offset;
+      term._text = _source.substr(start, _offset - start);
+      if (is_keyword(term._text))
+        fail("missing term before " + term._text);
+    }
+    if (term._text.empty())
+      fail("empty term");
+    auto &leaves(_target._leaves);
+    auto const existing(std::ranges::find_if(leaves, [&](leaf const &next) {
+      return next._text == term._text && next._field == term._field;
+    }));
+    if (existing != leaves.cend())
+      return static_cast<uint8_t>(existing - leaves.cbegin());
+    if (leaves.size() == MaxLeaves)
+      fail("more than " + std::to_string(MaxLeaves) + " terms");
+    leaves.push_back(std::move(term));
+    return static_cast<uint8_t>(leaves.size() - 1);
+  }
+
+  static inline bool is_space(const char next) {
+    return std::isspace(static_cast<unsigned char>(next)) != 0;
+  }
+  static inline bool is_keyword(std::string_view word) {
+    return word == "AND" || word == "OR" || word == "NOT" ||
+           word.starts_with("NEAR/");
+  }
+  void skip_space() {
+    while (_offset < _source.length() && is_space(_source[_offset]))
+      ++_offset;
+  }
+  // keyword followed by a space or bracket
+  bool at_keyword(std::string_view keyword) {
+    skip_space();
+    if (!_source.substr(_offset).starts_with(keyword))
+      return false;
+    const size_t end(_offset + keyword.length());
+    return end == _source.length() || is_space(_source[end]) ||
+           _source[end] == '(' || _source[end] == '"';
+  }
+  bool take_keyword(std::string_view keyword) {
+    if (!at_keyword(keyword))
+      return false;
+    _offset += keyword.length();
+    return true;
+  }
+  bool take_near(uint16_t &distance) {
+    skip_space();
+    if (!_source.substr(_offset).starts_with("NEAR/"))
+      return false;
+    const char *first(_source.data() + _offset + 5);
+    const char *last(_source.data() + _source.length());
+    auto const parsed(std::from_chars(first, last, distance));
+    if (parsed.ec != std::errc() || distance == 0 || distance > MaxDistance)
+      fail("NEAR needs a distance from 1 to " + std::to_string(MaxDistance));
+    _offset = parsed.ptr - _source.data();
+    return true;
+  }
+  // NOT and brackets recurse
+  void enter() {
+    if (++_nesting > MaxDepth)
+      fail("nested deeper than " + std::to_string(MaxDepth));
+  }
+  // Tracks the operand stack of evaluate, one bit per operand, and the field
+  // each operand needs a candidate to be, empty for any
+  void emit(step const &next) {
+    switch (next._op) {
+    case op::leaf:
+      _operands.push_back(_target._leaves[next._leaf]._field);
+      break;
+    case op::near:
+      _operands.push_back(both_fields(_target._leaves[next._leaf]._field,
+                                      _target._leaves[next._other]._field));
+      break;
+    case op::negate:
+      // holds in any field without the operand
+      _operands.back().clear();
+      break;
+    case op::both: {
+      std::string rhs(std::move(_operands.back()));
+      _operands.pop_back();
+      _operands.back() = both_fields(std::move(_operands.back()), rhs);
+    } break;
+    case op::either: {
+      std::string rhs(std::move(_operands.back()));
+      _operands.pop_back();
+      if (_operands.back() != rhs)
+        _operands.back().clear();
+    } break;
+    }
+    if (_operands.size() > MaxDepth)
+      fail("more than " + std::to_string(MaxDepth) + " operands pending");
+    _target._program.push_back(next);
+  }
+  // a candidate is one field, so AND and NEAR across two never match
+  std::string both_fields(std::string lhs, std::string const &rhs) const {
+    if (!lhs.empty() && !rhs.empty() && lhs != rhs)
+      fail("terms in " + lhs + " and " + rhs + " are never in one field");
+    return lhs.empty() ? rhs : lhs;
+  }
+  [[noreturn]] void fail(std::string const &reason) const {
+    throw std::invalid_argument("Bad rule expression, " + reason + ": " +
+                                std::string(_source));
+  }
+
+  rule_expression &_target;
+  std::string_view _source;
+  size_t _offset = 0;
+  size_t _nesting = 0;
+  std::vector<std::string> _operands;
+};
+
+rule_expression::rule_expression(std::string_view source) {
+  parser(*this, source).parse();
+  // only candidates containing a leaf are evaluated
+  if (evaluate(0, [](size_t, size_t, uint16_t) { return false; }))
+    throw std::invalid_argument(
+        "Bad rule expression, matches without any terms: " +
+        std::string(source));
+}
+
+bool rule_expression::field_matches(const size_t index,
+                                    std::string_view field) const {
+  std::string_view wanted(_leaves[index]._field);
+  if (wanted.empty())
+    return true;
+  const size_t slash(field.rfind('/'));
+  std::string_view last(slash == std::string_view::npos
+                            ? field
+                            : field.substr(slash + 1));
+  if (std::ranges::find(LinkFields, field) != std::end(LinkFields))
+    last = "uri";
+  return last.length() == wanted.length() &&
+         std::ranges::equal(last, wanted, [](const char lhs, const char rhs) {
+           return std::tolower(static_cast<unsigned char>(lhs)) == rhs;
+         });
+}
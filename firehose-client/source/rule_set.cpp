@@ -0,0 +1,808 @@
+/*************************************************************************
+Public Education Forum Moderation Firehose Client
+Copyright (c) Steve Townsend 2024
+
+>>> SOURCE LICENSE >>>
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation (www.fsf.org); either version 3 of the
+License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+A copy of the GNU General Public License is available at
+http://www.fsf.org/licensing/licenses
+>>> END OF LICENSE >>>
+*************************************************************************/
+
+#include "matcher.hpp"
+#include "case_folding.hpp"
+#include "common/log_wrapper.hpp"
+#include "json_scanner.hpp"
+#include "moderation/list_manager.hpp"
+#include "word_breaks.hpp"
+#include <algorithm>
+#include <boost/interprocess/file_mapping.hpp>
+#include <cctype>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <ranges>
+#include <string_view>
+
+matcher::rule::rule(std::string const &rule_string) {
+  size_t count = 0;
+  if (rule_string.empty() || rule_string[0] == '|')
+    throw std::invalid_argument("Malformed rule, missing filter string " +
+                                rule_string);
+  for (const auto token : std::views::split(rule_string, '|')) {
+    // with string_view's C++23 range constructor:
+    std::string_view field(token);
+    switch (count) {
+    case 0:
+      if (field.empty())
+        throw std::invalid_argument("Blank target in filter rule " +
+                                    rule_string);
+      _target = field;
+      break;
+    case 1:
+      if (field.empty())
+        throw std::invalid_argument("Blank labels in filter rule " +
+                                    rule_string);
+      for (const auto subtoken : std::views::split(std::string(field), ',')) {
+        _labels.push_back(std::string(subtoken.cbegin(), subtoken.cend()));
+      }
+      break;
+    case 2:
+      store_actions(field);
+      break;
+    case 3:
+      if (field.empty())
+        continue;
+      store_contingent(field);
+      break;
+    default:
+      throw std::invalid_argument("More than " + std::to_string(field_count) +
+                                  " fields in filter rule " + rule_string);
+      break;
+    }
+    ++count;
+  }
+  // final field, contingent strings to match, is currently optional
+  if (count < field_count - 1)
+    throw std::invalid_argument("Less than " + std::to_string(field_count) +
+                                " fields in filter rule " + rule_string);
+  if (_match_type == match_type::expression)
+    _expression = rule_expression(_target);
+}
+
+matcher::rule::rule(std::string const &filter, std::string const &labels,
+                    std::string const &actions, std::string const &contingent) {
+  if (filter.empty())
+    throw std::invalid_argument("Blank filter");
+  _target = filter;
+  if (labels.empty())
+    throw std::invalid_argument("Blank labels");
+  for (const auto subtoken : std::views::split(std::string(labels), ',')) {
+    _labels.push_back(std::string(subtoken.cbegin(), subtoken.cend()));
+  }
+  store_actions(actions);
+  if (_match_type == match_type::expression)
+    _expression = rule_expression(_target);
+  if (contingent.empty())
+    return;
+  store_contingent(contingent);
+}
+
+void matcher::rule::store_actions(std::string_view actions) {
+  _raw_actions = actions;
+  // with string_view's C++23 range constructor:
+  for (const auto token : std::views::split(actions, ',')) {
+    std::string field(token.cbegin(), token.cend());
+    size_t offset(field.find('='));
+    if (offset == std::string::npos || offset == 0) {
+      throw std::invalid_argument("Invalid rule action " + field +
+                                  ", malformed key-value pair");
+    }
+    std::string value(field, offset + 1);
+    if (offset == std::string::npos) {
+      throw std::invalid_argument("Invalid rule action " + field +
+                                  ", blank value");
+    }
+    if (starts_with(field, "track=")) {
+      _track = bool_from_string(value);
+      continue;
+    }
+    if (starts_with(field, "report=")) {
+      _report = bool_from_string(value);
+      continue;
+    }
+    if (starts_with(field, "label=")) {
+      _label = bool_from_string(value);
+      continue;
+    }
+    if (starts_with(field, "scope=")) {
+      _content_scope = content_scope_from_string(value);
+      continue;
+    }
+    if (starts_with(field, "match=")) {
+      _match_type = match_type_from_string(value);
+      continue;
+    }
+    if (starts_with(field, "block=")) {
+      if (!list_manager::is_active_list_for_group(value)) {
+        throw std::invalid_argument(
+            "Invalid rule action " + field +
+            ", hyphen not permitted in list-troup name");
+      }
+      _block_list_name = value;
+      continue;
+    }
+    throw std::invalid_argument("Invalid rule action " + field +
+                                ", invalid key");
+  }
+}
+
+// contingent strings confirm the context of a match
+void matcher::rule::store_contingent(std::string_view contingent) {
+  _contingent = contingent;
+  for (const auto subtoken : std::views::split(contingent, ',')) {
+    std::string_view next(subtoken);
+    if (next.starts_with('!')) {
+      _forbidden.emplace_back(next.substr(1));
+    } else {
+      _required.emplace_back(next);
+    }
+  }
+}
+
+std::string match_result::matched_filters() const {
+  std::ostringstream oss;
+  bool first(true);
+  for (auto const id : _matches) {
+    if (!first)
+      oss << ',';
+    else
+      first = false;
+    oss << '\'' << _rules->at(id)._keyword << '\'';
+  }
+  return oss.str();
+}
+
+bool rule_set::insert(matcher::rule &&new_rule) {
+  // Check for intentionally-skipped rule
+  if (!new_rule._track) {
+    REL_WARNING("Skipped rule '{}'", new_rule.to_string());
+    return false;
+  }
+  const bool is_regex(new_rule._match_type ==
+                      matcher::rule::match_type::regex);
+  // case-folded for multilanguage support. A regex is left as written and
+  // matched case-insensitively.
+  std::string canonical_form(is_regex
+                                 ? new_rule._target
+                                 : case_folding::folded(new_rule._target));
+  // a mention is looked up as the handle
+  if (new_rule._match_type == matcher::rule::match_type::exact &&
+      canonical_form.starts_with('@'))
+    canonical_form.erase(0, 1);
+  if (canonical_form.empty()) {
+    REL_WARNING("Rule has no canonical form '{}'", new_rule.to_string());
+    return false;
+  }
+  const rule_id local_id(static_cast<rule_id>(_rules.size()));
+  if (is_duplicate(canonical_form)) {
+    // first one wins, as for the lookup by keyword this replaces
+    REL_WARNING("Duplicate rule '{}'", new_rule.to_string());
+    return true;
+  }
+  partition &target(partition_for(new_rule._content_scope));
+  if (is_regex) {
+    std::string error;
+    if (target._regexes.add(canonical_form, error) == regex_set::NoPattern) {
+      REL_WARNING("Rejected regex rule '{}': {}", new_rule.to_string(), error);
+      return false;
+    }
+    target._regex_rules.push_back(local_id);
+  } else if (new_rule._match_type == matcher::rule::match_type::exact) {
+    target._exact.add(canonical_form);
+    target._exact_rules.push_back(local_id);
+  } else if (new_rule._match_type ==
+             matcher::rule::match_type::expression) {
+    auto const &leaves(new_rule._expression.leaves());
+    for (size_t leaf = 0; leaf < leaves.size(); ++leaf) {
+      add_pattern(target, case_folding::folded(leaves[leaf]._text), local_id,
+                  role::leaf, static_cast<uint8_t>(leaf));
+    }
+  } else {
+    add_pattern(target, canonical_form, local_id,
+                new_rule._match_type == matcher::rule::match_type::whole_word
+                    ? role::whole_word
+                    : role::substring);
+  }
+  _ids.insert({canonical_form, local_id});
+  _sources.insert({new_rule.to_string(), local_id});
+  for (auto const &required : new_rule._required) {
+    add_pattern(target, case_folding::folded(required), local_id,
+                role::required);
+  }
+  for (auto const &forbidden : new_rule._forbidden) {
+    add_pattern(target, case_folding::folded(forbidden), local_id,
+                role::forbidden);
+  }
+  new_rule._keyword = canonical_form;
+  REL_INFO("Stored rule '{}'", new_rule.to_string());
+  _rules.push_back(std::move(new_rule));
+  return true;
+}
+
+void rule_set::add_pattern(partition &target, std::string const &canonical,
+                           const rule_id id, const role use,
+                           const uint8_t leaf) {
+  // already compiled into the mapped file
+  if (_compiled)
+    return;
+  const utf8_automaton::pattern_id pattern(target._automaton.add(canonical));
+  if (pattern == utf8_automaton::NoPattern)
+    return;
+  if (pattern == target._uses.size())
+    target._uses.emplace_back();
+  target._uses[pattern].push_back({id, use, leaf});
+}
+
+void rule_set::compile() {
+  size_t patterns(0);
+  size_t states(0);
+  size_t regexes(0);
+  size_t exact(0);
+  for (auto &next : _partitions) {
+    if (!_compiled) {
+      next._automaton.compile();
+      next._use_offsets.clear();
+      next._use_list.clear();
+      next._use_offsets.reserve(next._uses.size() + 1);
+      for (auto const &uses : next._uses) {
+        next._use_offsets.push_back(
+            static_cast<uint32_t>(next._use_list.size()));
+        next._use_list.insert(next._use_list.end(), uses.cbegin(),
+                              uses.cend());
+      }
+      next._use_offsets.push_back(static_cast<uint32_t>(next._use_list.size()));
+      next._uses.clear();
+      next._uses.shrink_to_fit();
+      next._use_offset_table = next._use_offsets;
+      next._use_table = next._use_list;
+    }
+    next._regexes.compile();
+    next._exact.compile();
+    patterns += next._automaton.pattern_count();
+    states += next._automaton.state_count();
+    regexes += next._regexes.pattern_count();
+    exact += next._exact.size();
+  }
+  REL_INFO("Compiled {} rules, {} patterns, {} states, {} regexes, {} exact "
+           "tokens{}{}",
+           _rules.size(), patterns, states, regexes, exact,
+           _base ? ", as overlay" : "", _compiled ? ", from file" : "");
+}
+
+// Layout: compiled_header, then for each content scope the automaton image
+// and its use offsets and use list, each padded to 8 bytes
+bool rule_set::load_compiled(std::filesystem::path const &path,
+                             const uint64_t key) {
+  std::error_code error;
+  const auto size(std::filesystem::file_size(path, error));
+  if (error || size < sizeof(compiled_header)) {
+    REL_INFO("No compiled rules in {}", path.string());
+    return false;
+  }
+  try {
+    boost::interprocess::file_mapping mapping(path.string().c_str(),
+                                              boost::interprocess::read_only);
+    _compiled = std::make_unique<boost::interprocess::mapped_region>(
+        mapping, boost::interprocess::read_only);
+  } catch (std::exception const &exc) {
+    REL_WARNING("Cannot map compiled rules {}: {}", path.string(), exc.what());
+    return false;
+  }
+  const char *base(static_cast<const char *>(_compiled->get_address()));
+  const size_t mapped(_compiled->get_size());
+  compiled_header header;
+  std::memcpy(&header, base, sizeof(header));
+  if (std::memcmp(header._magic, Magic, sizeof(Magic)) != 0 ||
+      header._version != Version || header._key != key) {
+    REL_INFO("Compiled rules {} are stale", path.string());
+    _compiled.reset();
+    return false;
+  }
+  size_t offset(sizeof(header));
+  for (size_t scope = 0; scope < ScopeCount; ++scope) {
+    partition &next(_partitions[scope]);
+    const size_t automaton_size(header._automaton_size[scope]);
+    if (automaton_size > mapped - offset ||
+        !next._automaton.load_image({base + offset, automaton_size})) {
+      REL_WARNING("Compiled rules {} are invalid", path.string());
+      _compiled.reset();
+      return false;
+    }
+    offset += automaton_size;
+    const size_t offsets_bytes((next._automaton.pattern_count() + 1) *
+                               sizeof(uint32_t));
+    const size_t list_offset(offset + ((offsets_bytes + 7) & ~size_t(7)));
+    const size_t list_bytes(header._use_count[scope] * sizeof(pattern_use));
+    if (list_offset + list_bytes > mapped) {
+      REL_WARNING("Compiled rules {} are truncated", path.string());
+      _compiled.reset();
+      return false;
+    }
+    next._use_offset_table = {
+        reinterpret_cast<uint32_t const *>(base + offset),
+        next._automaton.pattern_count() + 1};
+    next._use_table = {
+        reinterpret_cast<pattern_use const *>(base + list_offset),
+        static_cast<size_t>(header._use_count[scope])};
+    offset = list_offset + ((list_bytes + 7) & ~size_t(7));
+  }
+  _compiled_rule_count = header._rule_count;
+  REL_INFO("Mapped compiled rules {}, {} bytes", path.string(), mapped);
+  return true;
+}
+
+// every use must index an inserted rule, in bounds of the use list
+bool rule_set::matches_compiled() const {
+  if (!_compiled)
+    return true;
+  if (_compiled_rule_count != _rules.size())
+    return false;
+  for (auto const &next : _partitions) {
+    auto const &offsets(next._use_offset_table);
+    if (offsets.back() != next._use_table.size())
+      return false;
+    for (size_t pattern = 0; pattern + 1 < offsets.size(); ++pattern) {
+      if (offsets[pattern] > offsets[pattern + 1])
+        return false;
+    }
+    if (!std::ranges::all_of(next._use_table, [&](pattern_use const &use) {
+          return use._rule < _rules.size() && use._role <= role::leaf &&
+                 (use._role != role::leaf ||
+                  use._leaf < _rules[use._rule]._expression.leaves().size());
+        }))
+      return false;
+  }
+  return true;
+}
+
+// written aside and renamed, so a reader never maps a partial file
+void rule_set::save_compiled(std::filesystem::path const &path,
+                             const uint64_t key) const {
+  static constexpr char Padding[8] = {};
+  auto write_padded([](std::ofstream &output, void const *data,
+                       const size_t bytes) {
+    output.write(static_cast<const char *>(data),
+                 static_cast<std::streamsize>(bytes));
+    output.write(Padding,
+                 static_cast<std::streamsize>(((bytes + 7) & ~size_t(7)) -
+                                              bytes));
+  });
+  std::filesystem::path temporary(path);
+  temporary += ".tmp";
+  {
+    std::ofstream output(temporary, std::ios::binary | std::ios::trunc);
+    compiled_header header{};
+    std::memcpy(header._magic, Magic, sizeof(Magic));
+    header._version = Version;
+    header._key = key;
+    header._rule_count = _rules.size();
+    for (size_t scope = 0; scope < ScopeCount; ++scope) {
+      header._automaton_size[scope] =
+          _partitions[scope]._automaton.image_size();
+      header._use_count[scope] = _partitions[scope]._use_table.size();
+    }
+    output.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    for (auto const &next : _partitions) {
+      next._automaton.write_image(output);
+      write_padded(output, next._use_offset_table.data(),
+                   next._use_offset_table.size_bytes());
+      write_padded(output, next._use_table.data(),
+                   next._use_table.size_bytes());
+    }
+    if (!output) {
+      REL_WARNING("Cannot write compiled rules {}", temporary.string());
+      return;
+    }
+  }
+  std::error_code error;
+  std::filesystem::rename(temporary, path, error);
+  if (error) {
+    REL_WARNING("Cannot replace compiled rules {}: {}", path.string(),
+                error.message());
+    return;
+  }
+  REL_INFO("Saved compiled rules {}", path.string());
+}
+
+rule_set::rule_set(std::shared_ptr<const rule_set> base,
+                   std::vector<bool> &&removed)
+    : _base(std::move(base)), _removed(std::move(removed)),
+      _first_id(static_cast<rule_id>(_base->size())) {}
+
+std::optional<rule_id> rule_set::find(std::string const &source) const {
+  auto const found(_sources.find(source));
+  if (found != _sources.cend())
+    return _first_id + found->second;
+  return std::nullopt;
+}
+
+size_t rule_set::fingerprint(std::vector<matcher::rule> const &rules) {
+  std::vector<std::string> ordered;
+  ordered.reserve(rules.size());
+  for (auto const &next : rules) {
+    ordered.push_back(next.to_string());
+  }
+  std::sort(ordered.begin(), ordered.end());
+  std::string all_sources;
+  for (auto const &source : ordered) {
+    all_sources.append(source).push_back('\n');
+  }
+  return std::hash<std::string>()(all_sources);
+}
+
+std::unique_ptr<rule_set>
+rule_set::overlay_for(std::shared_ptr<const rule_set> current,
+                      std::vector<matcher::rule> &replacement) {
+  // diff against the compiled rules under any overlay
+  std::shared_ptr<const rule_set> base(std::move(current));
+  if (base->base())
+    base = base->base();
+  std::vector<bool> removed(base->size(), true);
+  std::vector<size_t> added;
+  for (size_t index = 0; index < replacement.size(); ++index) {
+    // untracked rules are never stored
+    if (!replacement[index]._track)
+      continue;
+    auto const existing(base->find(replacement[index].to_string()));
+    if (existing.has_value()) {
+      removed[existing.value()] = false;
+    } else {
+      added.push_back(index);
+    }
+  }
+  const size_t removed_count(
+      std::count(removed.cbegin(), removed.cend(), true));
+  if (base->size() == 0 ||
+      (added.size() + removed_count) * OverlayFraction > base->size()) {
+    REL_INFO("Rebuilding rules, {} added, {} removed", added.size(),
+             removed_count);
+    return nullptr;
+  }
+  REL_INFO("Overlaying rules, {} added, {} removed", added.size(),
+           removed_count);
+  auto overlay(std::make_unique<rule_set>(base, std::move(removed)));
+  for (auto const index : added) {
+    overlay->insert(std::move(replacement[index]));
+  }
+  overlay->compile();
+  return overlay;
+}
+
+// a base rule still in use keeps its target
+bool rule_set::is_duplicate(std::string const &canonical) const {
+  if (_ids.contains(canonical))
+    return true;
+  if (!_base)
+    return false;
+  auto const in_base(_base->_ids.find(canonical));
+  return in_base != _base->_ids.cend() && !_removed[in_base->second];
+}
+
+namespace {
+inline bool is_space(const char next) {
+  return next == ' ' || next == '\t' || next == '\n' || next == '\r';
+}
+// hashtags run to ASCII punctuation or space, any other UTF-8 is kept
+inline bool is_tag_byte(const char next) {
+  return static_cast<unsigned char>(next) >= 0x80 ||
+         std::isalnum(static_cast<unsigned char>(next)) || next == '_';
+}
+inline bool is_handle_byte(const char next) {
+  return std::isalnum(static_cast<unsigned char>(next)) || next == '.' ||
+         next == '-';
+}
+inline std::string_view without_trailing_dots(std::string_view token) {
+  while (token.ends_with('.'))
+    token.remove_suffix(1);
+  return token;
+}
+
+// Tokens of folded text for exact rules: the whole text if it is one word,
+// each #hashtag, each @mention as the handle, and the host of each URL
+template <typename Visitor>
+void for_each_token(std::string_view canonical, Visitor &&visit) {
+  const bool one_word(!canonical.empty() &&
+                      std::ranges::none_of(canonical, is_space));
+  if (one_word)
+    visit(canonical);
+  // a word token that is the whole text was visited already
+  auto visit_part([&](std::string_view token) {
+    if (!one_word || token.length() != canonical.length())
+      visit(token);
+  });
+  for (size_t offset = 0; offset < canonical.length(); ++offset) {
+    const char next(canonical[offset]);
+    if ((next == '#' || next == '@') &&
+        (offset == 0 || !is_tag_byte(canonical[offset - 1]))) {
+      size_t end(offset + 1);
+      while (end < canonical.length() &&
+             (next == '#' ? is_tag_byte(canonical[end])
+                          : is_handle_byte(canonical[end])))
+        ++end;
+      std::string_view token(canonical.substr(offset, end - offset));
+      if (next == '@')
+        token = without_trailing_dots(token.substr(1));
+      if (token.length() > 1 || (next == '@' && !token.empty()))
+        visit_part(token);
+      offset = end - 1;
+    } else if (next == ':' && canonical.substr(offset, 3) == "://") {
+      size_t end(offset + 3);
+      while (end < canonical.length() && !is_space(canonical[end]) &&
+             canonical[end] != '/' && canonical[end] != '?' &&
+             canonical[end] != '#' && canonical[end] != ':')
+        ++end;
+      std::string_view host(
+          without_trailing_dots(canonical.substr(offset + 3, end - offset - 3)));
+      if (!host.empty())
+        visit_part(host);
+      offset = end - 1;
+    }
+  }
+}
+} // namespace
+
+template <typename Visitor>
+void rule_set::find_exact(partition const &target, std::string_view canonical,
+                          std::vector<bool> const *hidden,
+                          Visitor &&visit) const {
+  if (target._exact.empty())
+    return;
+  // record fields arrive serialized as JSON strings, tokens are their content
+  thread_local std::string unquoted;
+  if (canonical.starts_with('"') &&
+      json_scanner::string_value(canonical, unquoted))
+    canonical = unquoted;
+  for_each_token(canonical, [&](std::string_view token) {
+    const exact_set::key_id key(target._exact.find(token));
+    if (key != exact_set::NoKey &&
+        (!hidden || !(*hidden)[target._exact_rules[key]]))
+      visit(target._exact_rules[key]);
+  });
+}
+
+static_assert(rule_expression::LinkFields[0] == bsky::AppBskyRichtextFacetLink);
+
+rule_set::content_scope rule_set::scope_of(candidate const &target) {
+  if (target._type == bsky::AppBskyActorProfile)
+    return content_scope::profile;
+  if (target._field == "/embed/external/uri" ||
+      std::ranges::find(rule_expression::LinkFields, target._field) !=
+          std::end(rule_expression::LinkFields))
+    return content_scope::link;
+  return content_scope::any;
+}
+
+bool rule_set::matches_any_substring(std::string_view canonical,
+                                     const content_scope scope) const {
+  return (_base && _base->any_substring(canonical, scope, &_removed)) ||
+         any_substring(canonical, scope, nullptr);
+}
+
+bool rule_set::any_substring(std::string_view canonical,
+                             const content_scope scope,
+                             std::vector<bool> const *hidden) const {
+  bool found(false);
+  for (auto const applies : {content_scope::any, scope}) {
+    partition const &next(partition_for(applies));
+    next._automaton.scan(canonical, [&](utf8_automaton::pattern_id const
+                                            pattern,
+                                        size_t const) {
+      for (auto const &use : next.uses_of(pattern)) {
+        if (use._role == role::substring &&
+            (!hidden || !(*hidden)[use._rule])) {
+          found = true;
+          break;
+        }
+      }
+      return !found;
+    });
+    if (!found) {
+      find_exact(next, canonical, hidden, [&](rule_id const) { found = true; });
+    }
+    if (!found && !next._regexes.empty()) {
+      thread_local std::vector<int> regex_hits;
+      next._regexes.scan(canonical, regex_hits);
+      for (auto const pattern : regex_hits) {
+        if (!hidden || !(*hidden)[next._regex_rules[pattern]]) {
+          found = true;
+          break;
+        }
+      }
+    }
+    if (found || scope == content_scope::any)
+      break;
+  }
+  return found;
+}
+
+namespace {
+// Per-thread flags of contingent strings seen in the current candidate,
+// reset after each scan through the list of rules touched
+constexpr uint8_t RequiredSeen = 1;
+constexpr uint8_t ForbiddenSeen = 2;
+struct contingent_scratch {
+  std::vector<uint8_t> _seen;
+  std::vector<rule_id> _touched;
+};
+
+// Per-thread leaves of rule expressions seen in the current candidate, one
+// bit per leaf, and where they were seen if the rule needs proximity
+struct expression_scratch {
+  struct position {
+    rule_id _rule;
+    uint8_t _leaf;
+    size_t _offset;
+  };
+  std::vector<uint64_t> _seen;
+  std::vector<rule_id> _touched;
+  std::vector<position> _positions;
+  // byte offset of each word of the candidate, built on demand
+  std::vector<size_t> _word_starts;
+
+  size_t word_of(std::string_view canonical, const size_t offset) {
+    if (_word_starts.empty()) {
+      for (size_t next = 0; next < canonical.length(); ++next) {
+        if (!is_space(canonical[next]) &&
+            (next == 0 || is_space(canonical[next - 1])))
+          _word_starts.push_back(next);
+      }
+      // a text of only spaces still has somewhere to count from
+      _word_starts.push_back(canonical.length());
+    }
+    return std::upper_bound(_word_starts.cbegin(), _word_starts.cend(),
+                            offset) -
+           _word_starts.cbegin();
+  }
+  // any occurrences of the two leaves of the rule within distance words
+  bool within(std::string_view canonical, const rule_id id,
+              const size_t first, const size_t second,
+              const uint16_t distance) {
+    for (auto const &lhs : _positions) {
+      if (lhs._rule != id || lhs._leaf != first)
+        continue;
+      const size_t lhs_word(word_of(canonical, lhs._offset));
+      for (auto const &rhs : _positions) {
+        if (rhs._rule != id || rhs._leaf != second)
+          continue;
+        const size_t rhs_word(word_of(canonical, rhs._offset));
+        if ((lhs_word > rhs_word ? lhs_word - rhs_word : rhs_word - lhs_word) <=
+            distance)
+          return true;
+      }
+    }
+    return false;
+  }
+  void clear() {
+    _touched.clear();
+    _positions.clear();
+    _word_starts.clear();
+  }
+};
+} // namespace
+
+void rule_set::scan(std::string_view canonical, const content_scope scope,
+                    std::string_view field, std::vector<rule_id> &hits) const {
+  if (_base)
+    _base->scan_layer(canonical, scope, field, hits, &_removed);
+  scan_layer(canonical, scope, field, hits, nullptr);
+}
+
+void rule_set::scan_layer(std::string_view canonical,
+                          const content_scope scope, std::string_view field,
+                          std::vector<rule_id> &hits,
+                          std::vector<bool> const *hidden) const {
+  thread_local contingent_scratch scratch;
+  thread_local expression_scratch expressions;
+  thread_local word_breaks words;
+  words.reset(canonical);
+  if (scratch._seen.size() < _rules.size())
+    scratch._seen.resize(_rules.size());
+  if (expressions._seen.size() < _rules.size())
+    expressions._seen.resize(_rules.size());
+  const size_t first_hit(hits.size());
+  // a rule's target and contingent strings are all in its scope's partition
+  for (auto const applies : {content_scope::any, scope}) {
+    partition const &next(partition_for(applies));
+    next._automaton.scan(canonical, [&](utf8_automaton::pattern_id const
+                                            pattern,
+                                        size_t const end) {
+      for (auto const &use : next.uses_of(pattern)) {
+        if (hidden && (*hidden)[use._rule])
+          continue;
+        switch (use._role) {
+        case role::substring:
+          hits.push_back(use._rule);
+          break;
+        case role::whole_word: {
+          const size_t start(end - next._automaton.pattern_length(pattern));
+          if (words.is_whole_word(start, end))
+            hits.push_back(use._rule);
+        } break;
+        case role::required:
+        case role::forbidden:
+          if (scratch._seen[use._rule] == 0)
+            scratch._touched.push_back(use._rule);
+          scratch._seen[use._rule] |=
+              use._role == role::required ? RequiredSeen : ForbiddenSeen;
+          break;
+        case role::leaf: {
+          rule_expression const &expression(_rules[use._rule]._expression);
+          if (!expression.field_matches(use._leaf, field))
+            break;
+          if (expressions._seen[use._rule] == 0)
+            expressions._touched.push_back(use._rule);
+          expressions._seen[use._rule] |= uint64_t(1) << use._leaf;
+          if (expression.has_proximity()) {
+            expressions._positions.push_back(
+                {use._rule, use._leaf,
+                 end - next._automaton.pattern_length(pattern)});
+          }
+        } break;
+        }
+      }
+      return true;
+    });
+    if (!next._regexes.empty()) {
+      thread_local std::vector<int> regex_hits;
+      next._regexes.scan(canonical, regex_hits);
+      for (auto const pattern : regex_hits) {
+        if (!hidden || !(*hidden)[next._regex_rules[pattern]])
+          hits.push_back(next._regex_rules[pattern]);
+      }
+    }
+    find_exact(next, canonical, hidden,
+               [&](rule_id const id) { hits.push_back(id); });
+    if (scope == content_scope::any)
+      break;
+  }
+  for (auto const id : expressions._touched) {
+    if (_rules[id]._expression.evaluate(
+            expressions._seen[id],
+            [&](const size_t first, const size_t second,
+                const uint16_t distance) {
+              return expressions.within(canonical, id, first, second,
+                                        distance);
+            }))
+      hits.push_back(id);
+    expressions._seen[id] = 0;
+  }
+  expressions.clear();
+
+  // strip out matches which do not pass contingent string matching in rule
+  hits.erase(std::remove_if(hits.begin() + first_hit, hits.end(),
+                            [&](rule_id const id) {
+                              return !_rules[id]._contingent.empty() &&
+                                     scratch._seen[id] != RequiredSeen;
+                            }),
+             hits.end());
+  for (auto const id : scratch._touched) {
+    scratch._seen[id] = 0;
+  }
+  scratch._touched.clear();
+  // overlay rules follow on from the base
+  if (_first_id > 0) {
+    for (auto hit(hits.begin() + first_hit); hit != hits.end(); ++hit) {
+      *hit += _first_id;
+    }
+  }
+}
@@ -0,0 +1,60 @@
+/*************************************************************************
+Public Education Forum Moderation Firehose Client
+Copyright (c) Steve Townsend 2025
+
+>>> SOURCE LICENSE >>>
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation (www.fsf.org); either version 3 of the
+License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+A copy of the GNU General Public License is available at
+http://www.fsf.org/licensing/licenses
+>>> END OF LICENSE >>>
+*************************************************************************/
+
+#include "scan_cache.hpp"
+#include <functional>
+
+void scan_cache::set_capacity(const size_t capacity) {
+  _slots_per_shard = (capacity + ShardCount - 1) / ShardCount;
+  for (auto &next : _shards) {
+    next._slots.clear();
+    next._slots.resize(_slots_per_shard);
+  }
+}
+
+uint64_t scan_cache::hash(std::string_view text) {
+  return static_cast<uint64_t>(std::hash<std::string_view>()(text));
+}
+
+bool scan_cache::find(std::string_view text, std::string_view field,
+                      const uint64_t text_hash, const uint64_t version,
+                      std::vector<uint32_t> &hits) const {
+  shard &target(shard_for(text_hash));
+  std::lock_guard guard(target._lock);
+  entry const &slot(target._slots[slot_for(text_hash)]);
+  if (slot._version != version || slot._hash != text_hash ||
+      slot._text != text || slot._field != field)
+    return false;
+  hits = slot._hits;
+  return true;
+}
+
+void scan_cache::store(std::string_view text, std::string_view field,
+                       const uint64_t text_hash, const uint64_t version,
+                       std::vector<uint32_t> const &hits) {
+  shard &target(shard_for(text_hash));
+  std::lock_guard guard(target._lock);
+  entry &slot(target._slots[slot_for(text_hash)]);
+  slot._hash = text_hash;
+  slot._text.assign(text);
+  slot._field.assign(field);
+  slot._version = version;
+  slot._hits = hits;
+}
@@ -0,0 +1,112 @@
+/*************************************************************************
+Public Education Forum Moderation Firehose Client
+Copyright (c) Steve Townsend 2025
+
+>>> SOURCE LICENSE >>>
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation (www.fsf.org); either version 3 of the
+License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+A copy of the GNU General Public License is available at
+http://www.fsf.org/licensing/licenses
+>>> END OF LICENSE >>>
+*************************************************************************/
+
+#include "word_breaks.hpp"
+#include "case_folding.hpp"
+#include "common/log_wrapper.hpp"
+#include <algorithm>
+#include <cctype>
+#include <unicode/uchar.h>
+#include <unicode/uscript.h>
+#include <unicode/utext.h>
+
+namespace {
+inline bool is_word_character(char32_t const code_point) {
+  return code_point < 0x80 ? std::isalpha(static_cast<int>(code_point)) != 0
+                           : u_isalpha(static_cast<UChar32>(code_point));
+}
+
+// scripts written without spaces, where only a dictionary finds the words
+inline bool needs_dictionary(char32_t const code_point) {
+  // Thai is the first of them
+  if (code_point < 0x0E00) {
+    return false;
+  }
+  const UChar32 next(static_cast<UChar32>(code_point));
+  // script extensions cover marks shared by several, such as the Japanese
+  // prolonged sound mark
+  return uscript_hasScript(next, USCRIPT_HAN) ||
+         uscript_hasScript(next, USCRIPT_HIRAGANA) ||
+         uscript_hasScript(next, USCRIPT_KATAKANA) ||
+         uscript_hasScript(next, USCRIPT_THAI) ||
+         uscript_hasScript(next, USCRIPT_LAO) ||
+         uscript_hasScript(next, USCRIPT_KHMER) ||
+         uscript_hasScript(next, USCRIPT_MYANMAR);
+}
+} // namespace
+
+void word_breaks::reset(std::string_view text) {
+  _text = text;
+  _segmentation = segmentation::pending;
+}
+
+bool word_breaks::is_whole_word(const size_t start, const size_t end) {
+  return (start == 0 ||
+          is_edge(start, case_folding::code_point_before(_text, start),
+                  case_folding::code_point_at(_text, start))) &&
+         (end == _text.length() ||
+          is_edge(end, case_folding::code_point_at(_text, end),
+                  case_folding::code_point_before(_text, end)));
+}
+
+bool word_breaks::is_edge(const size_t offset, char32_t const outside,
+                          char32_t const inside) {
+  if (needs_dictionary(outside) || needs_dictionary(inside)) {
+    if (_segmentation == segmentation::pending) {
+      _segmentation = segment() ? segmentation::done : segmentation::failed;
+    }
+    if (_segmentation == segmentation::done) {
+      return std::binary_search(_boundaries.cbegin(), _boundaries.cend(),
+                                static_cast<int32_t>(offset));
+    }
+  }
+  return !is_word_character(outside);
+}
+
+// UTF-8 text is read in place, so boundaries are byte offsets
+bool word_breaks::segment() {
+  UErrorCode status(U_ZERO_ERROR);
+  if (!_iterator) {
+    _iterator.reset(
+        icu::BreakIterator::createWordInstance(icu::Locale::getRoot(), status));
+    if (U_FAILURE(status)) {
+      REL_ERROR("word_breaks: no ICU word break iterator, {}",
+                u_errorName(status));
+      _iterator.reset();
+      return false;
+    }
+  }
+  UText text = UTEXT_INITIALIZER;
+  utext_openUTF8(&text, _text.data(), static_cast<int64_t>(_text.length()),
+                 &status);
+  // the iterator keeps a shallow clone of text
+  _iterator->setText(&text, status);
+  utext_close(&text);
+  if (U_FAILURE(status)) {
+    REL_ERROR("word_breaks: cannot segment text, {}", u_errorName(status));
+    return false;
+  }
+  _boundaries.clear();
+  for (int32_t next = _iterator->first(); next != icu::BreakIterator::DONE;
+       next = _iterator->next()) {
+    _boundaries.push_back(next);
+  }
+  return true;
+}
@@ -0,0 +1,200 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <cstring>
+#include <random>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "automaton.hpp"
+
+namespace {
+typedef std::vector<std::pair<wautomaton::pattern_id, size_t>> hit_list;
+
+hit_list all_hits(wautomaton const &automaton, std::wstring_view text) {
+  hit_list hits;
+  automaton.scan(text, [&](wautomaton::pattern_id const id, size_t const end) {
+    hits.emplace_back(id, end);
+    return true;
+  });
+  return hits;
+}
+} // namespace
+
+TEST(AutomatonTest, OverlappingPatterns) {
+  wautomaton automaton;
+  const auto he(automaton.add(L"he"));
+  const auto she(automaton.add(L"she"));
+  const auto his(automaton.add(L"his"));
+  const auto hers(automaton.add(L"hers"));
+  automaton.compile();
+  EXPECT_EQ(automaton.pattern_count(), 4);
+  EXPECT_EQ(automaton.pattern_length(hers), 4);
+  EXPECT_THAT(all_hits(automaton, L"ushers"),
+              ::testing::UnorderedElementsAre(std::make_pair(she, 4),
+                                              std::make_pair(he, 4),
+                                              std::make_pair(hers, 6)));
+  EXPECT_THAT(all_hits(automaton, L"this"),
+              ::testing::ElementsAre(std::make_pair(his, 4)));
+  EXPECT_TRUE(all_hits(automaton, L"xyz").empty());
+}
+
+TEST(AutomatonTest, DuplicateAndEmptyPatterns) {
+  wautomaton automaton;
+  const auto first(automaton.add(L"abc"));
+  EXPECT_EQ(automaton.add(L"abc"), first);
+  EXPECT_EQ(automaton.add(L""), wautomaton::NoPattern);
+  automaton.compile();
+  EXPECT_EQ(automaton.pattern_count(), 1);
+  EXPECT_THAT(all_hits(automaton, L"abcabc"),
+              ::testing::ElementsAre(std::make_pair(first, 3),
+                                     std::make_pair(first, 6)));
+}
+
+TEST(AutomatonTest, StopsEarly) {
+  wautomaton automaton;
+  automaton.add(L"a");
+  automaton.compile();
+  size_t count(0);
+  automaton.scan(L"aaaa", [&](wautomaton::pattern_id, size_t) {
+    return ++count < 2;
+  });
+  EXPECT_EQ(count, 2);
+}
+
+TEST(AutomatonTest, NonAscii) {
+  wautomaton automaton;
+  const auto word(automaton.add(L"été"));
+  const auto cjk(automaton.add(L"東京"));
+  automaton.compile();
+  EXPECT_THAT(all_hits(automaton, L"l'été 東京都"),
+              ::testing::ElementsAre(std::make_pair(word, 5),
+                                     std::make_pair(cjk, 8)));
+}
+
+TEST(AutomatonTest, LoadImage) {
+  utf8_automaton compiled;
+  const auto spam(compiled.add("spam"));
+  const auto pam(compiled.add("pam"));
+  const auto city(compiled.add("東京"));
+  compiled.compile();
+  std::ostringstream output;
+  compiled.write_image(output);
+  const std::string written(output.str());
+  EXPECT_EQ(written.length(), compiled.image_size());
+
+  // 8-byte aligned, as for a mapped file
+  std::vector<uint64_t> image((written.length() + 7) / 8);
+  std::memcpy(image.data(), written.data(), written.length());
+  utf8_automaton loaded;
+  ASSERT_TRUE(loaded.load_image(
+      {reinterpret_cast<const char *>(image.data()), written.length()}));
+  EXPECT_EQ(loaded.pattern_count(), 3);
+  EXPECT_EQ(loaded.state_count(), compiled.state_count());
+  EXPECT_EQ(loaded.pattern_length(city), 6);
+  std::vector<std::pair<utf8_automaton::pattern_id, size_t>> hits;
+  loaded.scan("spam from 東京", [&](utf8_automaton::pattern_id const id,
+                                   size_t const end) {
+    hits.emplace_back(id, end);
+    return true;
+  });
+  EXPECT_THAT(hits, ::testing::UnorderedElementsAre(std::make_pair(spam, 4),
+                                                    std::make_pair(pam, 4),
+                                                    std::make_pair(city, 16)));
+
+  utf8_automaton truncated;
+  EXPECT_FALSE(truncated.load_image(
+      {reinterpret_cast<const char *>(image.data()), written.length() / 2}));
+  wautomaton wide;
+  EXPECT_FALSE(wide.load_image(
+      {reinterpret_cast<const char *>(image.data()), written.length()}));
+}
+
+TEST(AutomatonTest, CorruptImage) {
+  utf8_automaton compiled;
+  compiled.add("spam");
+  compiled.add("pam");
+  compiled.add("sp");
+  compiled.add("東京");
+  compiled.compile();
+  std::ostringstream output;
+  compiled.write_image(output);
+  const std::string written(output.str());
+  const std::string text("spam sp pam spa 東京 ssppaamm");
+
+  // any one byte changed is rejected, or still scans within bounds
+  size_t rejected(0);
+  for (size_t offset = 0; offset < written.length(); ++offset) {
+    for (const uint8_t value : {uint8_t(0x01), uint8_t(0xff)}) {
+      std::vector<uint64_t> image((written.length() + 7) / 8);
+      std::memcpy(image.data(), written.data(), written.length());
+      reinterpret_cast<uint8_t *>(image.data())[offset] ^= value;
+      utf8_automaton loaded;
+      if (!loaded.load_image({reinterpret_cast<const char *>(image.data()),
+                              written.length()})) {
+        ++rejected;
+        continue;
+      }
+      loaded.scan(text, [&](utf8_automaton::pattern_id const id,
+                            size_t const end) {
+        EXPECT_LT(id, loaded.pattern_count()) << "at " << offset;
+        if (id < loaded.pattern_count()) {
+          EXPECT_GT(loaded.pattern_length(id), 0) << "at " << offset;
+          EXPECT_LE(loaded.pattern_length(id), end) << "at " << offset;
+        }
+        return true;
+      });
+    }
+  }
+  EXPECT_GT(rejected, 0);
+
+  // an edge to a state past the end
+  std::vector<uint64_t> image((written.length() + 7) / 8);
+  std::memcpy(image.data(), written.data(), written.length());
+  // header, then the root table of 256 states
+  uint32_t *root_table(reinterpret_cast<uint32_t *>(image.data()) + 8);
+  root_table[static_cast<uint8_t>('s')] = 1000;
+  utf8_automaton loaded;
+  EXPECT_FALSE(loaded.load_image(
+      {reinterpret_cast<const char *>(image.data()), written.length()}));
+}
+
+// compare against a brute force search over a small alphabet, which
+// exercises deep failure chains
+TEST(AutomatonTest, MatchesBruteForce) {
+  std::mt19937 random(42);
+  auto random_text = [&](size_t const length) {
+    std::wstring text;
+    for (size_t next = 0; next < length; ++next) {
+      text.push_back(L"abé"[random() % 3]);
+    }
+    return text;
+  };
+  // indexed by pattern ID, duplicates are dropped
+  std::vector<std::wstring> patterns;
+  wautomaton automaton;
+  for (size_t next = 0; next < 50; ++next) {
+    std::wstring pattern(random_text(1 + random() % 5));
+    if (automaton.add(pattern) == patterns.size())
+      patterns.push_back(pattern);
+  }
+  automaton.compile();
+  EXPECT_EQ(automaton.pattern_count(), patterns.size());
+  for (size_t trial = 0; trial < 100; ++trial) {
+    std::wstring text(random_text(random() % 40));
+    hit_list expected;
+    for (size_t end = 1; end <= text.length(); ++end) {
+      for (size_t id = 0; id < patterns.size(); ++id) {
+        auto const &pattern(patterns[id]);
+        if (pattern.length() <= end &&
+            text.compare(end - pattern.length(), pattern.length(), pattern) ==
+                0) {
+          expected.emplace_back(static_cast<wautomaton::pattern_id>(id), end);
+        }
+      }
+    }
+    EXPECT_THAT(all_hits(automaton, text),
+                ::testing::UnorderedElementsAreArray(expected));
+  }
+}
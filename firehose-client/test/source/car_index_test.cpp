@@ -0,0 +1,50 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include "car_index.hpp"
+#include "testdefs.hpp"
+
+namespace {
+std::vector<uint8_t> commit_blocks(nlohmann::json const &commit) {
+  return commit["blocks"]["bytes"].template get<std::vector<uint8_t>>();
+}
+
+// op CIDs carry a leading multibase zero
+std::vector<uint8_t> op_cid(nlohmann::json const &commit) {
+  auto cid(commit["ops"][0]["cid"]["bytes"]
+               .template get<std::vector<uint8_t>>());
+  return {cid.cbegin() + 1, cid.cend()};
+}
+} // namespace
+
+TEST(CarIndexTest, FindsOpRecord) {
+  const auto commit = load_json_from_file("raw_firehose_commit.json");
+  auto blocks(commit_blocks(commit));
+  car_index index(blocks);
+  EXPECT_TRUE(index.is_valid());
+  EXPECT_GT(index.size(), 1);
+
+  auto record(index.find(op_cid(commit)));
+  ASSERT_FALSE(record.empty());
+  auto decoded(nlohmann::json::from_cbor(
+      record.begin(), record.end(), true, true,
+      nlohmann::json::cbor_tag_handler_t::ignore));
+  EXPECT_EQ(decoded["$type"], "app.bsky.graph.follow");
+}
+
+TEST(CarIndexTest, MissingBlock) {
+  const auto commit = load_json_from_file("raw_firehose_commit.json");
+  auto blocks(commit_blocks(commit));
+  car_index index(blocks);
+  auto cid(op_cid(commit));
+  cid.back() ^= 0xff;
+  EXPECT_TRUE(index.find(cid).empty());
+}
+
+TEST(CarIndexTest, Truncated) {
+  const auto commit = load_json_from_file("raw_firehose_commit.json");
+  auto blocks(commit_blocks(commit));
+  blocks.resize(blocks.size() - 1);
+  car_index index(blocks);
+  EXPECT_FALSE(index.is_valid());
+}
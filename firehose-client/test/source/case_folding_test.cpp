@@ -0,0 +1,100 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <random>
+#include <string>
+#include <unicode/uchar.h>
+#include <unicode/ustring.h>
+#include <vector>
+
+#include "case_folding.hpp"
+
+namespace {
+// reference result via UTF-16, as the matcher used to canonicalise
+std::string icu_folded(std::string const &input) {
+  std::vector<UChar> wide(input.length() + 1);
+  std::vector<UChar> folded(input.length() * 3 + 1);
+  int32_t length;
+  UErrorCode error(U_ZERO_ERROR);
+  u_strFromUTF8(wide.data(), static_cast<int32_t>(wide.size()), &length,
+                input.data(), static_cast<int32_t>(input.length()), &error);
+  length = u_strFoldCase(folded.data(), static_cast<int32_t>(folded.size()),
+                         wide.data(), length, U_FOLD_CASE_DEFAULT, &error);
+  std::string result(length * 3, '\0');
+  u_strToUTF8(result.data(), static_cast<int32_t>(result.length()), &length,
+              folded.data(), length, &error);
+  EXPECT_TRUE(U_SUCCESS(error));
+  result.resize(length);
+  return result;
+}
+
+std::string utf8(char32_t const code_point) {
+  std::u32string wide(1, code_point);
+  std::string result(4, '\0');
+  int32_t length;
+  UErrorCode error(U_ZERO_ERROR);
+  UChar units[2];
+  int32_t unit_count;
+  u_strFromUTF32(units, 2, &unit_count,
+                 reinterpret_cast<UChar32 const *>(wide.data()), 1, &error);
+  u_strToUTF8(result.data(), 4, &length, units, unit_count, &error);
+  result.resize(length);
+  return result;
+}
+} // namespace
+
+TEST(CaseFoldingTest, Ascii) {
+  EXPECT_EQ(case_folding::folded("Hello, WORLD @[`{ 09"),
+            "hello, world @[`{ 09");
+  // long enough for the vector path, with a tail
+  std::string input("The Quick Brown Fox Jumps Over The Lazy Dog AZ az");
+  std::string expected("the quick brown fox jumps over the lazy dog az az");
+  EXPECT_EQ(case_folding::folded(input), expected);
+}
+
+TEST(CaseFoldingTest, MatchesIcuForEveryCodePoint) {
+  for (char32_t code_point = 1; code_point <= 0x10FFFF; ++code_point) {
+    if (code_point >= 0xD800 && code_point <= 0xDFFF)
+      continue;
+    std::string input(utf8(code_point));
+    ASSERT_EQ(case_folding::folded(input), icu_folded(input))
+        << "code point " << std::hex << uint32_t(code_point);
+  }
+}
+
+TEST(CaseFoldingTest, MixedText) {
+  for (std::string input :
+       {"Straße İstanbul ΐ Ǆ", "ＡＢＣ東京 MIXED ascii Ünïcödé 𐐀𐐨",
+        "RUN OF ASCII LONGER THAN SIXTEEN BYTES then Ω then MORE ASCII"}) {
+    EXPECT_EQ(case_folding::folded(input), icu_folded(input)) << input;
+  }
+  EXPECT_EQ(case_folding::folded("STRASSE"), case_folding::folded("Straße"));
+}
+
+TEST(CaseFoldingTest, MalformedReplaced) {
+  EXPECT_EQ(case_folding::folded("A\xC3"), "a\xEF\xBF\xBD");
+  EXPECT_EQ(case_folding::folded("\xC0\xAF" "B"),
+            "\xEF\xBF\xBD\xEF\xBF\xBD" "b");
+  EXPECT_EQ(case_folding::folded("\xED\xA0\x80"),
+            "\xEF\xBF\xBD\xEF\xBF\xBD\xEF\xBF\xBD");
+}
+
+TEST(CaseFoldingTest, ReusesOutput) {
+  std::string output("previous contents");
+  case_folding::fold("ABC", output);
+  EXPECT_EQ(output, "abc");
+  case_folding::fold("", output);
+  EXPECT_TRUE(output.empty());
+}
+
+TEST(CaseFoldingTest, CodePoints) {
+  std::string text("a\xC3\xA9\xE6\x9D\xB1\xF0\x90\x90\x80z");
+  EXPECT_EQ(uint32_t(case_folding::code_point_at(text, 0)), uint32_t(U'a'));
+  EXPECT_EQ(uint32_t(case_folding::code_point_at(text, 1)), uint32_t(U'é'));
+  EXPECT_EQ(uint32_t(case_folding::code_point_at(text, 3)), uint32_t(U'東'));
+  EXPECT_EQ(uint32_t(case_folding::code_point_at(text, 6)), uint32_t(U'\U00010400'));
+  EXPECT_EQ(uint32_t(case_folding::code_point_before(text, 1)), uint32_t(U'a'));
+  EXPECT_EQ(uint32_t(case_folding::code_point_before(text, 3)), uint32_t(U'é'));
+  EXPECT_EQ(uint32_t(case_folding::code_point_before(text, 6)), uint32_t(U'東'));
+  EXPECT_EQ(uint32_t(case_folding::code_point_before(text, 10)), uint32_t(U'\U00010400'));
+  EXPECT_EQ(uint32_t(case_folding::code_point_before(text, 11)), uint32_t(U'z'));
+}
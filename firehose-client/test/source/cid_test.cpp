@@ -1,3 +1,6 @@
+#include "binary_cid.hpp"
+#include "car_index.hpp"
+#include "common/bluesky/platform.hpp"
 #include "multiformats/cid.hpp"
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
@@ -13,3 +16,63 @@ TEST(CIDTest, RoundTrip) {
   auto decoded(Multiformats::Multibase::decode(mod_service_banner));
   EXPECT_EQ(decoded.size(), 36);
 }
+
+TEST(CIDTest, BinaryRoundTrip) {
+  const std::string mod_service_banner(
+      "bafyreifd275x5ujvzarnxzwmztn32ncrtewmtp4ne4bb73opkflvdabere");
+  const std::vector<uint8_t> raw(
+      {0x01, 0x71, 0x12, 0x20, 0xa3, 0xd7, 0xfb, 0x7e, 0xd1, 0x35, 0xc8, 0x22,
+       0xdb, 0xe6, 0xcc, 0xcc, 0xdb, 0xbd, 0x34, 0x51, 0x99, 0x2c, 0xc9, 0xbf,
+       0x8d, 0x27, 0x02, 0x1f, 0xed, 0xcf, 0x51, 0x57, 0x51, 0x80, 0x24, 0x89});
+  atproto::binary_cid cid(raw);
+  EXPECT_TRUE(cid.is_valid());
+  EXPECT_EQ(cid.to_string(), mod_service_banner);
+
+  // DAG-CBOR link form has a leading zero
+  std::vector<uint8_t> link(1, 0);
+  link.insert(link.end(), raw.cbegin(), raw.cend());
+  auto linked(atproto::binary_cid::from_link(link));
+  EXPECT_EQ(linked, cid);
+  EXPECT_EQ(std::hash<atproto::binary_cid>()(linked), cid.hash());
+}
+
+// CIDv0 keeps its wire form, so display and CAR block lookup both match
+TEST(CIDTest, BinaryV0RoundTrip) {
+  const std::vector<uint8_t> v0(
+      {0x12, 0x20, 0xa3, 0xd7, 0xfb, 0x7e, 0xd1, 0x35, 0xc8, 0x22, 0xdb, 0xe6,
+       0xcc, 0xcc, 0xdb, 0xbd, 0x34, 0x51, 0x99, 0x2c, 0xc9, 0xbf, 0x8d, 0x27,
+       0x02, 0x1f, 0xed, 0xcf, 0x51, 0x57, 0x51, 0x80, 0x24, 0x89});
+  atproto::binary_cid cid(v0);
+  EXPECT_TRUE(cid.is_valid());
+  EXPECT_TRUE(cid.is_v0());
+  EXPECT_TRUE(std::ranges::equal(cid.raw(), v0));
+  EXPECT_EQ(cid.to_string(),
+            atproto::cid_decoder<std::vector<uint8_t>::const_iterator>(
+                v0.cbegin(), v0.cend())
+                .as_string());
+
+  // not the same CID as the DAG-PB CIDv1 on the same digest
+  std::vector<uint8_t> v1({0x01, 0x70});
+  v1.insert(v1.end(), v0.cbegin(), v0.cend());
+  EXPECT_FALSE(atproto::binary_cid(v1).is_v0());
+  EXPECT_NE(atproto::binary_cid(v1), cid);
+
+  // header of an empty map, then one block keyed by the v0 CID
+  std::vector<uint8_t> car({0x01, 0xa0, static_cast<uint8_t>(v0.size() + 1)});
+  car.insert(car.end(), v0.cbegin(), v0.cend());
+  car.push_back(0xf6);
+  car_index index(car);
+  ASSERT_TRUE(index.is_valid());
+  auto block(index.find(cid.raw()));
+  ASSERT_EQ(block.size(), 1);
+  EXPECT_EQ(block[0], 0xf6);
+}
+
+TEST(CIDTest, BinaryInvalid) {
+  EXPECT_FALSE(atproto::binary_cid().is_valid());
+  EXPECT_TRUE(atproto::binary_cid().to_string().empty());
+  std::vector<uint8_t> truncated(20, 1);
+  EXPECT_THROW(atproto::binary_cid cid(truncated), std::invalid_argument);
+  EXPECT_THROW(atproto::binary_cid::from_link(truncated),
+               std::invalid_argument);
+}
@@ -0,0 +1,246 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <limits>
+#include <memory_resource>
+#include <string>
+
+#include "dag_cbor.hpp"
+#include "testdefs.hpp"
+
+using namespace std::literals;
+
+namespace {
+// test data renders byte strings as {"bytes": [...], "subtype": ...}
+nlohmann::json with_binary(nlohmann::json const &node) {
+  if (node.is_object() && node.contains("bytes") &&
+      node["bytes"].is_array()) {
+    auto content(node["bytes"].get<std::vector<uint8_t>>());
+    if (node.contains("subtype") && !node["subtype"].is_null()) {
+      return nlohmann::json::binary(content, node["subtype"].get<uint8_t>());
+    }
+    return nlohmann::json::binary(content);
+  }
+  if (node.is_object()) {
+    nlohmann::json result(nlohmann::json::object());
+    for (auto const &[key, next] : node.items()) {
+      result[key] = with_binary(next);
+    }
+    return result;
+  }
+  if (node.is_array()) {
+    nlohmann::json result(nlohmann::json::array());
+    for (auto const &next : node) {
+      result.push_back(with_binary(next));
+    }
+    return result;
+  }
+  return node;
+}
+
+std::string to_cbor(nlohmann::json const &item) {
+  auto encoded(nlohmann::json::to_cbor(item));
+  return std::string(encoded.cbegin(), encoded.cend());
+}
+
+const std::string Header(to_cbor({{"op", 1}, {"t", "#commit"}}));
+
+// header then commit message, as on the wire
+std::string commit_frame() {
+  return Header +
+         to_cbor(with_binary(load_json_from_file("raw_firehose_commit.json")));
+}
+
+// count arrays of one element around a null
+std::string nested_arrays(const size_t count) {
+  return std::string(count, '\x81') + '\xf6';
+}
+
+dag_cbor::value decode_one(std::string_view data,
+                           std::pmr::memory_resource &arena) {
+  size_t offset(0);
+  auto result(dag_cbor::decode(data, offset, arena));
+  EXPECT_EQ(offset, data.size());
+  return result;
+}
+} // namespace
+
+TEST(DagCborTest, CommitFrame) {
+  const std::string frame(commit_frame());
+  dag_cbor::document document(frame);
+  ASSERT_EQ(document.items().size(), 2);
+  auto const &header(document.items().front());
+  auto const &message(document.items().back());
+  EXPECT_EQ(header["op"].as_integer(), 1);
+  EXPECT_EQ(header["t"].as_text(), "#commit");
+
+  EXPECT_EQ(message["seq"].as_integer(), 2057690245);
+  EXPECT_EQ(message["repo"].as_text(), "did:plc:4xu4evbtjxhoyxjta6nrnxg2");
+  EXPECT_FALSE(message["tooBig"].as_bool());
+  EXPECT_TRUE(message["prev"].is_null());
+  EXPECT_EQ(message["blocks"].type(), dag_cbor::kind::bytes);
+  EXPECT_EQ(message["blocks"].as_bytes().size(), 2363);
+
+  auto const &ops(message["ops"]);
+  ASSERT_TRUE(ops.is_array());
+  ASSERT_EQ(ops.size(), 1);
+  auto const &op(ops.items().front());
+  EXPECT_EQ(op["action"].as_text(), "create");
+  EXPECT_EQ(op["path"].as_text(), "app.bsky.graph.follow/3ldrdeafu442z");
+  EXPECT_TRUE(op["cid"].is_link());
+
+  // strings view the frame, nothing is copied
+  auto repo(message["repo"].as_text());
+  EXPECT_GE(repo.data(), frame.data());
+  EXPECT_LE(repo.data() + repo.size(), frame.data() + frame.size());
+
+  // same content as a full DOM decode
+  auto expected(nlohmann::json::from_cbor(
+      frame.substr(Header.size()), true, true,
+      nlohmann::json::cbor_tag_handler_t::store));
+  EXPECT_EQ(dag_cbor::to_json(message), expected);
+}
+
+TEST(DagCborTest, Truncated) {
+  const std::string frame(commit_frame());
+  // cut anywhere inside the message
+  for (size_t size = Header.size() + 1; size < frame.size(); ++size) {
+    EXPECT_THROW(dag_cbor::document(frame.substr(0, size)),
+                 dag_cbor::decode_error)
+        << "truncated at " << size;
+  }
+  // a length beyond the input is not allocated
+  std::pmr::monotonic_buffer_resource arena;
+  size_t offset(0);
+  EXPECT_THROW(dag_cbor::decode("\x9b\x00\x00\x00\x00\xff\xff\xff\xff"sv,
+                                offset, arena),
+               dag_cbor::decode_error);
+}
+
+TEST(DagCborTest, MaxDepth) {
+  std::pmr::monotonic_buffer_resource arena;
+  const std::string deepest(nested_arrays(dag_cbor::MaxDepth));
+  auto item(decode_one(deepest, arena));
+  for (size_t depth = 0; depth < dag_cbor::MaxDepth; ++depth) {
+    ASSERT_TRUE(item.is_array());
+    item = item.items().front();
+  }
+  EXPECT_TRUE(item.is_null());
+
+  const std::string too_deep(nested_arrays(dag_cbor::MaxDepth + 1));
+  size_t offset(0);
+  EXPECT_THROW(dag_cbor::decode(too_deep, offset, arena),
+               dag_cbor::decode_error);
+  // tags count as nesting
+  const std::string tagged(std::string(dag_cbor::MaxDepth + 1, '\xc1') +
+                           '\x01');
+  offset = 0;
+  EXPECT_THROW(dag_cbor::decode(tagged, offset, arena),
+               dag_cbor::decode_error);
+}
+
+TEST(DagCborTest, WrongTypeAccess) {
+  const std::string frame(commit_frame());
+  dag_cbor::document document(frame);
+  auto const &message(document.items().back());
+  EXPECT_THROW(message["seq"].as_text(), dag_cbor::type_error);
+  EXPECT_THROW(message["repo"].as_integer(), dag_cbor::type_error);
+  EXPECT_THROW(message["tooBig"].as_bytes(), dag_cbor::type_error);
+  EXPECT_THROW(message["ops"].entries(), dag_cbor::type_error);
+  EXPECT_THROW(message.items(), dag_cbor::type_error);
+  EXPECT_THROW(message["missing"], dag_cbor::type_error);
+  EXPECT_THROW(message["repo"]["nested"], dag_cbor::type_error);
+  EXPECT_EQ(message["repo"].find("nested"), nullptr);
+  EXPECT_FALSE(message.contains("missing"));
+  EXPECT_EQ(message["repo"].size(), 0);
+  // integers widen to double
+  EXPECT_EQ(message["seq"].as_double(), 2057690245.0);
+}
+
+TEST(DagCborTest, Malformed) {
+  std::pmr::monotonic_buffer_resource arena;
+  size_t offset(0);
+  // map with an integer key
+  EXPECT_THROW(dag_cbor::decode("\xa1\x01\x02"sv, offset, arena),
+               dag_cbor::decode_error);
+  // indefinite length array
+  offset = 0;
+  EXPECT_THROW(dag_cbor::decode("\x9f\x01\xff"sv, offset, arena),
+               dag_cbor::decode_error);
+  // reserved additional info
+  offset = 0;
+  EXPECT_THROW(dag_cbor::decode("\x1c"sv, offset, arena),
+               dag_cbor::decode_error);
+}
+
+TEST(DagCborTest, IntegerRange) {
+  std::pmr::monotonic_buffer_resource arena;
+  EXPECT_EQ(decode_one("\x1b\x7f\xff\xff\xff\xff\xff\xff\xff"sv, arena)
+                .as_integer(),
+            std::numeric_limits<int64_t>::max());
+  EXPECT_EQ(decode_one("\x3b\x7f\xff\xff\xff\xff\xff\xff\xff"sv, arena)
+                .as_integer(),
+            std::numeric_limits<int64_t>::min());
+  // beyond int64_t, either sign
+  size_t offset(0);
+  EXPECT_THROW(dag_cbor::decode("\x1b\xff\xff\xff\xff\xff\xff\xff\xff"sv,
+                                offset, arena),
+               dag_cbor::decode_error);
+  offset = 0;
+  EXPECT_THROW(dag_cbor::decode("\x1b\x80\x00\x00\x00\x00\x00\x00\x00"sv,
+                                offset, arena),
+               dag_cbor::decode_error);
+  offset = 0;
+  EXPECT_THROW(dag_cbor::decode("\x3b\xff\xff\xff\xff\xff\xff\xff\xff"sv,
+                                offset, arena),
+               dag_cbor::decode_error);
+}
+
+TEST(DagCborTest, CidTag) {
+  const std::vector<uint8_t> cid{0x00, 0x01, 0x71, 0x12, 0x20, 0xab};
+  std::pmr::monotonic_buffer_resource arena;
+  const std::string link(to_cbor(nlohmann::json::binary(cid, 42)));
+  ASSERT_EQ(link.substr(0, 2), "\xd8\x2a"sv);
+  auto item(decode_one(link, arena));
+  EXPECT_TRUE(item.is_link());
+  EXPECT_EQ(item.type(), dag_cbor::kind::link);
+  EXPECT_THAT(item.as_bytes(), ::testing::ElementsAreArray(cid));
+  EXPECT_EQ(dag_cbor::to_json(item), nlohmann::json::binary(cid, 42));
+
+  // untagged bytes are not a link
+  auto plain(decode_one(to_cbor(nlohmann::json::binary(cid)), arena));
+  EXPECT_EQ(plain.type(), dag_cbor::kind::bytes);
+  EXPECT_FALSE(plain.is_link());
+
+  // other tags pass the tagged value through
+  auto other(decode_one("\xc1\x05"sv, arena));
+  EXPECT_EQ(other.as_integer(), 5);
+
+  // a link must be bytes
+  size_t offset(0);
+  EXPECT_THROW(dag_cbor::decode("\xd8\x2a\x61\x78"sv, offset, arena),
+               dag_cbor::decode_error);
+}
+
+TEST(DagCborTest, PooledDocumentsAreReused) {
+  const std::string frame(commit_frame());
+  dag_cbor::document const *first(nullptr);
+  {
+    auto document(dag_cbor::document_pool::instance().acquire(frame));
+    ASSERT_EQ(document->items().size(), 2);
+    first = document.get();
+  }
+  const std::string header_only(Header);
+  {
+    auto document(dag_cbor::document_pool::instance().acquire(header_only));
+    EXPECT_EQ(document.get(), first);
+    ASSERT_EQ(document->items().size(), 1);
+    EXPECT_EQ(document->items().front()["t"].as_text(), "#commit");
+  }
+  // a failed decode still returns the document to the pool
+  EXPECT_THROW(dag_cbor::document_pool::instance().acquire(
+                   frame.substr(0, frame.size() - 1)),
+               dag_cbor::decode_error);
+  auto document(dag_cbor::document_pool::instance().acquire(frame));
+  EXPECT_EQ(document.get(), first);
+  EXPECT_EQ(document->items().back()["seq"].as_integer(), 2057690245);
+}
@@ -0,0 +1,43 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+#include "exact_set.hpp"
+
+TEST(ExactSetTest, FindsEveryKey) {
+  exact_set keys;
+  std::vector<exact_set::key_id> ids;
+  for (size_t next = 0; next < 5000; ++next) {
+    ids.push_back(keys.add("spam" + std::to_string(next) + ".example"));
+  }
+  keys.compile();
+  EXPECT_EQ(keys.size(), 5000);
+  for (size_t next = 0; next < 5000; ++next) {
+    EXPECT_EQ(keys.find("spam" + std::to_string(next) + ".example"),
+              ids[next]);
+  }
+  EXPECT_EQ(keys.find("spam5000.example"), exact_set::NoKey);
+  EXPECT_EQ(keys.find("spam1.exampl"), exact_set::NoKey);
+  EXPECT_EQ(keys.find(""), exact_set::NoKey);
+}
+
+TEST(ExactSetTest, RepeatedAndEmptyKeys) {
+  exact_set keys;
+  const auto tag(keys.add("#tag"));
+  EXPECT_EQ(keys.add("#tag"), tag);
+  EXPECT_EQ(keys.add(""), exact_set::NoKey);
+  const auto handle(keys.add("handle.bsky.social"));
+  keys.compile();
+  EXPECT_EQ(keys.size(), 2);
+  EXPECT_EQ(keys.find("#tag"), tag);
+  EXPECT_EQ(keys.find("handle.bsky.social"), handle);
+  EXPECT_EQ(keys.find("#ta"), exact_set::NoKey);
+}
+
+TEST(ExactSetTest, Empty) {
+  exact_set keys;
+  keys.compile();
+  EXPECT_TRUE(keys.empty());
+  EXPECT_EQ(keys.find("anything"), exact_set::NoKey);
+}
@@ -0,0 +1,225 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "common/metrics_factory.hpp"
+#include "frame_log.hpp"
+
+namespace {
+std::string frame_for(const int64_t seq) {
+  return "frame " + std::to_string(seq);
+}
+
+std::vector<int64_t> replayed_seqs(std::filesystem::path const &directory,
+                                   const int64_t from_seq) {
+  frame_log::reader reader(directory, from_seq);
+  std::vector<int64_t> seqs;
+  frame_log::record next_record;
+  while (reader.next(next_record)) {
+    EXPECT_EQ(next_record._frame, frame_for(next_record._seq));
+    seqs.push_back(next_record._seq);
+  }
+  return seqs;
+}
+
+std::vector<int64_t> seq_range(const int64_t first, const int64_t last) {
+  std::vector<int64_t> seqs;
+  for (int64_t seq = first; seq <= last; ++seq) {
+    seqs.push_back(seq);
+  }
+  return seqs;
+}
+
+std::vector<std::filesystem::path>
+segments_in(std::filesystem::path const &directory) {
+  std::vector<std::filesystem::path> segments;
+  for (auto const &entry : std::filesystem::directory_iterator(directory)) {
+    if (entry.path().extension() == frame_log::SegmentSuffix) {
+      segments.push_back(entry.path());
+    }
+  }
+  std::sort(segments.begin(), segments.end());
+  return segments;
+}
+} // namespace
+
+class FrameLogTest : public ::testing::Test {
+protected:
+  static void SetUpTestSuite() {
+    metrics_factory::instance().add_counter("frame_log", "frame log test");
+  }
+
+  void SetUp() override {
+    _directory = std::filesystem::temp_directory_path() /
+                 ("frame_log_test_" +
+                  std::string(::testing::UnitTest::GetInstance()
+                                  ->current_test_info()
+                                  ->name()));
+    std::filesystem::remove_all(_directory);
+  }
+  void TearDown() override { std::filesystem::remove_all(_directory); }
+
+  void capture(const int64_t first, const int64_t last,
+               const size_t index_interval = 1000) {
+    YAML::Node settings;
+    settings["directory"] = _directory.string();
+    settings["segment_mb"] = 1;
+    settings["index_interval"] = index_interval;
+    frame_log::writer writer(settings);
+    for (int64_t seq = first; seq <= last; ++seq) {
+      writer.append(seq, frame_for(seq));
+    }
+  }
+
+  std::filesystem::path _directory;
+};
+
+TEST_F(FrameLogTest, RoundTrip) {
+  capture(1, 50);
+  ASSERT_EQ(segments_in(_directory).size(), 1);
+  frame_log::reader reader(_directory, 0);
+  frame_log::record next_record;
+  for (int64_t seq = 1; seq <= 50; ++seq) {
+    ASSERT_TRUE(reader.next(next_record));
+    EXPECT_EQ(next_record._seq, seq);
+    EXPECT_EQ(next_record._frame, frame_for(seq));
+    EXPECT_GT(next_record._captured_us, 0);
+  }
+  EXPECT_FALSE(reader.next(next_record));
+}
+
+TEST_F(FrameLogTest, FramesWithoutSeqUseLastSeen) {
+  YAML::Node settings;
+  settings["directory"] = _directory.string();
+  settings["segment_mb"] = 1;
+  {
+    frame_log::writer writer(settings);
+    writer.append(7, "first");
+    writer.append(0, "info");
+    writer.append(8, "second");
+  }
+  frame_log::reader reader(_directory, 0);
+  frame_log::record next_record;
+  ASSERT_TRUE(reader.next(next_record));
+  EXPECT_EQ(next_record._frame, "first");
+  ASSERT_TRUE(reader.next(next_record));
+  EXPECT_EQ(next_record._seq, 7);
+  EXPECT_EQ(next_record._frame, "info");
+  ASSERT_TRUE(reader.next(next_record));
+  EXPECT_EQ(next_record._seq, 8);
+  EXPECT_FALSE(reader.next(next_record));
+}
+
+TEST_F(FrameLogTest, RollsOverSegments) {
+  YAML::Node settings;
+  settings["directory"] = _directory.string();
+  settings["segment_mb"] = 1;
+  // three frames fill a segment
+  const std::string big(300 * 1024, 'x');
+  {
+    frame_log::writer writer(settings);
+    for (int64_t seq = 1; seq <= 10; ++seq) {
+      writer.append(seq, big);
+    }
+  }
+  EXPECT_EQ(segments_in(_directory).size(), 4);
+  frame_log::reader reader(_directory, 5);
+  frame_log::record next_record;
+  for (int64_t seq = 5; seq <= 10; ++seq) {
+    ASSERT_TRUE(reader.next(next_record));
+    EXPECT_EQ(next_record._seq, seq);
+    EXPECT_EQ(next_record._frame.size(), big.size());
+  }
+  EXPECT_FALSE(reader.next(next_record));
+}
+
+TEST_F(FrameLogTest, FrameWithoutSeqOpensSegment) {
+  YAML::Node settings;
+  settings["directory"] = _directory.string();
+  settings["segment_mb"] = 1;
+  // three frames fill a segment, the fourth has no seq
+  const std::string big(300 * 1024, 'x');
+  const std::string info(300 * 1024, 'i');
+  {
+    frame_log::writer writer(settings);
+    for (int64_t seq = 1; seq <= 3; ++seq) {
+      writer.append(seq, big);
+    }
+    writer.append(0, info);
+    writer.append(4, "after");
+  }
+  ASSERT_EQ(segments_in(_directory).size(), 2);
+  frame_log::reader reader(_directory, 0);
+  frame_log::record next_record;
+  for (int64_t seq = 1; seq <= 3; ++seq) {
+    ASSERT_TRUE(reader.next(next_record));
+    EXPECT_EQ(next_record._seq, seq);
+  }
+  ASSERT_TRUE(reader.next(next_record));
+  EXPECT_EQ(next_record._seq, 3);
+  EXPECT_EQ(next_record._frame, info);
+  ASSERT_TRUE(reader.next(next_record));
+  EXPECT_EQ(next_record._seq, 4);
+  EXPECT_EQ(next_record._frame, "after");
+  EXPECT_FALSE(reader.next(next_record));
+}
+
+TEST_F(FrameLogTest, SeeksThroughIndex) {
+  capture(1, 100, 10);
+  EXPECT_THAT(replayed_seqs(_directory, 55), ::testing::ElementsAreArray(
+                                                 seq_range(55, 100)));
+
+  // mark the first record as end of data, only a seek through the index
+  // gets past it
+  auto segment(segments_in(_directory).front());
+  {
+    std::fstream file(segment,
+                      std::ios::binary | std::ios::in | std::ios::out);
+    file.seekp(sizeof(frame_log::segment_header));
+    const uint32_t end_of_data(0);
+    file.write(reinterpret_cast<const char *>(&end_of_data),
+               sizeof(end_of_data));
+  }
+  EXPECT_TRUE(replayed_seqs(_directory, 0).empty());
+  EXPECT_THAT(replayed_seqs(_directory, 55), ::testing::ElementsAreArray(
+                                                 seq_range(55, 100)));
+}
+
+TEST_F(FrameLogTest, SkipsDuplicateSeqs) {
+  // capture restarted after a rewind overlaps the previous one
+  capture(1, 10);
+  capture(6, 15);
+  capture(15, 20);
+  ASSERT_EQ(segments_in(_directory).size(), 3);
+  EXPECT_THAT(replayed_seqs(_directory, 0),
+              ::testing::ElementsAreArray(seq_range(1, 20)));
+  EXPECT_THAT(replayed_seqs(_directory, 8),
+              ::testing::ElementsAreArray(seq_range(8, 20)));
+}
+
+TEST_F(FrameLogTest, TornFinalRecord) {
+  capture(1, 5);
+  auto segment(segments_in(_directory).front());
+  const auto complete_size(std::filesystem::file_size(segment));
+
+  // crash after the frame bytes, before the header: zero header reads as end
+  // of data
+  const std::string torn_frame(frame_for(6));
+  {
+    std::ofstream file(segment, std::ios::binary | std::ios::app);
+    const frame_log::record_header no_header{};
+    file.write(reinterpret_cast<const char *>(&no_header), sizeof(no_header));
+    file.write(torn_frame.data(), torn_frame.size());
+  }
+  EXPECT_THAT(replayed_seqs(_directory, 0),
+              ::testing::ElementsAreArray(seq_range(1, 5)));
+
+  // file cut short inside the last record
+  std::filesystem::resize_file(segment, complete_size - 2);
+  EXPECT_THAT(replayed_seqs(_directory, 0),
+              ::testing::ElementsAreArray(seq_range(1, 4)));
+}
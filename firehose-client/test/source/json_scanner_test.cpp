@@ -0,0 +1,74 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include "json_scanner.hpp"
+#include "testdefs.hpp"
+
+TEST(JsonScannerTest, PostText) {
+  const auto post = load_json_from_file("post.json");
+  auto candidates(json_scanner::candidates(post.dump(2)));
+  ASSERT_TRUE(candidates.has_value());
+  candidate_list expected = {
+      {"app.bsky.feed.post", "/text",
+       nlohmann::to_string(post["commit"]["record"]["text"])}};
+  EXPECT_THAT(candidates.value(), ::testing::ContainerEq(expected));
+}
+
+TEST(JsonScannerTest, ProfileFields) {
+  const auto profile = load_json_from_file("profile.json");
+  auto candidates(json_scanner::candidates(profile.dump()));
+  ASSERT_TRUE(candidates.has_value());
+  auto const &record(profile["commit"]["record"]);
+  candidate_list expected = {
+      {"app.bsky.actor.profile", "/description",
+       nlohmann::to_string(record["description"])},
+      {"app.bsky.actor.profile", "/displayName",
+       nlohmann::to_string(record["displayName"])}};
+  EXPECT_THAT(candidates.value(), ::testing::ContainerEq(expected));
+}
+
+TEST(JsonScannerTest, EscapesAndNesting) {
+  const std::string message(
+      R"({"kind":"commit","commit":{"operation":"create","record":)"
+      R"({"$type":"app.bsky.feed.post","text":"say \"hi\" é 😀",)"
+      R"("embed":{"images":[{"alt":"one ]}"},{"image":{}},)"
+      R"({"alt":"three"}]}}}})");
+  auto candidates(json_scanner::candidates(message));
+  ASSERT_TRUE(candidates.has_value());
+  candidate_list expected = {
+      {"app.bsky.feed.post", "/text", "\"say \\\"hi\\\" é \U0001F600\""},
+      {"app.bsky.feed.post", "/embed/images/0/alt", "\"one ]}\""},
+      {"app.bsky.feed.post", "/embed/images/2/alt", "\"three\""}};
+  EXPECT_THAT(candidates.value(), ::testing::ContainerEq(expected));
+}
+
+TEST(JsonScannerTest, IdentityAndSkipped) {
+  auto handle(json_scanner::candidates(
+      R"({"kind":"identity",)"
+      R"("identity":{"did":"x","handle":"a.bsky.social"}})"));
+  ASSERT_TRUE(handle.has_value());
+  candidate_list expected = {{"identity", "handle", "a.bsky.social"}};
+  EXPECT_THAT(handle.value(), ::testing::ContainerEq(expected));
+
+  auto deleted(json_scanner::candidates(
+      R"({"kind":"commit","commit":{"operation":"delete","rkey":"x"}})"));
+  ASSERT_TRUE(deleted.has_value());
+  EXPECT_TRUE(deleted->empty());
+}
+
+TEST(JsonScannerTest, FallsBackToDom) {
+  // non-string target field
+  EXPECT_FALSE(json_scanner::candidates(
+                   R"({"kind":"commit","commit":{"record":)"
+                   R"({"$type":"app.bsky.actor.profile","description":null}}})")
+                   .has_value());
+  // lone surrogate
+  EXPECT_FALSE(json_scanner::candidates(
+                   R"({"kind":"commit","commit":{"record":)"
+                   R"({"$type":"app.bsky.feed.post","text":"\ud83d"}}})")
+                   .has_value());
+  // truncated
+  EXPECT_FALSE(
+      json_scanner::candidates(R"({"kind":"commit","commit":{"rec)")
+          .has_value());
+}
@@ -0,0 +1,94 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+#include "regex_set.hpp"
+
+TEST(RegexSetTest, MatchesAnyPattern) {
+  regex_set regexes;
+  std::string error;
+  const auto colour(regexes.add("colou?r", error));
+  const auto digits(regexes.add(R"(\d{3,})", error));
+  const auto spelled(regexes.add("n[o0]pe", error));
+  ASSERT_NE(colour, regex_set::NoPattern);
+  ASSERT_NE(digits, regex_set::NoPattern);
+  ASSERT_NE(spelled, regex_set::NoPattern);
+  regexes.compile();
+  EXPECT_EQ(regexes.pattern_count(), 3);
+
+  std::vector<int> matches;
+  regexes.scan("my favourite COLOR is 1234", matches);
+  EXPECT_THAT(matches, ::testing::UnorderedElementsAre(colour, digits));
+  regexes.scan("N0PE", matches);
+  EXPECT_THAT(matches, ::testing::ElementsAre(spelled));
+  regexes.scan("nothing here 12", matches);
+  EXPECT_TRUE(matches.empty());
+}
+
+TEST(RegexSetTest, Utf8) {
+  regex_set regexes;
+  std::string error;
+  const auto cyrillic(regexes.add("х[оo]х[оo]л", error));
+  ASSERT_NE(cyrillic, regex_set::NoPattern);
+  regexes.compile();
+  std::vector<int> matches;
+  regexes.scan("ХоХoЛ", matches);
+  EXPECT_THAT(matches, ::testing::ElementsAre(cyrillic));
+}
+
+TEST(RegexSetTest, RejectsBadPatterns) {
+  regex_set regexes;
+  std::string error;
+  EXPECT_EQ(regexes.add("(unclosed", error), regex_set::NoPattern);
+  EXPECT_FALSE(error.empty());
+  error.clear();
+  // matches every candidate
+  EXPECT_EQ(regexes.add("a*", error), regex_set::NoPattern);
+  EXPECT_FALSE(error.empty());
+  error.clear();
+  // compiles to a huge program
+  EXPECT_EQ(regexes.add("(((a{100}){100}){100})", error), regex_set::NoPattern);
+  EXPECT_FALSE(error.empty());
+  EXPECT_TRUE(regexes.empty());
+
+  const auto valid(regexes.add("valid", error));
+  regexes.compile();
+  std::vector<int> matches;
+  regexes.scan("still valid", matches);
+  EXPECT_THAT(matches, ::testing::ElementsAre(valid));
+}
+
+TEST(RegexSetTest, Empty) {
+  regex_set regexes;
+  regexes.compile();
+  std::vector<int> matches{1};
+  regexes.scan("anything", matches);
+  EXPECT_TRUE(matches.empty());
+}
+
+TEST(RegexSetTest, CountsSinglePatternScans) {
+  prometheus::Counter fallbacks;
+  regex_set::set_fallback_counter(&fallbacks);
+  // too small a budget for the combined DFA of these
+  regex_set singly(32 * 1024);
+  std::string error;
+  ASSERT_NE(singly.add("a[a-c]{200}d", error), regex_set::NoPattern) << error;
+  ASSERT_NE(singly.add("b[a-c]{200}e", error), regex_set::NoPattern) << error;
+  singly.compile();
+  std::vector<int> matches;
+  singly.scan("x a" + std::string(200, 'c') + "d", matches);
+  EXPECT_THAT(matches, ::testing::ElementsAre(0));
+  singly.scan("nothing", matches);
+  EXPECT_TRUE(matches.empty());
+  EXPECT_EQ(fallbacks.Value(), 2);
+
+  // scans by the combined DFA are not counted
+  regex_set combined;
+  ASSERT_NE(combined.add("scam", error), regex_set::NoPattern);
+  combined.compile();
+  combined.scan("a scam", matches);
+  EXPECT_THAT(matches, ::testing::ElementsAre(0));
+  EXPECT_EQ(fallbacks.Value(), 2);
+  regex_set::set_fallback_counter(nullptr);
+}
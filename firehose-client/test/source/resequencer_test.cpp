@@ -0,0 +1,157 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "resequencer.hpp"
+
+TEST(ResequencerTest, InOrder) {
+  std::vector<int> released;
+  resequencer<int> sequencer([&](int &&value) { released.push_back(value); });
+  sequencer.complete(0, 10);
+  sequencer.complete(1, 11);
+  sequencer.complete(2, 12);
+  EXPECT_THAT(released, ::testing::ElementsAre(10, 11, 12));
+  EXPECT_EQ(sequencer.pending(), 0);
+}
+
+TEST(ResequencerTest, OutOfOrder) {
+  std::vector<int> released;
+  resequencer<int> sequencer([&](int &&value) { released.push_back(value); });
+  sequencer.complete(2, 12);
+  sequencer.complete(1, 11);
+  EXPECT_TRUE(released.empty());
+  EXPECT_EQ(sequencer.pending(), 2);
+  sequencer.complete(0, 10);
+  EXPECT_THAT(released, ::testing::ElementsAre(10, 11, 12));
+  EXPECT_EQ(sequencer.pending(), 0);
+  EXPECT_EQ(sequencer.high_water(), 2);
+}
+
+TEST(ResequencerTest, EmptyResultsAdvance) {
+  std::vector<int> released;
+  resequencer<int> sequencer([&](int &&value) { released.push_back(value); });
+  sequencer.complete(1, 11);
+  sequencer.complete(0, std::nullopt);
+  sequencer.complete(3, 13);
+  EXPECT_THAT(released, ::testing::ElementsAre(11));
+  sequencer.complete(2, std::nullopt);
+  EXPECT_THAT(released, ::testing::ElementsAre(11, 13));
+}
+
+TEST(ResequencerTest, ManyThreads) {
+  constexpr int Workers = 4;
+  constexpr int PerWorker = 1000;
+  std::vector<int> released;
+  resequencer<int> sequencer([&](int &&value) { released.push_back(value); });
+  std::vector<std::thread> workers;
+  for (int worker = 0; worker < Workers; ++worker) {
+    workers.emplace_back([&, worker] {
+      for (int next = worker; next < Workers * PerWorker; next += Workers) {
+        sequencer.complete(next, next);
+      }
+    });
+  }
+  for (auto &worker : workers) {
+    worker.join();
+  }
+  ASSERT_EQ(released.size(), Workers * PerWorker);
+  for (int next = 0; next < Workers * PerWorker; ++next) {
+    EXPECT_EQ(released[next], next);
+  }
+}
+
+TEST(ResequencerTest, BlockedSinkReleasesOutsideLock) {
+  std::vector<int> released;
+  std::promise<void> entered;
+  std::promise<void> unblock;
+  std::shared_future<void> unblocked(unblock.get_future());
+  resequencer<int> sequencer([&](int &&value) {
+    if (released.empty()) {
+      entered.set_value();
+      unblocked.wait();
+    }
+    released.push_back(value);
+  });
+  std::thread releaser([&] { sequencer.complete(0, 10); });
+  entered.get_future().wait();
+  // sink is blocked on the first item, later items still complete
+  sequencer.complete(2, 12);
+  sequencer.complete(1, 11);
+  EXPECT_EQ(sequencer.pending(), 2);
+  unblock.set_value();
+  releaser.join();
+  EXPECT_THAT(released, ::testing::ElementsAre(10, 11, 12));
+  EXPECT_EQ(sequencer.pending(), 0);
+}
+
+TEST(ResequencerTest, ReaderBlocksWhileSinkStalls) {
+  constexpr size_t Window = 4;
+  constexpr uint64_t Frames = 20;
+  std::vector<int> released;
+  std::promise<void> unblock;
+  std::shared_future<void> unblocked(unblock.get_future());
+  resequencer<int> sequencer(
+      [&](int &&value) {
+        unblocked.wait();
+        released.push_back(value);
+      },
+      Window);
+
+  // reader admits ordinals to a queue, decoders complete them
+  std::mutex lock;
+  std::condition_variable queued;
+  std::deque<uint64_t> queue;
+  uint64_t taken(0);
+  std::atomic<uint64_t> admitted(0);
+  std::thread reader([&] {
+    for (uint64_t ordinal = 0; ordinal < Frames; ++ordinal) {
+      while (!sequencer.wait_admission(ordinal, std::chrono::milliseconds(10))) {
+      }
+      std::lock_guard guard(lock);
+      queue.push_back(ordinal);
+      ++admitted;
+      queued.notify_one();
+    }
+  });
+  auto decode([&] {
+    while (true) {
+      std::unique_lock guard(lock);
+      queued.wait(guard, [&] { return !queue.empty() || taken == Frames; });
+      if (queue.empty())
+        return;
+      uint64_t ordinal(queue.front());
+      queue.pop_front();
+      if (++taken == Frames) {
+        queued.notify_all();
+      }
+      guard.unlock();
+      sequencer.complete(ordinal, static_cast<int>(ordinal));
+    }
+  });
+  std::thread first_decoder(decode);
+  std::thread second_decoder(decode);
+
+  // first item is stuck in the sink, the rest of the window is pending
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  EXPECT_EQ(admitted.load(), Window);
+  EXPECT_FALSE(sequencer.wait_admission(Window, std::chrono::milliseconds(10)));
+  EXPECT_EQ(sequencer.pending(), Window - 1);
+
+  unblock.set_value();
+  reader.join();
+  first_decoder.join();
+  second_decoder.join();
+  EXPECT_EQ(admitted.load(), Frames);
+  ASSERT_EQ(released.size(), Frames);
+  for (uint64_t next = 0; next < Frames; ++next) {
+    EXPECT_EQ(released[next], next);
+  }
+  EXPECT_LE(sequencer.high_water(), Window - 1);
+}
@@ -0,0 +1,149 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include <string>
+
+#include "rule_expression.hpp"
+
+namespace {
+// leaves seen, by text
+uint64_t seen(rule_expression const &expression,
+              std::initializer_list<std::string> texts) {
+  uint64_t result(0);
+  for (auto const &text : texts) {
+    for (size_t index = 0; index < expression.leaves().size(); ++index) {
+      if (expression.leaves()[index]._text == text)
+        result |= uint64_t(1) << index;
+    }
+  }
+  return result;
+}
+
+bool holds(rule_expression const &expression,
+           std::initializer_list<std::string> texts) {
+  return expression.evaluate(seen(expression, texts),
+                             [](size_t, size_t, uint16_t) { return true; });
+}
+} // namespace
+
+TEST(RuleExpressionTest, BooleanOperators) {
+  rule_expression expression(
+      R"(scam AND (crypto OR "wallet drainer") AND NOT giveaway)");
+  EXPECT_EQ(expression.leaves().size(), 4);
+  EXPECT_EQ(expression.leaves()[2]._text, "wallet drainer");
+  EXPECT_TRUE(holds(expression, {"scam", "crypto"}));
+  EXPECT_TRUE(holds(expression, {"scam", "wallet drainer"}));
+  EXPECT_FALSE(holds(expression, {"scam"}));
+  EXPECT_FALSE(holds(expression, {"crypto"}));
+  EXPECT_FALSE(holds(expression, {"scam", "crypto", "giveaway"}));
+}
+
+TEST(RuleExpressionTest, PrecedenceAndImplicitAnd) {
+  rule_expression expression("a b OR c");
+  EXPECT_TRUE(holds(expression, {"a", "b"}));
+  EXPECT_TRUE(holds(expression, {"c"}));
+  EXPECT_FALSE(holds(expression, {"a"}));
+  rule_expression repeated("a OR (b AND a)");
+  EXPECT_EQ(repeated.leaves().size(), 2);
+}
+
+TEST(RuleExpressionTest, Proximity) {
+  rule_expression expression("free NEAR/3 followers");
+  EXPECT_TRUE(expression.has_proximity());
+  const uint64_t both(seen(expression, {"free", "followers"}));
+  EXPECT_TRUE(expression.evaluate(
+      both, [](size_t const first, size_t const second,
+               uint16_t const distance) {
+        return first == 0 && second == 1 && distance == 3;
+      }));
+  EXPECT_FALSE(expression.evaluate(
+      both, [](size_t, size_t, uint16_t) { return false; }));
+  // both terms are needed whatever the distance
+  EXPECT_FALSE(expression.evaluate(
+      seen(expression, {"free"}), [](size_t, size_t, uint16_t) {
+        return true;
+      }));
+}
+
+TEST(RuleExpressionTest, FieldQualifiers) {
+  rule_expression expression(R"(displayName:"bot farm" OR uri:spam.example)");
+  ASSERT_EQ(expression.leaves().size(), 2);
+  EXPECT_EQ(expression.leaves()[0]._field, "displayname");
+  EXPECT_TRUE(expression.field_matches(0, "/displayName"));
+  EXPECT_FALSE(expression.field_matches(0, "/description"));
+  EXPECT_TRUE(expression.field_matches(1, "/embed/external/uri"));
+  // link facets and redirect targets are links too
+  EXPECT_TRUE(expression.field_matches(1, "app.bsky.richtext.facet#link"));
+  EXPECT_TRUE(expression.field_matches(1, "redirected_url"));
+  EXPECT_FALSE(expression.field_matches(0, "redirected_url"));
+  // not a field, so part of the term
+  rule_expression link("https://spam.example");
+  EXPECT_EQ(link.leaves()[0]._text, "https://spam.example");
+  EXPECT_TRUE(link.field_matches(0, "/text"));
+}
+
+TEST(RuleExpressionTest, Malformed) {
+  for (auto const source :
+       {"", "a AND", "(a OR b", "a NEAR/0 b", "a NEAR/x b", "NOT a",
+        "a OR NOT b", "\"unclosed", "a )"}) {
+    EXPECT_THROW(rule_expression{source}, std::invalid_argument) << source;
+  }
+}
+
+TEST(RuleExpressionTest, DepthLimits) {
+  // a OR (b OR (c OR ...)) holds one operand per term until the end
+  auto nested_or([](const size_t terms) {
+    std::string source;
+    for (size_t term = 0; term + 1 < terms; ++term) {
+      source += "t" + std::to_string(term) + " OR (";
+    }
+    source += "t" + std::to_string(terms - 1);
+    source.append(terms - 1, ')');
+    return source;
+  });
+  rule_expression deepest(nested_or(63));
+  EXPECT_EQ(deepest.leaves().size(), 63);
+  EXPECT_TRUE(holds(deepest, {"t62"}));
+  EXPECT_TRUE(holds(deepest, {"t0"}));
+
+  // operands pile up across precedence levels within the nesting limit
+  std::string pending;
+  for (size_t level = 0; level < 40; ++level) {
+    pending += "a OR b AND (";
+  }
+  pending += "c" + std::string(40, ')');
+  EXPECT_THROW(rule_expression{pending}, std::invalid_argument);
+
+  std::string negated;
+  for (size_t level = 0; level < 70; ++level) {
+    negated += "NOT ";
+  }
+  EXPECT_THROW(rule_expression{negated + "a"}, std::invalid_argument);
+  EXPECT_THROW(rule_expression{std::string(70, '(') + "a" +
+                               std::string(70, ')')},
+               std::invalid_argument);
+  // deep is fine within the limit
+  EXPECT_NO_THROW(rule_expression{std::string(rule_expression::MaxDepth, '(') +
+                                  "a" +
+                                  std::string(rule_expression::MaxDepth, ')')});
+}
+
+TEST(RuleExpressionTest, CrossFieldTerms) {
+  // never in one candidate
+  for (auto const source :
+       {"displayname:bot AND description:crypto",
+        "displayname:bot description:crypto",
+        "displayname:bot NEAR/3 description:crypto",
+        "(displayname:bot AND scam) AND description:crypto",
+        "(displayname:bot NEAR/2 scam) description:crypto"}) {
+    EXPECT_THROW(rule_expression{source}, std::invalid_argument) << source;
+  }
+  // one field can hold all the terms needed
+  for (auto const source :
+       {"displayname:bot AND displayName:farm", "displayname:bot AND crypto",
+        "displayname:bot AND NOT description:crypto",
+        "(displayname:bot OR description:bot) AND description:crypto",
+        "displayname:bot OR description:crypto"}) {
+    EXPECT_NO_THROW(rule_expression{source}) << source;
+  }
+}
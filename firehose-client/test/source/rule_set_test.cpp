@@ -0,0 +1,323 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "case_folding.hpp"
+#include "json_scanner.hpp"
+#include "matcher.hpp"
+
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+
+namespace {
+typedef rule_set::content_scope content_scope;
+
+matcher::rule make_rule(std::string const &target,
+                        std::string const &actions = "",
+                        std::string const &contingent = "") {
+  return matcher::rule(target, "spam",
+                       actions.empty() ? "track=true" : "track=true," + actions,
+                       contingent);
+}
+
+std::vector<rule_id> scan(rule_set const &rules, std::string_view text,
+                          const content_scope scope = content_scope::any,
+                          std::string_view field = "/text") {
+  std::vector<rule_id> hits;
+  rules.scan(text, scope, field, hits);
+  return hits;
+}
+
+std::shared_ptr<const rule_set>
+compiled(std::vector<std::string> const &targets) {
+  auto rules(std::make_shared<rule_set>());
+  for (auto const &target : targets) {
+    rules->insert(make_rule(target));
+  }
+  rules->compile();
+  return rules;
+}
+
+std::vector<matcher::rule> rules_for(std::vector<std::string> const &targets) {
+  std::vector<matcher::rule> rules;
+  for (auto const &target : targets) {
+    rules.push_back(make_rule(target));
+  }
+  return rules;
+}
+} // namespace
+
+TEST(RuleSetTest, IdsFollowInsertOrder) {
+  rule_set rules;
+  EXPECT_TRUE(rules.insert(make_rule("scam")));
+  EXPECT_TRUE(rules.insert(make_rule("spam", "match=word")));
+  EXPECT_TRUE(rules.insert(make_rule("fraud")));
+  rules.compile();
+  ASSERT_EQ(rules.size(), 3);
+  EXPECT_EQ(rules.at(0)._target, "scam");
+  EXPECT_EQ(rules.at(1)._target, "spam");
+  EXPECT_EQ(rules.at(2)._keyword, "fraud");
+  EXPECT_EQ(rules.find(make_rule("spam", "match=word").to_string()), 1);
+  EXPECT_EQ(rules.find(make_rule("spam").to_string()), std::nullopt);
+  EXPECT_EQ(rules.version(), 0);
+}
+
+TEST(RuleSetTest, SkipsUntrackedAndDuplicates) {
+  rule_set rules;
+  EXPECT_FALSE(rules.insert(matcher::rule("scam", "spam", "track=false", "")));
+  EXPECT_TRUE(rules.insert(make_rule("Scam")));
+  // same folded target, first one wins
+  EXPECT_TRUE(rules.insert(make_rule("SCAM", "report=true")));
+  rules.compile();
+  ASSERT_EQ(rules.size(), 1);
+  EXPECT_FALSE(rules.at(0)._report);
+  EXPECT_THAT(scan(rules, "a scam"), ElementsAre(0));
+}
+
+TEST(RuleSetTest, ScanReportsRuleIds) {
+  rule_set rules;
+  rules.insert(make_rule("scam"));
+  rules.insert(make_rule("art", "match=word"));
+  rules.insert(make_rule("prize", "", "claim,!legit"));
+  rules.compile();
+  // one hit per occurrence of a substring
+  EXPECT_THAT(scan(rules, "scam after scam"), ElementsAre(0, 0));
+  EXPECT_THAT(scan(rules, "art for sale"), ElementsAre(1));
+  EXPECT_THAT(scan(rules, "a startup"), IsEmpty());
+  // contingent strings, one required and none forbidden
+  EXPECT_THAT(scan(rules, "claim your prize"), ElementsAre(2));
+  EXPECT_THAT(scan(rules, "your prize"), IsEmpty());
+  EXPECT_THAT(scan(rules, "claim your legit prize"), IsEmpty());
+  EXPECT_TRUE(rules.matches_any_substring("scammer", content_scope::any));
+  // whole word rules are not substring matches
+  EXPECT_FALSE(rules.matches_any_substring("startup", content_scope::any));
+}
+
+TEST(RuleSetTest, OverlayFollowsBase) {
+  auto base(compiled({"scam", "spam", "fraud"}));
+  // spam removed
+  rule_set overlay(base, {false, true, false});
+  EXPECT_EQ(overlay.base(), base);
+  EXPECT_TRUE(overlay.insert(make_rule("phish")));
+  overlay.compile();
+  ASSERT_EQ(overlay.size(), 4);
+  EXPECT_EQ(overlay.at(0)._target, "scam");
+  EXPECT_EQ(overlay.at(3)._target, "phish");
+  EXPECT_EQ(overlay.find(make_rule("phish").to_string()), 3);
+  EXPECT_EQ(overlay.find(make_rule("scam").to_string()), std::nullopt);
+  // base rules keep their IDs, hidden ones never match
+  EXPECT_THAT(scan(overlay, "scam spam fraud phish"), ElementsAre(0, 2, 3));
+  EXPECT_THAT(scan(overlay, "spam"), IsEmpty());
+  EXPECT_FALSE(overlay.matches_any_substring("spam", content_scope::any));
+  EXPECT_TRUE(overlay.matches_any_substring("phishing", content_scope::any));
+}
+
+TEST(RuleSetTest, DuplicatesAcrossLayers) {
+  auto base(compiled({"scam", "spam"}));
+  rule_set overlay(base, {false, true});
+  // a visible base rule keeps its target
+  EXPECT_TRUE(overlay.insert(make_rule("SCAM", "report=true")));
+  // a hidden one does not
+  EXPECT_TRUE(overlay.insert(make_rule("spam", "report=true")));
+  overlay.compile();
+  ASSERT_EQ(overlay.size(), 3);
+  EXPECT_TRUE(overlay.at(2)._report);
+  EXPECT_THAT(scan(overlay, "scam spam"), ElementsAre(0, 2));
+}
+
+TEST(RuleSetTest, RefreshPaths) {
+  // unchanged: the same rules in any order
+  EXPECT_EQ(rule_set::fingerprint(rules_for({"a", "b", "c"})),
+            rule_set::fingerprint(rules_for({"c", "a", "b"})));
+  EXPECT_NE(rule_set::fingerprint(rules_for({"a", "b", "c"})),
+            rule_set::fingerprint(rules_for({"a", "b", "d"})));
+
+  const std::vector<std::string> targets{"one", "two",   "three", "four",
+                                         "five", "six", "seven", "eight"};
+  auto base(compiled(targets));
+  // one replaced: two changes in eight rules are overlaid
+  auto replacement(rules_for(targets));
+  replacement[1] = make_rule("nine");
+  auto overlay(rule_set::overlay_for(base, replacement));
+  ASSERT_NE(overlay, nullptr);
+  EXPECT_EQ(overlay->base(), base);
+  ASSERT_EQ(overlay->size(), 9);
+  EXPECT_EQ(overlay->at(8)._target, "nine");
+  EXPECT_THAT(scan(*overlay, "two nine one"), ElementsAre(0, 8));
+
+  // another refresh diffs against the base, not the overlay
+  std::shared_ptr<const rule_set> current(std::move(overlay));
+  auto next(rules_for(targets));
+  next[2] = make_rule("ten");
+  overlay = rule_set::overlay_for(current, next);
+  ASSERT_NE(overlay, nullptr);
+  EXPECT_EQ(overlay->base(), base);
+  ASSERT_EQ(overlay->size(), 9);
+  EXPECT_THAT(scan(*overlay, "two nine three ten"), ElementsAre(1, 8));
+
+  // three replaced: a rebuild, replacement untouched
+  auto rebuild(rules_for(targets));
+  rebuild[0] = make_rule("x");
+  rebuild[1] = make_rule("y");
+  rebuild[2] = make_rule("z");
+  EXPECT_EQ(rule_set::overlay_for(base, rebuild), nullptr);
+  EXPECT_EQ(rebuild[0]._target, "x");
+  // nothing to overlay
+  auto empty(std::make_shared<rule_set>());
+  auto first(rules_for(targets));
+  EXPECT_EQ(rule_set::overlay_for(empty, first), nullptr);
+}
+
+TEST(RuleSetTest, CompiledFileRoundTrip) {
+  const std::filesystem::path path(std::filesystem::temp_directory_path() /
+                                   "rule_set_test.rules");
+  std::filesystem::remove(path);
+  const std::vector<std::string> targets{"scam", "spam", "fraud"};
+  auto original(compiled(targets));
+  original->save_compiled(path, 42);
+  ASSERT_TRUE(std::filesystem::exists(path));
+
+  rule_set loaded;
+  ASSERT_TRUE(loaded.load_compiled(path, 42));
+  for (auto &next : rules_for(targets)) {
+    loaded.insert(std::move(next));
+  }
+  EXPECT_TRUE(loaded.matches_compiled());
+  loaded.compile();
+  EXPECT_THAT(scan(loaded, "fraud, spam and scam"), ElementsAre(2, 1, 0));
+  EXPECT_EQ(scan(loaded, "fraud, spam and scam"),
+            scan(*original, "fraud, spam and scam"));
+
+  // built from other rules
+  rule_set stale;
+  EXPECT_FALSE(stale.load_compiled(path, 43));
+  rule_set other;
+  ASSERT_TRUE(other.load_compiled(path, 42));
+  other.insert(make_rule("scam"));
+  EXPECT_FALSE(other.matches_compiled());
+  std::filesystem::remove(path);
+}
+
+TEST(RuleSetTest, ScopeSelectsPartition) {
+  EXPECT_EQ(rule_set::scope_of({"app.bsky.actor.profile", "description", ""}),
+            content_scope::profile);
+  EXPECT_EQ(
+      rule_set::scope_of({"app.bsky.feed.post", "/embed/external/uri", ""}),
+      content_scope::link);
+  EXPECT_EQ(rule_set::scope_of({"app.bsky.feed.post",
+                                "app.bsky.richtext.facet#link", ""}),
+            content_scope::link);
+  // as embed_checker passes a redirect, typed by the URL it came from
+  EXPECT_EQ(
+      rule_set::scope_of({"https://short.example/x", "redirected_url", ""}),
+      content_scope::link);
+  EXPECT_EQ(rule_set::scope_of({"app.bsky.feed.post", "/text", ""}),
+            content_scope::any);
+
+  rule_set rules;
+  rules.insert(make_rule("bot", "scope=profile"));
+  rules.insert(make_rule("badsite", "scope=link"));
+  rules.insert(make_rule("scam"));
+  rules.compile();
+  const std::string text("bot scam badsite");
+  EXPECT_THAT(scan(rules, text, content_scope::profile), ElementsAre(2, 0));
+  EXPECT_THAT(scan(rules, text, content_scope::link), ElementsAre(2, 1));
+  EXPECT_THAT(scan(rules, text, content_scope::any), ElementsAre(2));
+  EXPECT_TRUE(rules.matches_any_substring("bot", content_scope::profile));
+  EXPECT_FALSE(rules.matches_any_substring("bot", content_scope::any));
+}
+
+TEST(RuleSetTest, ExactTokens) {
+  rule_set rules;
+  rules.insert(make_rule("#scamcoin", "match=exact"));
+  rules.insert(make_rule("@bad.example.com", "match=exact"));
+  rules.insert(make_rule("evil.example", "match=exact"));
+  rules.insert(make_rule("spammer", "match=exact"));
+  rules.compile();
+  EXPECT_EQ(rules.at(1)._keyword, "bad.example.com");
+  // hashtag
+  EXPECT_THAT(scan(rules, "buy #scamcoin now"), ElementsAre(0));
+  EXPECT_THAT(scan(rules, "buy #scamcoins now"), IsEmpty());
+  EXPECT_THAT(scan(rules, "buy scamcoin#scamcoin"), IsEmpty());
+  // mention, as the handle
+  EXPECT_THAT(scan(rules, "ask @bad.example.com."), ElementsAre(1));
+  EXPECT_THAT(scan(rules, "bad.example.com"), ElementsAre(1));
+  // link host
+  EXPECT_THAT(scan(rules, "see https://evil.example/path?q=1"),
+              ElementsAre(2));
+  EXPECT_THAT(scan(rules, "see https://not.evil.example/"), IsEmpty());
+  // a whole text of one word, but not a word in a text
+  EXPECT_THAT(scan(rules, "spammer"), ElementsAre(3));
+  EXPECT_THAT(scan(rules, "a spammer"), IsEmpty());
+  EXPECT_TRUE(rules.matches_any_substring("#scamcoin", content_scope::any));
+}
+
+TEST(RuleSetTest, ExactTokensInRecordFields) {
+  rule_set rules;
+  rules.insert(make_rule("#scamcoin", "match=exact"));
+  rules.insert(make_rule("evil.example", "match=exact"));
+  rules.insert(make_rule("spammer", "match=exact"));
+  rules.compile();
+  // as parser::get_candidates_from_record serializes a field
+  EXPECT_THAT(scan(rules, nlohmann::to_string(nlohmann::json("spammer"))),
+              ElementsAre(2));
+  EXPECT_THAT(
+      scan(rules, nlohmann::to_string(nlohmann::json("https://evil.example"))),
+      ElementsAre(1));
+  // as json_scanner extracts them, escapes included
+  auto candidates(json_scanner::candidates(
+      R"({"kind":"commit","commit":{"operation":"create","record":)"
+      R"({"$type":"app.bsky.feed.post","text":"Say \"hi\" #ScamCoin",)"
+      R"("embed":{"external":{"uri":"https://Evil.example"}}}}})"));
+  ASSERT_TRUE(candidates.has_value());
+  ASSERT_EQ(candidates->size(), 2);
+  std::vector<rule_id> hits;
+  for (auto const &next : candidates.value()) {
+    std::vector<rule_id> found(scan(rules, case_folding::folded(next._value),
+                                    rule_set::scope_of(next), next._field));
+    hits.insert(hits.end(), found.cbegin(), found.cend());
+  }
+  EXPECT_THAT(hits, ElementsAre(0, 1));
+  // a quoted word is still one word
+  EXPECT_THAT(scan(rules, nlohmann::to_string(nlohmann::json("a spammer"))),
+              IsEmpty());
+}
+
+TEST(RuleSetTest, Expressions) {
+  rule_set rules;
+  rules.insert(make_rule("scam AND (crypto OR wallet) AND NOT giveaway",
+                         "match=expr"));
+  rules.insert(make_rule("free NEAR/2 followers", "match=expr"));
+  rules.insert(make_rule("displayname:bot OR description:bot", "match=expr"));
+  rules.compile();
+  EXPECT_THAT(scan(rules, "crypto scam"), ElementsAre(0));
+  EXPECT_THAT(scan(rules, "wallet scam scam"), ElementsAre(0));
+  EXPECT_THAT(scan(rules, "scam"), IsEmpty());
+  EXPECT_THAT(scan(rules, "crypto scam giveaway"), IsEmpty());
+  // state from one scan does not leak into the next
+  EXPECT_THAT(scan(rules, "crypto"), IsEmpty());
+
+  EXPECT_THAT(scan(rules, "free real followers"), ElementsAre(1));
+  EXPECT_THAT(scan(rules, "free and many real followers"), IsEmpty());
+
+  EXPECT_THAT(scan(rules, "a bot", content_scope::any, "displayName"),
+              ElementsAre(2));
+  EXPECT_THAT(scan(rules, "a bot", content_scope::any, "/text"), IsEmpty());
+}
+
+TEST(RuleSetTest, LinkFieldsInExpressions) {
+  rule_set rules;
+  rules.insert(make_rule("uri:spam.example", "match=expr"));
+  rules.compile();
+  const std::string link("https://spam.example/x");
+  EXPECT_THAT(scan(rules, link, content_scope::link, "/embed/external/uri"),
+              ElementsAre(0));
+  EXPECT_THAT(scan(rules, link, content_scope::link,
+                   "app.bsky.richtext.facet#link"),
+              ElementsAre(0));
+  EXPECT_THAT(scan(rules, link, content_scope::link, "redirected_url"),
+              ElementsAre(0));
+  EXPECT_THAT(scan(rules, link, content_scope::any, "/text"), IsEmpty());
+}
@@ -0,0 +1,81 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+#include "scan_cache.hpp"
+
+TEST(ScanCacheTest, Disabled) {
+  scan_cache cache;
+  EXPECT_FALSE(cache.is_enabled());
+  cache.set_capacity(0);
+  EXPECT_FALSE(cache.is_enabled());
+}
+
+TEST(ScanCacheTest, FindStored) {
+  scan_cache cache;
+  cache.set_capacity(1024);
+  ASSERT_TRUE(cache.is_enabled());
+  std::string text("repeated spam reply");
+  const uint64_t text_hash(scan_cache::hash(text));
+  std::vector<uint32_t> hits{7};
+  EXPECT_FALSE(cache.find(text, "/text", text_hash, 1, hits));
+  EXPECT_THAT(hits, ::testing::ElementsAre(7));
+
+  cache.store(text, "/text", text_hash, 1, {3, 5, 3});
+  EXPECT_TRUE(cache.find(text, "/text", text_hash, 1, hits));
+  EXPECT_THAT(hits, ::testing::ElementsAre(3, 5, 3));
+
+  // no hits is a result too
+  std::string clean("nothing to see");
+  const uint64_t clean_hash(scan_cache::hash(clean));
+  cache.store(clean, "/text", clean_hash, 1, {});
+  EXPECT_TRUE(cache.find(clean, "/text", clean_hash, 1, hits));
+  EXPECT_TRUE(hits.empty());
+}
+
+TEST(ScanCacheTest, NewRulesMiss) {
+  scan_cache cache;
+  cache.set_capacity(1024);
+  std::string text("display name");
+  const uint64_t text_hash(scan_cache::hash(text));
+  cache.store(text, "/text", text_hash, 1, {2});
+  std::vector<uint32_t> hits;
+  EXPECT_FALSE(cache.find(text, "/text", text_hash, 2, hits));
+  cache.store(text, "/text", text_hash, 2, {4});
+  EXPECT_TRUE(cache.find(text, "/text", text_hash, 2, hits));
+  EXPECT_THAT(hits, ::testing::ElementsAre(4));
+  EXPECT_FALSE(cache.find(text, "/text", text_hash, 1, hits));
+}
+
+TEST(ScanCacheTest, SlotReplaced) {
+  scan_cache cache;
+  // one slot per shard, so texts in the same shard evict each other
+  cache.set_capacity(scan_cache::ShardCount);
+  std::string first("first");
+  const uint64_t first_hash(0);
+  std::string second("second");
+  const uint64_t second_hash(scan_cache::ShardCount);
+  cache.store(first, "/text", first_hash, 1, {1});
+  cache.store(second, "/text", second_hash, 1, {2});
+  std::vector<uint32_t> hits;
+  EXPECT_FALSE(cache.find(first, "/text", first_hash, 1, hits));
+  EXPECT_TRUE(cache.find(second, "/text", second_hash, 1, hits));
+  EXPECT_THAT(hits, ::testing::ElementsAre(2));
+}
+
+TEST(ScanCacheTest, CollidingHashesMiss) {
+  scan_cache cache;
+  cache.set_capacity(1024);
+  std::string text("harmless text");
+  std::string other("other text!!!");
+  ASSERT_EQ(text.length(), other.length());
+  // as if both hashed the same
+  const uint64_t text_hash(scan_cache::hash(text));
+  cache.store(text, "/text", text_hash, 1, {9});
+  std::vector<uint32_t> hits;
+  EXPECT_FALSE(cache.find(other, "/text", text_hash, 1, hits));
+  EXPECT_FALSE(cache.find(text, "description", text_hash, 1, hits));
+  EXPECT_TRUE(cache.find(text, "/text", text_hash, 1, hits));
+  EXPECT_THAT(hits, ::testing::ElementsAre(9));
+}
@@ -0,0 +1,68 @@
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <string>
+
+#include "word_breaks.hpp"
+
+namespace {
+// whole-word test of the first occurrence of word in text
+bool whole_word(word_breaks &breaks, std::string const &text,
+                std::string const &word) {
+  const size_t start(text.find(word));
+  breaks.reset(text);
+  return breaks.is_whole_word(start, start + word.length());
+}
+} // namespace
+
+TEST(WordBreaksTest, Latin) {
+  word_breaks breaks;
+  EXPECT_TRUE(whole_word(breaks, "a rapist, again", "rapist"));
+  EXPECT_FALSE(whole_word(breaks, "therapist", "rapist"));
+  EXPECT_TRUE(whole_word(breaks, "rapist", "rapist"));
+  EXPECT_TRUE(whole_word(breaks, "l'été dernier", "été"));
+  EXPECT_FALSE(whole_word(breaks, "étés", "été"));
+}
+
+TEST(WordBreaksTest, Cyrillic) {
+  word_breaks breaks;
+  EXPECT_TRUE(whole_word(breaks, "слово хохол тут", "хохол"));
+  EXPECT_FALSE(whole_word(breaks, "хохлы", "хохл"));
+}
+
+TEST(WordBreaksTest, Japanese) {
+  word_breaks breaks;
+  EXPECT_TRUE(whole_word(breaks, "東京に行く", "東京"));
+  EXPECT_FALSE(whole_word(breaks, "東京に行く", "京"));
+  EXPECT_FALSE(whole_word(breaks, "東京に行く", "東"));
+}
+
+TEST(WordBreaksTest, Thai) {
+  word_breaks breaks;
+  // hello + polite particle, no space between the words
+  EXPECT_TRUE(whole_word(breaks, "สวัสดีครับ", "สวัสดี"));
+  EXPECT_FALSE(whole_word(breaks, "สวัสดีครับ", "สวัส"));
+}
+
+TEST(WordBreaksTest, MixedScripts) {
+  word_breaks breaks;
+  // Latin in text that is segmented still splits on spaces and punctuation
+  EXPECT_TRUE(whole_word(breaks, "spam 東京 spam, ok", "ok"));
+  EXPECT_FALSE(whole_word(breaks, "spammer 東京", "spam"));
+  // Latin against Han with no space between
+  EXPECT_TRUE(whole_word(breaks, "spam東京", "spam"));
+  EXPECT_FALSE(whole_word(breaks, "東京spammer", "spam"));
+}
+
+TEST(WordBreaksTest, LatinWithEmojiAndPunctuation) {
+  word_breaks breaks;
+  // emoji, dashes and curly quotes elsewhere do not change a Latin match
+  EXPECT_TRUE(whole_word(breaks, "nazi88 rally", "nazi"));
+  EXPECT_TRUE(whole_word(breaks, "nazi88 rally🙂", "nazi"));
+  EXPECT_TRUE(whole_word(breaks, "nazi's rally — ok", "nazi"));
+  EXPECT_TRUE(whole_word(breaks, "nazi’s rally", "nazi"));
+  EXPECT_TRUE(whole_word(breaks, "🙂nazi🙂", "nazi"));
+  EXPECT_TRUE(whole_word(breaks, "—nazi—", "nazi"));
+  EXPECT_FALSE(whole_word(breaks, "therapist 🙂", "rapist"));
+  EXPECT_FALSE(whole_word(breaks, "— spammer —", "spam"));
+  EXPECT_FALSE(whole_word(breaks, "antispam 🙂", "spam"));
+}